@@ -22,6 +22,6 @@
 ##
 # Submakes to handle:
 ##
-SUBMAKES := hello1.mk hello2.mk hello3.mk hello4.mk hello5.mk
+SUBMAKES := hello1.mk hello2.mk hello3.mk hello4.mk hello5.mk hello6.mk hello7.mk
 export SUBMAKES
 
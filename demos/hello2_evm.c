@@ -27,6 +27,9 @@
  * 1. The MAIN part shows standard C program initialization with options for
  *    different logging capabilities of EVM.
  * 2. The EVM part demonstrates EVM initialization. 
+ * The socket I/O is done by the event loop itself (evm_io_recv_add(),
+ * evm_io_send()) - via io_uring, if available - no separate receiver
+ * thread required.
 */
 
 #ifndef EVM_FILE_hello2_evm_c
@@ -43,7 +46,6 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
-#include <pthread.h>
 
 #include <evm/libevm.h>
 #include "hello2_evm.h"
@@ -77,8 +79,6 @@ static evmTimerStruct * hello_start_timer(evmConsumerStruct *consumer_ptr, evmTi
 
 static int hello2_fork_and_connect(void);
 static int hello2_socket_send_hello(int sock);
-static int hello2_receive(int sock);
-static int hello2_parse(evmMessageStruct *msg);
 
 static int evHelloMsg(evmConsumerStruct *consumer, evmMessageStruct *msg);
 static int evHelloTmrIdle(evmConsumerStruct *consumer, evmTimerStruct *tmr);
@@ -288,9 +288,21 @@ static int evHelloMsg(evmConsumerStruct *consumer, evmMessageStruct *msg)
 	if (msg == NULL)
 		return -1;
 
+	if ((iov_buff = (struct iovec *)evm_message_data_get(msg)) == NULL)
+		return -1;
+
+	/* Over symplified message parsing:) */
+	if (iov_buff->iov_len == 0) {
+		u2up_log_notice("Peer gone (%d messages sent)!\n", count);
+		exit(EXIT_SUCCESS);
+	}
+	if (strncmp((char *)iov_buff->iov_base, hello_str, strlen(hello_str)) != 0) {
+		u2up_log_debug("No event decoded (unknown data: %s).\n", (char *)iov_buff->iov_base);
+		return -1;
+	}
+	sscanf((char *)iov_buff->iov_base, "HELLO: %d", &count);
+
 	if (demo_liveloop == 0) {
-		if ((iov_buff = (struct iovec *)evm_message_data_get(msg)) == NULL)
-			return -1;
 		u2up_log_notice("HELLO msg received: \"%s\"\n", (char *)iov_buff->iov_base);
 
 		helloIdleTmr = hello_start_timer(consumer, NULL, 10, 0, NULL, tmrid_idle_ptr);
@@ -359,9 +371,6 @@ static int hello2_fork_and_connect(void)
 static int hello2_socket_send_hello(int sock)
 {
 	struct iovec *iov_buff = NULL;
-	struct msghdr msg;
-	int err_save = EINVAL;
-	int ret;
 	u2up_log_info("(entry) sockfd=%d\n", sock);
 
 	if ((iov_buff = (struct iovec *)evm_message_data_get(helloMsg)) == NULL) {
@@ -370,105 +379,15 @@ static int hello2_socket_send_hello(int sock)
 	/* Prepare message buffer. */
 	sprintf((char *)iov_buff->iov_base, "%s: %d", hello_str, ++count);
 	iov_buff->iov_len = strlen(iov_buff->iov_base);
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = iov_buff;
-	msg.msg_iovlen = 1;
-	msg.msg_control = NULL;
-	msg.msg_controllen = 0;
-	/* Send HELLO message. */
+	/* Send HELLO message (submitted after this event loop pass). */
 	if (demo_liveloop == 0)
 		u2up_log_notice("HELLO msg send: \"%s\"\n", (char *)iov_buff->iov_base);
-	ret = sendmsg(sock, &msg, 0);
-	if (ret == -1) {
-		err_save = errno;
-		if (err_save != EINTR) {
-			u2up_log_system_error("sendmsg(): sockfd=%d\n", sock);
-		}
-		return -err_save;
-	}
-
-	u2up_log_debug("sent=%d\n", ret);
-	return ret;
-}
-
-/*
- * Over symplified message parsing:)
- */
-static int hello2_parse(evmMessageStruct *msg)
-{
-	int rv = 0;
-	struct iovec *iov_buff = NULL;
-	u2up_log_info("(entry) iov_buff=%p\n", iov_buff);
-
-	iov_buff = (struct iovec*)evm_message_data_get(msg);
-	if (iov_buff == NULL) {
-		u2up_log_debug("Receive buffer is NULL.\n");
+	if (evm_io_send(consumer, sock, iov_buff->iov_base, iov_buff->iov_len) < 0) {
+		u2up_log_error("evm_io_send() failed!\n");
 		return -1;
 	}
-	u2up_log_debug("iov_buff->iov_len=%zd\n", iov_buff->iov_len);
-	if (iov_buff->iov_len == 0) {
-		u2up_log_debug("No event decoded (empty receive buffer).\n");
-		return -1;
-	} else {
-		/* Decode the INPUT buffer. */ 
-		((char *)iov_buff->iov_base)[iov_buff->iov_len] = '\0';
-		if (strncmp((char *)iov_buff->iov_base, hello_str, strlen(hello_str)) == 0) {
-			sscanf((char *)iov_buff->iov_base, "HELLO: %d", &count);
-			rv = evm_message_pass(consumer, msg);
-		} else {
-			u2up_log_debug("No event decoded (unknown data: %s).\n", (char *)iov_buff->iov_base);
-			return -1;
-		}
-	}
 
-	return rv;
-}
-
-static int hello2_receive(int sock)
-{
-	struct iovec *iov_buff = NULL;
-	struct msghdr msg;
-	evmMessageStruct *evm_msg;
-	int err_save = EINVAL;
-	int ret;
-	u2up_log_info("(cb entry) sock=%d\n", sock);
-
-	if ((evm_msg = evm_message_new(msgtype_hello_ptr, msgid_hello_ptr, sizeof(struct iovec))) == NULL) {
-		u2up_log_error("evm_message_new() failed!\n");
-		return -1;
-	}
-	if ((iov_buff = (struct iovec *)evm_message_data_get(evm_msg)) == NULL)
-		return -1;
-	else {
-		if ((iov_buff->iov_base = calloc(MAX_BUFF_SIZE, sizeof(char))) == NULL)
-			return -1;
-	}
-	if (evm_message_alloc_add(evm_msg, iov_buff->iov_base) != 0) {
-		free(iov_buff);
-		return -1;
-	}
-
-	/* Prepare receive buffer. */
-	iov_buff->iov_len = MAX_BUFF_SIZE;
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = iov_buff;
-	msg.msg_iovlen = 1;
-	msg.msg_control = NULL;
-	msg.msg_controllen = 0;
-	/* Receive whatever message comes in. */
-	ret = recvmsg(sock, &msg, 0);
-	if (ret == -1) {
-		err_save = errno;
-		if (err_save != EINTR) {
-			u2up_log_system_error("recvmsg(): sock=%d\n", sock);
-		}
-		return -err_save;
-	}
-	iov_buff->iov_len = ret;
-	((char *)(iov_buff->iov_base))[ret] = '\0';
-
-	u2up_log_debug("buffered=%zd, received data: %s\n", iov_buff->iov_len, (char *)iov_buff->iov_base);
-	return hello2_parse(evm_msg);
+	return iov_buff->iov_len;
 }
 
 /* EVM initialization */
@@ -537,24 +456,9 @@ static int hello2_evm_init(void)
 	return rv;
 }
 
-/* Socker receiver thread processing loop */
-static void * hello2_socket_receiver_thread_start(void *arg)
-{
-	u2up_log_info("(entry)\n");
-
-	while (1) {
-		if (hello2_receive(sock) < 0)
-			break;
-	}
-	return NULL;
-}
-
 /* Main core processing (event loop) */
 static int hello2_evm_run(void)
 {
-	int rv = 0;
-	pthread_attr_t attr;
-	pthread_t socket_receiver_thread;
 	u2up_log_info("(entry) child=%d\n", child);
 
 	/* Send first HELLO to the child process! */
@@ -566,11 +470,11 @@ static int hello2_evm_run(void)
 	helloQuitTmr = hello_start_timer(consumer, NULL, 60, 0, NULL, tmrid_quit_ptr);
 	u2up_log_notice("QUIT timer set: 60 s\n");
 
-	if ((rv = pthread_attr_init(&attr)) != 0)
-		u2up_log_return_system_err("pthread_attr_init()\n");
-
-	if ((rv = pthread_create(&socket_receiver_thread, &attr, hello2_socket_receiver_thread_start, NULL)) != 0)
-		u2up_log_return_system_err("pthread_create()\n");
+	/* Receive HELLO messages from the socket within the event loop */
+	if (evm_io_recv_add(consumer, sock, msgtype_hello_ptr, msgid_hello_ptr, NULL) < 0) {
+		u2up_log_error("evm_io_recv_add() failed!\n");
+		return -1;
+	}
 
 	/*
 	 * Main thread EVM processing (event loop)
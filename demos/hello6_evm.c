@@ -0,0 +1,428 @@
+/*
+ * The hello6_evm demo program
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+/*
+ * This demo is a benchmark of content-based subscription filters. Single
+ * thread posts messages to topics subscribed by many consumers, each of them
+ * interested only in messages with its own value of the message field 0
+ * (1 of 100 values - 1% selectivity):
+ * - The PLAIN topic is subscribed without filters - every message is queued
+ *   for every consumer, which discards messages of other values.
+ * - The FILTERED topic is subscribed with field ranges filter - messages are
+ *   matched in evm_message_post() and queued only for interested consumers.
+ * Posting and handling (draining consumer queues) times are reported for
+ * both topics.
+ * 1. The MAIN part shows standard C program initialization with options for
+ *    different logging capabilities of EVM.
+ * 2. The EVM part demonstrates EVM initialization and the benchmark. 
+*/
+
+#ifndef EVM_FILE_hello6_evm_c
+#define EVM_FILE_hello6_evm_c
+#else
+#error Preprocesor macro EVM_FILE_hello6_evm_c conflict!
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <evm/libevm.h>
+#include "hello6_evm.h"
+
+#define U2UP_LOG_NAME DEMO6EVM
+#include <u2up-log/u2up-log.h>
+/* Declare all other used "u2up-log" modules: */
+U2UP_LOG_DECLARE(EVM_CORE);
+U2UP_LOG_DECLARE(EVM_MSGS);
+U2UP_LOG_DECLARE(EVM_TMRS);
+U2UP_LOG_DECLARE(EVM_FLTR);
+
+enum evm_topic_ids {
+	EVM_TOPIC_ID_PLAIN = 0,
+	EVM_TOPIC_ID_FILTERED
+};
+
+enum evm_msgtype_ids {
+	EV_TYPE_UNKNOWN_MSG = 0,
+	EV_TYPE_HELLO_MSG
+};
+
+enum evm_msg_ids {
+	EV_ID_HELLO_MSG_HELLO = 0
+};
+
+static int evHelloMsg(evmConsumerStruct *consumer, evmMessageStruct *msg_ptr);
+
+static int hello6_evm_init(void);
+static int hello6_evm_run(void);
+
+/*
+ * The MAIN part.
+ */
+unsigned int log_mask;
+int num_consumers = HELLO6_NUM_CONSUMERS;
+
+static void usage_help(char *argv[])
+{
+	printf("Usage:\n");
+	printf("\t%s [options] [num_consumers]\n", argv[0]);
+	printf("options:\n");
+	printf("\t-q, --quiet              Disable all output.\n");
+	printf("\t-v, --verbose            Enable verbose output.\n");
+#if (U2UP_LOG_MODULE_TRACE != 0)
+	printf("\t-t, --trace              Enable trace output.\n");
+#endif
+#if (U2UP_LOG_MODULE_DEBUG != 0)
+	printf("\t-g, --debug              Enable debug output.\n");
+#endif
+	printf("\t-s, --syslog             Enable syslog output (instead of stdout, stderr).\n");
+	printf("\t-n, --no-header          No U2UP_LOG header added to every u2up_log_... output.\n");
+	printf("\t-h, --help               Displays this text.\n");
+}
+
+static int usage_check(int argc, char *argv[])
+{
+	int c;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"quiet", 0, 0, 'q'},
+			{"verbose", 0, 0, 'v'},
+#if (U2UP_LOG_MODULE_TRACE != 0)
+			{"trace", 0, 0, 't'},
+#endif
+#if (U2UP_LOG_MODULE_DEBUG != 0)
+			{"debug", 0, 0, 'g'},
+#endif
+			{"no-header", 0, 0, 'n'},
+			{"syslog", 0, 0, 's'},
+			{"help", 0, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+
+#if (U2UP_LOG_MODULE_TRACE != 0) && (U2UP_LOG_MODULE_DEBUG != 0)
+		c = getopt_long(argc, argv, "qvtgnsh", long_options, &option_index);
+#elif (U2UP_LOG_MODULE_TRACE == 0) && (U2UP_LOG_MODULE_DEBUG != 0)
+		c = getopt_long(argc, argv, "qvgnsh", long_options, &option_index);
+#elif (U2UP_LOG_MODULE_TRACE != 0) && (U2UP_LOG_MODULE_DEBUG == 0)
+		c = getopt_long(argc, argv, "qvtnsh", long_options, &option_index);
+#else
+		c = getopt_long(argc, argv, "qvnsh", long_options, &option_index);
+#endif
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'q':
+			U2UP_LOG_SET_NORMAL(0);
+			U2UP_LOG_SET_NORMAL2(EVM_CORE, 0);
+			U2UP_LOG_SET_NORMAL2(EVM_MSGS, 0);
+			U2UP_LOG_SET_NORMAL2(EVM_TMRS, 0);
+			U2UP_LOG_SET_NORMAL2(EVM_FLTR, 0);
+			break;
+
+		case 'v':
+			U2UP_LOG_SET_VERBOSE(1);
+			U2UP_LOG_SET_VERBOSE2(EVM_CORE, 1);
+			U2UP_LOG_SET_VERBOSE2(EVM_MSGS, 1);
+			U2UP_LOG_SET_VERBOSE2(EVM_TMRS, 1);
+			U2UP_LOG_SET_VERBOSE2(EVM_FLTR, 1);
+			break;
+
+#if (U2UP_LOG_MODULE_TRACE != 0)
+		case 't':
+			U2UP_LOG_SET_TRACE(1);
+			U2UP_LOG_SET_TRACE2(EVM_CORE, 1);
+			U2UP_LOG_SET_TRACE2(EVM_MSGS, 1);
+			U2UP_LOG_SET_TRACE2(EVM_TMRS, 1);
+			U2UP_LOG_SET_TRACE2(EVM_FLTR, 1);
+			break;
+#endif
+
+#if (U2UP_LOG_MODULE_DEBUG != 0)
+		case 'g':
+			U2UP_LOG_SET_DEBUG(1);
+			U2UP_LOG_SET_DEBUG2(EVM_CORE, 1);
+			U2UP_LOG_SET_DEBUG2(EVM_MSGS, 1);
+			U2UP_LOG_SET_DEBUG2(EVM_TMRS, 1);
+			U2UP_LOG_SET_DEBUG2(EVM_FLTR, 1);
+			break;
+#endif
+
+		case 'n':
+			U2UP_LOG_SET_HEADER(0);
+			U2UP_LOG_SET_HEADER2(EVM_CORE, 0);
+			U2UP_LOG_SET_HEADER2(EVM_MSGS, 0);
+			U2UP_LOG_SET_HEADER2(EVM_TMRS, 0);
+			U2UP_LOG_SET_HEADER2(EVM_FLTR, 0);
+			break;
+
+		case 's':
+			U2UP_LOG_SET_SYSLOG(1);
+			U2UP_LOG_SET_SYSLOG2(EVM_CORE, 1);
+			U2UP_LOG_SET_SYSLOG2(EVM_MSGS, 1);
+			U2UP_LOG_SET_SYSLOG2(EVM_TMRS, 1);
+			U2UP_LOG_SET_SYSLOG2(EVM_FLTR, 1);
+			break;
+
+		case 'h':
+			usage_help(argv);
+			exit(EXIT_SUCCESS);
+
+		case '?':
+			exit(EXIT_FAILURE);
+			break;
+
+		default:
+			printf("?? getopt returned character code 0%o ??\n", c);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind < argc) {
+		char *param = argv[optind];
+
+		if ((num_consumers = atoi(param)) > 0)
+			optind++;
+	}
+
+	if (optind < argc) {
+		printf("non-option ARGV-elements: ");
+		while (optind < argc)
+			printf("%s ", argv[optind++]);
+		printf("\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
+
+static evmStruct *evm;
+static evmMsgidStruct *msgid_hello_ptr;
+static evmMsgtypeStruct *msgtype_hello_ptr;
+
+static evmConsumerStruct **consumers;
+static evmTopicStruct *topic_plain;
+static evmTopicStruct *topic_filtered;
+
+int main(int argc, char *argv[])
+{
+	usage_check(argc, argv);
+
+	log_mask = LOG_MASK(LOG_EMERG) | LOG_MASK(LOG_ALERT) | LOG_MASK(LOG_CRIT) | LOG_MASK(LOG_ERR);
+
+	/* Setup LOG_MASK according to startup arguments! */
+	if (U2UP_LOG_GET_NORMAL()) {
+		log_mask |= LOG_MASK(LOG_WARNING);
+		log_mask |= LOG_MASK(LOG_NOTICE);
+	}
+	if ((U2UP_LOG_GET_VERBOSE()) || (U2UP_LOG_GET_TRACE()))
+		log_mask |= LOG_MASK(LOG_INFO);
+	if (U2UP_LOG_GET_DEBUG())
+		log_mask |= LOG_MASK(LOG_DEBUG);
+
+	setlogmask(log_mask);
+
+	if (hello6_evm_init() != 0)
+		exit(EXIT_FAILURE);
+
+	if (hello6_evm_run() < 0)
+		exit(EXIT_FAILURE);
+
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * The EVM part.
+ */
+
+/* Per consumer counters */
+struct hello6_counters {
+	long long value; /*field 0 value of interest*/
+	unsigned long received;
+	unsigned long accepted;
+};
+
+static struct hello6_counters *counters;
+
+/* HELLO event handlers */
+static int evHelloMsg(evmConsumerStruct *consumer, evmMessageStruct *msg_ptr)
+{
+	long long value;
+	struct hello6_counters *cnt = (struct hello6_counters *)evm_consumer_priv_get(consumer);
+	u2up_log_info("(cb entry) msg_ptr=%p\n", msg_ptr);
+
+	if ((msg_ptr == NULL) || (cnt == NULL))
+		return -1;
+
+	cnt->received++;
+	if (evm_message_field_get(msg_ptr, 0, &value) != 0)
+		return -1;
+
+	/* Discard messages of other values. */
+	if (value == cnt->value)
+		cnt->accepted++;
+
+	return 0;
+}
+
+/* EVM initialization */
+static int hello6_evm_init(void)
+{
+	int rv = 0;
+	int i;
+	evmFilterStruct filter;
+
+	u2up_log_info("(entry)\n");
+
+	/* Prepare consumers and counters tables */
+	if ((consumers = (evmConsumerStruct **)calloc(num_consumers, sizeof(evmConsumerStruct *))) == NULL)
+		return -1;
+	if ((counters = (struct hello6_counters *)calloc(num_consumers, sizeof(struct hello6_counters))) == NULL)
+		return -1;
+
+	/* Initialize event machine... */
+	if ((evm = evm_init()) != NULL) {
+		if ((rv == 0) && ((topic_plain = evm_topic_add(evm, EVM_TOPIC_ID_PLAIN)) == NULL)) {
+			u2up_log_error("evm_topic_add() failed!\n");
+			rv = -1;
+		}
+		if ((rv == 0) && ((topic_filtered = evm_topic_add(evm, EVM_TOPIC_ID_FILTERED)) == NULL)) {
+			u2up_log_error("evm_topic_add() failed!\n");
+			rv = -1;
+		}
+		if ((rv == 0) && ((msgtype_hello_ptr = evm_msgtype_add(evm, EV_TYPE_HELLO_MSG)) == NULL)) {
+			u2up_log_error("evm_msgtype_add() failed!\n");
+			rv = -1;
+		}
+		if ((rv == 0) && ((msgid_hello_ptr = evm_msgid_add(msgtype_hello_ptr, EV_ID_HELLO_MSG_HELLO)) == NULL)) {
+			u2up_log_error("evm_msgid_add() failed!\n");
+			rv = -1;
+		}
+		if ((rv == 0) && (evm_msgid_cb_handle_set(msgid_hello_ptr, evHelloMsg) < 0)) {
+			u2up_log_error("evm_msgid_cb_handle() failed!\n");
+			rv = -1;
+		}
+		for (i = 0; (rv == 0) && (i < num_consumers); i++) {
+			if ((consumers[i] = evm_consumer_add(evm, i)) == NULL) {
+				u2up_log_error("evm_consumer_add() failed!\n");
+				rv = -1;
+				break;
+			}
+			counters[i].value = i % HELLO6_FIELD_VALUES;
+			evm_consumer_priv_set(consumers[i], (void *)&counters[i]);
+			if (evm_topic_subscribe(consumers[i], EVM_TOPIC_ID_PLAIN) != topic_plain) {
+				u2up_log_error("evm_topic_subscribe() failed!\n");
+				rv = -1;
+				break;
+			}
+			/* Only messages with our value of the field 0 */
+			memset(&filter, 0, sizeof(filter));
+			filter.ranges_num = 1;
+			filter.ranges[0].field = 0;
+			filter.ranges[0].min = counters[i].value;
+			filter.ranges[0].max = counters[i].value;
+			if (evm_topic_subscribe_filter(consumers[i], EVM_TOPIC_ID_FILTERED, &filter) != topic_filtered) {
+				u2up_log_error("evm_topic_subscribe_filter() failed!\n");
+				rv = -1;
+				break;
+			}
+		}
+	} else {
+		u2up_log_error("evm_init() failed!\n");
+		rv = -1;
+	}
+
+	u2up_log_info("(exit)\n");
+	return rv;
+}
+
+static double hello6_elapsed_ms(struct timespec *start, struct timespec *stop)
+{
+	return ((stop->tv_sec - start->tv_sec) * 1000.0) + ((stop->tv_nsec - start->tv_nsec) / 1000000.0);
+}
+
+/* Post messages to topic and handle them by all consumers (single thread) */
+static int hello6_topic_bench(evmTopicStruct *topic, const char *name)
+{
+	int i, j;
+	evmMessageStruct *msg;
+	evmQueueStatsStruct stats;
+	unsigned long received = 0, accepted = 0;
+	struct timespec start, posted, drained;
+	u2up_log_info("(entry)\n");
+
+	for (i = 0; i < num_consumers; i++) {
+		counters[i].received = 0;
+		counters[i].accepted = 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (j = 0; j < HELLO6_NUM_MSGS; j++) {
+		if ((msg = evm_message_new(msgtype_hello_ptr, msgid_hello_ptr, 0)) == NULL) {
+			u2up_log_error("evm_message_new() failed!\n");
+			return -1;
+		}
+		evm_message_field_set(msg, 0, j % HELLO6_FIELD_VALUES);
+		/* Not matching any consumer's filter (less consumers than field values) - not taken over. */
+		if (evm_message_post(topic, msg) < 0)
+			evm_message_delete(msg);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &posted);
+
+	/* Drain all consumer queues. */
+	for (i = 0; i < num_consumers; i++) {
+		do {
+			evm_run_async(consumers[i]);
+			if (evm_consumer_queue_stats_get(consumers[i], &stats) != 0)
+				return -1;
+		} while (stats.depth > 0);
+		received += counters[i].received;
+		accepted += counters[i].accepted;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &drained);
+
+	u2up_log_notice("%s topic: %d messages, %d consumers - post: %.3f ms, handle: %.3f ms, total: %.3f ms (received: %lu, accepted: %lu)\n",
+		name, HELLO6_NUM_MSGS, num_consumers,
+		hello6_elapsed_ms(&start, &posted), hello6_elapsed_ms(&posted, &drained), hello6_elapsed_ms(&start, &drained),
+		received, accepted
+	);
+
+	return 0;
+}
+
+static int hello6_evm_run(void)
+{
+	u2up_log_info("(entry)\n");
+
+	if (hello6_topic_bench(topic_plain, "PLAIN") != 0)
+		return -1;
+
+	if (hello6_topic_bench(topic_filtered, "FILTERED") != 0)
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * The hello6_evm demo program
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_hello6_evm_h
+#define EVM_FILE_hello6_evm_h
+
+#ifdef EVM_FILE_hello6_evm_c
+/* PRIVATE usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN
+#else
+/* PUBLIC usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN extern
+#endif
+
+#define HELLO6_NUM_CONSUMERS 1000
+#define HELLO6_NUM_MSGS 1000
+#define HELLO6_FIELD_VALUES 100
+
+#endif /*EVM_FILE_hello6_evm_h*/
@@ -0,0 +1,565 @@
+/*
+ * The hello7_evm demo program
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+/*
+ * This demo is a benchmark of topic bridges. The parent process (client) and
+ * its child (server) run separate event machines, bridged over a TCP loopback
+ * (or Unix) stream socket:
+ * - The server subscribes to the client's PING topic over the bridge and
+ *   answers every PING message by posting it back to its PONG topic.
+ * - The client subscribes to the server's PONG topic over the bridge and
+ *   keeps a window of PING messages in flight, each carrying its post time.
+ * Message rate and round trip latency percentiles are reported.
+ * 1. The MAIN part shows standard C program initialization with options for
+ *    different logging capabilities of EVM.
+ * 2. The EVM part demonstrates EVM initialization and the benchmark.
+*/
+
+#ifndef EVM_FILE_hello7_evm_c
+#define EVM_FILE_hello7_evm_c
+#else
+#error Preprocesor macro EVM_FILE_hello7_evm_c conflict!
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <evm/libevm.h>
+#include "hello7_evm.h"
+
+#define U2UP_LOG_NAME DEMO7EVM
+#include <u2up-log/u2up-log.h>
+/* Declare all other used "u2up-log" modules: */
+U2UP_LOG_DECLARE(EVM_CORE);
+U2UP_LOG_DECLARE(EVM_MSGS);
+U2UP_LOG_DECLARE(EVM_TMRS);
+U2UP_LOG_DECLARE(EVM_BRDG);
+
+enum evm_topic_ids {
+	EVM_TOPIC_ID_PING = 0,
+	EVM_TOPIC_ID_PONG
+};
+
+enum evm_consumer_ids {
+	EVM_CONSUMER_ID_0 = 0
+};
+
+enum evm_msgtype_ids {
+	EV_TYPE_UNKNOWN_MSG = 0,
+	EV_TYPE_HELLO_MSG
+};
+
+enum evm_msg_ids {
+	EV_ID_HELLO_MSG_HELLO = 0
+};
+
+static int evPingMsg(evmConsumerStruct *consumer, evmMessageStruct *msg_ptr);
+static int evPongMsg(evmConsumerStruct *consumer, evmMessageStruct *msg_ptr);
+static int bridgeDown(evmConsumerStruct *consumer, evmBridgeStruct *bridge);
+
+static int hello7_evm_init(void);
+static int hello7_server_run(int fd);
+static int hello7_client_run(int fd);
+
+/*
+ * The MAIN part.
+ */
+unsigned int log_mask;
+int num_msgs = HELLO7_NUM_MSGS;
+int use_unix = 0;
+
+static void usage_help(char *argv[])
+{
+	printf("Usage:\n");
+	printf("\t%s [options] [num_msgs]\n", argv[0]);
+	printf("options:\n");
+	printf("\t-u, --unix               Bridge over Unix socket (instead of TCP loopback).\n");
+	printf("\t-q, --quiet              Disable all output.\n");
+	printf("\t-v, --verbose            Enable verbose output.\n");
+#if (U2UP_LOG_MODULE_TRACE != 0)
+	printf("\t-t, --trace              Enable trace output.\n");
+#endif
+#if (U2UP_LOG_MODULE_DEBUG != 0)
+	printf("\t-g, --debug              Enable debug output.\n");
+#endif
+	printf("\t-s, --syslog             Enable syslog output (instead of stdout, stderr).\n");
+	printf("\t-n, --no-header          No U2UP_LOG header added to every u2up_log_... output.\n");
+	printf("\t-h, --help               Displays this text.\n");
+}
+
+static int usage_check(int argc, char *argv[])
+{
+	int c;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"unix", 0, 0, 'u'},
+			{"quiet", 0, 0, 'q'},
+			{"verbose", 0, 0, 'v'},
+#if (U2UP_LOG_MODULE_TRACE != 0)
+			{"trace", 0, 0, 't'},
+#endif
+#if (U2UP_LOG_MODULE_DEBUG != 0)
+			{"debug", 0, 0, 'g'},
+#endif
+			{"no-header", 0, 0, 'n'},
+			{"syslog", 0, 0, 's'},
+			{"help", 0, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+
+#if (U2UP_LOG_MODULE_TRACE != 0) && (U2UP_LOG_MODULE_DEBUG != 0)
+		c = getopt_long(argc, argv, "uqvtgnsh", long_options, &option_index);
+#elif (U2UP_LOG_MODULE_TRACE == 0) && (U2UP_LOG_MODULE_DEBUG != 0)
+		c = getopt_long(argc, argv, "uqvgnsh", long_options, &option_index);
+#elif (U2UP_LOG_MODULE_TRACE != 0) && (U2UP_LOG_MODULE_DEBUG == 0)
+		c = getopt_long(argc, argv, "uqvtnsh", long_options, &option_index);
+#else
+		c = getopt_long(argc, argv, "uqvnsh", long_options, &option_index);
+#endif
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'u':
+			use_unix = 1;
+			break;
+
+		case 'q':
+			U2UP_LOG_SET_NORMAL(0);
+			U2UP_LOG_SET_NORMAL2(EVM_CORE, 0);
+			U2UP_LOG_SET_NORMAL2(EVM_MSGS, 0);
+			U2UP_LOG_SET_NORMAL2(EVM_TMRS, 0);
+			U2UP_LOG_SET_NORMAL2(EVM_BRDG, 0);
+			break;
+
+		case 'v':
+			U2UP_LOG_SET_VERBOSE(1);
+			U2UP_LOG_SET_VERBOSE2(EVM_CORE, 1);
+			U2UP_LOG_SET_VERBOSE2(EVM_MSGS, 1);
+			U2UP_LOG_SET_VERBOSE2(EVM_TMRS, 1);
+			U2UP_LOG_SET_VERBOSE2(EVM_BRDG, 1);
+			break;
+
+#if (U2UP_LOG_MODULE_TRACE != 0)
+		case 't':
+			U2UP_LOG_SET_TRACE(1);
+			U2UP_LOG_SET_TRACE2(EVM_CORE, 1);
+			U2UP_LOG_SET_TRACE2(EVM_MSGS, 1);
+			U2UP_LOG_SET_TRACE2(EVM_TMRS, 1);
+			U2UP_LOG_SET_TRACE2(EVM_BRDG, 1);
+			break;
+#endif
+
+#if (U2UP_LOG_MODULE_DEBUG != 0)
+		case 'g':
+			U2UP_LOG_SET_DEBUG(1);
+			U2UP_LOG_SET_DEBUG2(EVM_CORE, 1);
+			U2UP_LOG_SET_DEBUG2(EVM_MSGS, 1);
+			U2UP_LOG_SET_DEBUG2(EVM_TMRS, 1);
+			U2UP_LOG_SET_DEBUG2(EVM_BRDG, 1);
+			break;
+#endif
+
+		case 'n':
+			U2UP_LOG_SET_HEADER(0);
+			U2UP_LOG_SET_HEADER2(EVM_CORE, 0);
+			U2UP_LOG_SET_HEADER2(EVM_MSGS, 0);
+			U2UP_LOG_SET_HEADER2(EVM_TMRS, 0);
+			U2UP_LOG_SET_HEADER2(EVM_BRDG, 0);
+			break;
+
+		case 's':
+			U2UP_LOG_SET_SYSLOG(1);
+			U2UP_LOG_SET_SYSLOG2(EVM_CORE, 1);
+			U2UP_LOG_SET_SYSLOG2(EVM_MSGS, 1);
+			U2UP_LOG_SET_SYSLOG2(EVM_TMRS, 1);
+			U2UP_LOG_SET_SYSLOG2(EVM_BRDG, 1);
+			break;
+
+		case 'h':
+			usage_help(argv);
+			exit(EXIT_SUCCESS);
+
+		case '?':
+			exit(EXIT_FAILURE);
+			break;
+
+		default:
+			printf("?? getopt returned character code 0%o ??\n", c);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind < argc) {
+		char *param = argv[optind];
+
+		if ((num_msgs = atoi(param)) > 0)
+			optind++;
+	}
+
+	if (optind < argc) {
+		printf("non-option ARGV-elements: ");
+		while (optind < argc)
+			printf("%s ", argv[optind++]);
+		printf("\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
+
+static evmStruct *evm;
+static evmMsgidStruct *msgid_hello_ptr;
+static evmMsgtypeStruct *msgtype_hello_ptr;
+static evmConsumerStruct *consumer;
+static evmTopicStruct *topic_ping;
+static evmTopicStruct *topic_pong;
+
+/* Connected stream sockets of both sides (fds[0] - client, fds[1] - server) */
+static int hello7_connect(int fds[2])
+{
+	int lfd, one = 1;
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+
+	if (use_unix)
+		return socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+	if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+		(listen(lfd, 1) < 0) ||
+		(getsockname(lfd, (struct sockaddr *)&addr, &addrlen) < 0) ||
+		((fds[0] = socket(AF_INET, SOCK_STREAM, 0)) < 0)) {
+		close(lfd);
+		return -1;
+	}
+	if ((connect(fds[0], (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+		((fds[1] = accept(lfd, NULL, NULL)) < 0)) {
+		close(fds[0]);
+		close(lfd);
+		return -1;
+	}
+	close(lfd);
+	/* Frames are coalesced per flush already. */
+	setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(fds[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int fds[2];
+	pid_t pid;
+	int rv;
+
+	usage_check(argc, argv);
+
+	log_mask = LOG_MASK(LOG_EMERG) | LOG_MASK(LOG_ALERT) | LOG_MASK(LOG_CRIT) | LOG_MASK(LOG_ERR);
+
+	/* Setup LOG_MASK according to startup arguments! */
+	if (U2UP_LOG_GET_NORMAL()) {
+		log_mask |= LOG_MASK(LOG_WARNING);
+		log_mask |= LOG_MASK(LOG_NOTICE);
+	}
+	if ((U2UP_LOG_GET_VERBOSE()) || (U2UP_LOG_GET_TRACE()))
+		log_mask |= LOG_MASK(LOG_INFO);
+	if (U2UP_LOG_GET_DEBUG())
+		log_mask |= LOG_MASK(LOG_DEBUG);
+
+	setlogmask(log_mask);
+
+	if (hello7_connect(fds) != 0) {
+		u2up_log_system_error("hello7_connect()\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((pid = fork()) < 0) {
+		u2up_log_system_error("fork()\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Each process runs its own event machine. */
+	if (hello7_evm_init() != 0)
+		exit(EXIT_FAILURE);
+
+	if (pid == 0) {
+		close(fds[0]);
+		if (hello7_server_run(fds[1]) < 0)
+			exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+	rv = hello7_client_run(fds[0]);
+	waitpid(pid, NULL, 0);
+	if (rv < 0)
+		exit(EXIT_FAILURE);
+
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * The EVM part.
+ */
+
+/* PING message data */
+struct hello7_ping {
+	int seq; /*-1 - probe (bridge not subscribed yet)*/
+	struct timespec posted;
+	char payload[HELLO7_PAYLOAD];
+};
+
+static int done;
+static int started;
+static int sent;
+static int received;
+static double *latencies; /*round trips in microseconds*/
+static struct timespec start, stop;
+
+static double hello7_elapsed_us(struct timespec *from, struct timespec *to)
+{
+	return ((to->tv_sec - from->tv_sec) * 1000000.0) + ((to->tv_nsec - from->tv_nsec) / 1000.0);
+}
+
+/* Post a new message to topic (copy of data, if provided) */
+static int hello7_post(evmTopicStruct *topic, const struct hello7_ping *data, int seq)
+{
+	evmMessageStruct *msg;
+	struct hello7_ping *ping;
+
+	if ((msg = evm_message_new(msgtype_hello_ptr, msgid_hello_ptr, sizeof(struct hello7_ping))) == NULL) {
+		u2up_log_error("evm_message_new() failed!\n");
+		return -1;
+	}
+	ping = (struct hello7_ping *)evm_message_data_get(msg);
+	if (data != NULL) {
+		memcpy(ping, data, sizeof(struct hello7_ping));
+	} else {
+		memset(ping, 0, sizeof(struct hello7_ping));
+		ping->seq = seq;
+		clock_gettime(CLOCK_MONOTONIC, &ping->posted);
+	}
+	/* No local subscribers - forwarded over the bridge (copied) only. */
+	if (evm_message_post(topic, msg) < 0) {
+		/* Probes not forwarded, until the peer subscribed. */
+		if (seq >= 0)
+			u2up_log_error("evm_message_post() failed!\n");
+		evm_message_delete(msg);
+	}
+	return 0;
+}
+
+/* Server: PING event handler - answer with PONG */
+static int evPingMsg(evmConsumerStruct *consumer, evmMessageStruct *msg_ptr)
+{
+	u2up_log_info("(cb entry) msg_ptr=%p\n", msg_ptr);
+
+	if (msg_ptr == NULL)
+		return -1;
+
+	return hello7_post(topic_pong, (struct hello7_ping *)evm_message_data_get(msg_ptr), 0);
+}
+
+/* Client: PONG event handler - account round trip and keep the window full */
+static int evPongMsg(evmConsumerStruct *consumer, evmMessageStruct *msg_ptr)
+{
+	struct hello7_ping *ping;
+	struct timespec now;
+	u2up_log_info("(cb entry) msg_ptr=%p\n", msg_ptr);
+
+	if ((msg_ptr == NULL) || ((ping = (struct hello7_ping *)evm_message_data_get(msg_ptr)) == NULL))
+		return -1;
+
+	if (ping->seq < 0) {
+		started = 1;
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	latencies[received++] = hello7_elapsed_us(&ping->posted, &now);
+	if (received == num_msgs)
+		stop = now;
+
+	if (sent < num_msgs)
+		return hello7_post(topic_ping, NULL, sent++);
+
+	return 0;
+}
+
+static int bridgeDown(evmConsumerStruct *consumer, evmBridgeStruct *bridge)
+{
+	u2up_log_info("(cb entry) bridge=%p\n", bridge);
+
+	done = 1;
+	return evm_bridge_del(bridge);
+}
+
+/* EVM initialization */
+static int hello7_evm_init(void)
+{
+	int rv = 0;
+
+	u2up_log_info("(entry)\n");
+
+	/* Initialize event machine... */
+	if ((evm = evm_init()) != NULL) {
+		if ((rv == 0) && ((topic_ping = evm_topic_add(evm, EVM_TOPIC_ID_PING)) == NULL)) {
+			u2up_log_error("evm_topic_add() failed!\n");
+			rv = -1;
+		}
+		if ((rv == 0) && ((topic_pong = evm_topic_add(evm, EVM_TOPIC_ID_PONG)) == NULL)) {
+			u2up_log_error("evm_topic_add() failed!\n");
+			rv = -1;
+		}
+		if ((rv == 0) && ((msgtype_hello_ptr = evm_msgtype_add(evm, EV_TYPE_HELLO_MSG)) == NULL)) {
+			u2up_log_error("evm_msgtype_add() failed!\n");
+			rv = -1;
+		}
+		if ((rv == 0) && ((msgid_hello_ptr = evm_msgid_add(msgtype_hello_ptr, EV_ID_HELLO_MSG_HELLO)) == NULL)) {
+			u2up_log_error("evm_msgid_add() failed!\n");
+			rv = -1;
+		}
+		if ((rv == 0) && ((consumer = evm_consumer_add(evm, EVM_CONSUMER_ID_0)) == NULL)) {
+			u2up_log_error("evm_consumer_add() failed!\n");
+			rv = -1;
+		}
+	} else {
+		u2up_log_error("evm_init() failed!\n");
+		rv = -1;
+	}
+
+	u2up_log_info("(exit)\n");
+	return rv;
+}
+
+static int hello7_server_run(int fd)
+{
+	evmBridgeStruct *bridge;
+	u2up_log_info("(entry)\n");
+
+	if (evm_msgid_cb_handle_set(msgid_hello_ptr, evPingMsg) < 0) {
+		u2up_log_error("evm_msgid_cb_handle() failed!\n");
+		return -1;
+	}
+	if (evm_topic_subscribe(consumer, EVM_TOPIC_ID_PING) != topic_ping) {
+		u2up_log_error("evm_topic_subscribe() failed!\n");
+		return -1;
+	}
+	if ((bridge = evm_bridge_add(consumer, fd, bridgeDown)) == NULL) {
+		u2up_log_error("evm_bridge_add() failed!\n");
+		return -1;
+	}
+	if (evm_bridge_subscribe(bridge, EVM_TOPIC_ID_PING) != 0) {
+		u2up_log_error("evm_bridge_subscribe() failed!\n");
+		return -1;
+	}
+
+	/* Until the client goes away. */
+	while (!done)
+		evm_run_once(consumer);
+
+	close(fd);
+	return 0;
+}
+
+static int hello7_latency_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int hello7_client_run(int fd)
+{
+	evmBridgeStruct *bridge;
+	double elapsed_us;
+	u2up_log_info("(entry)\n");
+
+	if ((latencies = (double *)calloc(num_msgs, sizeof(double))) == NULL)
+		return -1;
+
+	if (evm_msgid_cb_handle_set(msgid_hello_ptr, evPongMsg) < 0) {
+		u2up_log_error("evm_msgid_cb_handle() failed!\n");
+		return -1;
+	}
+	if (evm_topic_subscribe(consumer, EVM_TOPIC_ID_PONG) != topic_pong) {
+		u2up_log_error("evm_topic_subscribe() failed!\n");
+		return -1;
+	}
+	if ((bridge = evm_bridge_add(consumer, fd, bridgeDown)) == NULL) {
+		u2up_log_error("evm_bridge_add() failed!\n");
+		return -1;
+	}
+	if (evm_bridge_subscribe(bridge, EVM_TOPIC_ID_PONG) != 0) {
+		u2up_log_error("evm_bridge_subscribe() failed!\n");
+		return -1;
+	}
+
+	/* Probe until both subscriptions crossed the bridge. */
+	while (!started && !done) {
+		if (hello7_post(topic_ping, NULL, -1) != 0)
+			return -1;
+		evm_run_async(consumer);
+		usleep(1000);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while ((sent < HELLO7_WINDOW) && (sent < num_msgs)) {
+		if (hello7_post(topic_ping, NULL, sent++) != 0)
+			return -1;
+	}
+	while ((received < num_msgs) && !done)
+		evm_run_once(consumer);
+
+	if (received < num_msgs) {
+		u2up_log_error("Bridge down - %d of %d messages received!\n", received, num_msgs);
+		return -1;
+	}
+
+	qsort(latencies, num_msgs, sizeof(double), hello7_latency_cmp);
+	elapsed_us = hello7_elapsed_us(&start, &stop);
+	u2up_log_notice("%s bridge: %d messages (window %d) - %.0f msgs/s, round trip p50: %.1f us, p99: %.1f us, max: %.1f us\n",
+		use_unix ? "UNIX" : "TCP", num_msgs, HELLO7_WINDOW,
+		num_msgs / (elapsed_us / 1000000.0),
+		latencies[num_msgs / 2], latencies[(num_msgs * 99) / 100], latencies[num_msgs - 1]
+	);
+
+	evm_bridge_del(bridge);
+	close(fd);
+	return 0;
+}
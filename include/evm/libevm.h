@@ -24,6 +24,19 @@
  * - EVM_CORE
  * - EVM_MSGS
  * - EVM_TMRS
+ * - EVM_GRPS
+ * - EVM_SHRD
+ * - EVM_FLTR
+ * - EVM_PATH
+ * - EVM_FDS
+ * - EVM_IO
+ * - EVM_DGRM
+ * - EVM_DCDR
+ * - EVM_SIGS
+ * - EVM_SHM
+ * - EVM_MFD
+ * - EVM_BRDG
+ * - EVM_POOL
 */
 
 #ifndef EVM_FILE_libevm_h
@@ -31,7 +44,9 @@
 
 #include <errno.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <time.h>
 #include <semaphore.h>
 
@@ -51,6 +66,8 @@ struct evm_consumer;
 struct evm_topic;
 struct evm_message;
 struct evm_timer;
+struct evm_group;
+struct evm_router;
 typedef struct evm evmStruct;
 typedef struct evm_msgtype evmMsgtypeStruct;
 typedef struct evm_msgid evmMsgidStruct;
@@ -59,6 +76,10 @@ typedef struct evm_consumer evmConsumerStruct;
 typedef struct evm_topic evmTopicStruct;
 typedef struct evm_message evmMessageStruct;
 typedef struct evm_timer evmTimerStruct;
+typedef struct evm_group evmGroupStruct;
+typedef struct evm_router evmRouterStruct;
+typedef struct evm_shm evmShmStruct;
+typedef struct evm_bridge evmBridgeStruct;
 
 /*
  * Public API functions:
@@ -118,7 +139,7 @@ extern evmTopicStruct * evm_topic_del(evmStruct *evm, int topic_id);
  * Function: evm_topic_subscribe()
  * Returns:
  * - NULL, if;
- *   - consumer is NULL
+ *   - consumer is NULL or remote (see evm_shm_consumer_add())
  *   - "evm" is not correctly initialized
  *   - topic with topic_id is not found
  * - Topic pointer, if:
@@ -139,6 +160,158 @@ evmTopicStruct * evm_topic_subscribe(evmConsumerStruct *consumer, int topic_id);
  */
 evmTopicStruct * evm_topic_unsubscribe(evmConsumerStruct *consumer, int topic_id);
 
+/*
+ * Public API function:
+ * - evm_topic_subscribe_filter()
+ *
+ * Subscribe to topic (if not yet) with a content filter, evaluated by
+ * evm_message_post(): Messages not matching the filter are not queued
+ * for this consumer at all (no enqueuing, wakeup and dispatching). The
+ * filter matches, if message's msgid is one of the "msgids" (any msgid,
+ * if "msgids_num" is 0) and all message fields' ranges match (unset
+ * message field never matches). The filter is copied, NULL removes it.
+ * Filtered out messages are counted in subscription's "filtered" stats
+ * counter (see evm_topic_lag_stats_get()).
+ * Returns:
+ * - NULL, if;
+ *   - consumer is NULL or remote or invalid filter provided
+ *   - "evm" is not correctly initialized
+ *   - topic with topic_id is not found
+ * - Topic pointer, if topic subscribed by consumer with the new filter
+ */
+#define EVM_MSG_FIELDS 4
+#define EVM_FILTER_MSGIDS 8
+#define EVM_FILTER_RANGES EVM_MSG_FIELDS
+
+struct evm_filter_range {
+	int field; /*message field index (0 .. EVM_MSG_FIELDS - 1)*/
+	long long min;
+	long long max;
+};
+
+struct evm_filter {
+	int msgids_num;
+	int msgids[EVM_FILTER_MSGIDS];
+	int ranges_num;
+	struct evm_filter_range ranges[EVM_FILTER_RANGES];
+};
+typedef struct evm_filter evmFilterStruct;
+
+evmTopicStruct * evm_topic_subscribe_filter(evmConsumerStruct *consumer, int topic_id, const evmFilterStruct *filter);
+
+/*
+ * Public API functions:
+ * - evm_topic_path_add() - add topic with topic_id and hierarchical path
+ *   ("/" separated levels, i.e.: "feed/eq/NASDAQ/AAPL")
+ * - evm_topic_path_get()
+ * - evm_topic_path_subscribe() - subscribe to all topics matching the
+ *   path pattern, with wildcard levels: "*" matches any single level and
+ *   "**" (as the last level) any number of levels, including topics
+ *   added later
+ * - evm_topic_path_unsubscribe()
+ * - evm_message_path_post() - post message to the topic with the path
+ *   (see evm_message_post())
+ *
+ * Topics matching a pattern are resolved once (when the pattern or the
+ * topic is added) into topic's subscriptions, so posting to a path does
+ * not depend on the number of patterns. A topic subscribed by more
+ * patterns (or also directly) is unsubscribed, when no longer matched.
+ * Returns:
+ * - NULL (-1), if evm (consumer) is NULL (or remote), invalid path
+ *   (pattern) provided, topic's path added with another topic_id (or
+ *   topic with topic_id has another path) or topic with path not found
+ * - topic pointer (0) on success
+ */
+#define EVM_TOPIC_PATH_DEPTH 32
+
+extern evmTopicStruct * evm_topic_path_add(evmStruct *evm, int topic_id, const char *path);
+extern evmTopicStruct * evm_topic_path_get(evmStruct *evm, const char *path);
+extern int evm_topic_path_subscribe(evmConsumerStruct *consumer, const char *pattern);
+extern int evm_topic_path_unsubscribe(evmConsumerStruct *consumer, const char *pattern);
+extern int evm_message_path_post(evmStruct *evm, const char *path, evmMessageStruct *msg);
+
+/*
+ * Public API functions:
+ * - evm_topic_lag_limit_set()
+ * - evm_topic_lag_stats_get()
+ *
+ * Per subscription lag limit: max messages posted to the topic and still
+ * queued by the consumer (0 - unlimited, default). When exceeded, next
+ * posted messages are handled by the lag policy:
+ * - EVM_SUB_LAG_DROP: not queued for this consumer
+ * - EVM_SUB_LAG_CONFLATE: replace the latest queued message of this
+ *   subscription (taking over its queue position)
+ * - EVM_SUB_LAG_UNSUBSCRIBE: consumer automatically unsubscribed and
+ *   notified via "lagged" callback (called by the posting thread)
+ * So a stuck consumer does not pin memory of the whole topic. The
+ * "lag" counter reports its current subscription lag.
+ * Returns:
+ * - -1, if consumer (or stats) is NULL, invalid arguments provided or
+ *   consumer not subscribed to topic with topic_id
+ * - 0 on success
+ */
+#define EVM_SUB_LAG_DROP 0
+#define EVM_SUB_LAG_CONFLATE 1
+#define EVM_SUB_LAG_UNSUBSCRIBE 2
+
+struct evm_sub_stats {
+	unsigned long lag;
+	unsigned long max_lag;
+	unsigned long posted;
+	unsigned long dropped;
+	unsigned long conflated;
+	unsigned long filtered;
+};
+typedef struct evm_sub_stats evmSubStatsStruct;
+
+extern int evm_topic_lag_limit_set(evmConsumerStruct *consumer, int topic_id, int lag_limit, int lag_policy, int (*lagged)(evmConsumerStruct *consumer, evmTopicStruct *topic));
+extern int evm_topic_lag_stats_get(evmConsumerStruct *consumer, int topic_id, evmSubStatsStruct *stats);
+
+/*
+ * Public API functions:
+ * - evm_group_add()
+ * - evm_group_get()
+ * - evm_group_del()
+ */
+extern evmGroupStruct * evm_group_add(evmStruct *evm, int group_id);
+extern evmGroupStruct * evm_group_get(evmStruct *evm, int group_id);
+extern evmGroupStruct * evm_group_del(evmStruct *evm, int group_id);
+
+/*
+ * Public API functions:
+ * - evm_group_member_add()
+ * - evm_group_member_del()
+ * - evm_group_policy_set()
+ * - evm_group_subscribe()
+ * - evm_group_unsubscribe()
+ *
+ * Consumer groups provide work-queue semantics: A message posted to a
+ * topic subscribed by a group (or passed to the group via
+ * evm_message_group_pass()) is delivered to exactly one of its member
+ * consumers, selected by the group policy:
+ * - EVM_GROUP_ROUND_ROBIN: members in turn (default)
+ * - EVM_GROUP_LEAST_DEPTH: member with the least queued messages
+ * - EVM_GROUP_TWO_CHOICES: less loaded of two randomly chosen members
+ * Group deliveries are subject to the member's queue policies only (its
+ * capacity, overflow policy and conflation mode), not to the topic's
+ * conflation mode or subscription lag limits. Deleting a group
+ * unsubscribes it from all topics, deleting a consumer removes it from
+ * all groups.
+ * Returns:
+ * - -1 (NULL), if group or consumer is NULL (or remote), invalid policy
+ *   provided or topic with topic_id not found
+ * - 0 (topic) on success
+ */
+#define EVM_GROUP_ROUND_ROBIN 0
+#define EVM_GROUP_LEAST_DEPTH 1
+#define EVM_GROUP_TWO_CHOICES 2
+
+extern int evm_group_member_add(evmGroupStruct *group, evmConsumerStruct *consumer);
+extern int evm_group_member_del(evmGroupStruct *group, evmConsumerStruct *consumer);
+extern int evm_group_policy_set(evmGroupStruct *group, int policy);
+extern evmTopicStruct * evm_group_subscribe(evmGroupStruct *group, int topic_id);
+extern evmTopicStruct * evm_group_unsubscribe(evmGroupStruct *group, int topic_id);
+
 extern int evm_priv_set(evmStruct *evm, void *priv);
 extern void * evm_priv_get(evmStruct *evm);
 
@@ -152,6 +325,273 @@ extern int evm_run_once(evmConsumerStruct *consumer);
 extern int evm_run_async(evmConsumerStruct *consumer);
 extern int evm_run(evmConsumerStruct *consumer);
 
+/*
+ * Public API functions:
+ * - evm_fd_add() - watch fd for EPOLL... events, fd_handle called by the
+ *   consumer's thread, when fd ready (revents)
+ * - evm_fd_mod() - change watched events
+ * - evm_fd_del() - stop watching fd (before it gets closed)
+ *
+ * With watched fds, consumer's blocking point in evm_run_once() becomes
+ * epoll_wait(), also woken by queued messages and timed out by its next
+ * timer expiration - no separate receiver thread (and handoff) required
+ * per socket. Watched fds are polled without blocking in evm_run_async().
+ * Watchers are meant to be managed from the consumer's thread (also
+ * from within fd_handle).
+ * Returns:
+ * - -1, if consumer is NULL, invalid fd (or fd_handle) provided, fd
+ *   already (or not) watched or epoll failure
+ * - 0 on success
+ */
+extern int evm_fd_add(evmConsumerStruct *consumer, int fd, unsigned int events, int (*fd_handle)(evmConsumerStruct *consumer, int fd, unsigned int revents, void *ctx), void *ctx);
+extern int evm_fd_mod(evmConsumerStruct *consumer, int fd, unsigned int events);
+extern int evm_fd_del(evmConsumerStruct *consumer, int fd);
+
+/*
+ * Public API functions:
+ * - evm_signal_add() - handle signal signo by the consumer's thread
+ * - evm_signal_del()
+ *
+ * Signals are read from a signalfd watched within the consumer's epoll
+ * set (see evm_fd_add()) and dispatched as ordinary events - no async
+ * signal handler restrictions. The signal gets blocked in the calling
+ * thread, so add signals before creating other threads (inheriting the
+ * mask), or block them there too. A signal is meant to be handled by a
+ * single consumer. Deleted signals remain blocked.
+ * Returns:
+ * - -1, if consumer (or sig_handle) is NULL, invalid signo (not added)
+ *   or failure
+ * - 0 on success
+ */
+extern int evm_signal_add(evmConsumerStruct *consumer, int signo, int (*sig_handle)(evmConsumerStruct *consumer, const struct signalfd_siginfo *info));
+extern int evm_signal_del(evmConsumerStruct *consumer, int signo);
+
+/*
+ * Public API functions:
+ * - evm_consumer_fd_get() - pollable (readable) fd for external event
+ *   loops, ready when messages are queued or watched fds are ready
+ * - evm_consumer_next_deadline() - absolute expiration time of the
+ *   consumer's next timer (evm clock, see evm_clock_gettime())
+ *
+ * For embedding a consumer into another (i.e. reactor) event loop, which
+ * can not block in evm_run(): Wait for the fd to become readable (or the
+ * next deadline to pass) and drain the consumer with evm_run_async().
+ * The fd remains readable while messages are left behind by the
+ * scheduling budget. It is owned by the consumer (do not close it).
+ * Returns:
+ * - -1, if consumer (or ts) is NULL or epoll failure
+ * - fd (evm_consumer_fd_get()) on success
+ * - 0 (no timer pending) or 1 (ts set) - evm_consumer_next_deadline()
+ */
+extern int evm_consumer_fd_get(evmConsumerStruct *consumer);
+extern int evm_consumer_next_deadline(evmConsumerStruct *consumer, struct timespec *ts);
+
+/*
+ * Public API functions:
+ * - evm_io_backend_set() - select consumer's I/O engine before its first
+ *   use (default EVM_IO_URING, if available)
+ * - evm_io_backend_get()
+ * - evm_io_recv_add() - receive from socket fd into messages of msgtype
+ *   and msgid with ctx (evm_message_ctx_get()), decoded and delivered by
+ *   the decode stage (see evm_message_decode(), the consumer as fallback)
+ * - evm_io_recv_del()
+ * - evm_io_send() - send data (copied) to socket fd
+ *
+ * Socket I/O engine of a consumer, managed from the consumer's thread:
+ * - EVM_IO_URING: Multishot receives into provided buffers and sends
+ *   submitted at once after each evm_run_once() pass (one in flight per
+ *   fd, keeping data ordered). The io_uring is watched within the
+ *   consumer's epoll set (see evm_fd_add()), together with its timers
+ *   and cross-thread wakeups.
+ * - EVM_IO_EPOLL: fallback without io_uring (receives on fd readiness,
+ *   synchronous sends).
+ * Data of a received message is a "struct iovec" referring to received
+ * bytes (up to EVM_IO_BUF_SIZE, nul terminated). An empty one (iov_len
+ * 0) is the last one received on peer shutdown or failure.
+ * Returns:
+ * - -1, if consumer is NULL, invalid arguments provided, fd already (or
+ *   not) receiving, selected backend not available (epoll used) or I/O
+ *   failure
+ * - 0 on success (or EVM_IO_... backend)
+ */
+#define EVM_IO_EPOLL 0
+#define EVM_IO_URING 1
+
+#define EVM_IO_BUF_SIZE 4096
+
+extern int evm_io_backend_set(evmConsumerStruct *consumer, int backend);
+extern int evm_io_backend_get(evmConsumerStruct *consumer);
+extern int evm_io_recv_add(evmConsumerStruct *consumer, int fd, evmMsgtypeStruct *msgtype, evmMsgidStruct *msgid, void *ctx);
+extern int evm_io_recv_del(evmConsumerStruct *consumer, int fd);
+extern int evm_io_send(evmConsumerStruct *consumer, int fd, const void *data, size_t len);
+
+/*
+ * Public API functions:
+ * - evm_dgram_add() - adapt datagram socket fd: received datagrams turned
+ *   into messages of msgtype and msgid (with ctx)
+ * - evm_dgram_del()
+ * - evm_dgram_send() - queue outgoing message (taken over) to fd
+ * - evm_dgram_message_new() - new message with datagram data of size
+ *   bytes (within the same allocation)
+ *
+ * Datagram adapters (UDP ingest) of a consumer, managed from the
+ * consumer's thread: Up to EVM_DGRAM_BATCH datagrams are received per
+ * recvmmsg() call, on fd readiness (see evm_fd_add()), into pooled
+ * buffers (returned to the pool, when their messages get deleted). Each
+ * message is decoded and delivered by the decode stage (see
+ * evm_message_decode(), the consumer as fallback). Queued outgoing
+ * messages are flushed with sendmmsg() at the end of each
+ * evm_run_once() pass (or when fd becomes writable).
+ * Data of datagram messages is evmDgramStruct, with peer address (not
+ * set for connected sockets). Received bytes (up to EVM_DGRAM_SIZE, nul
+ * terminated) remain valid until the message gets deleted.
+ * Returns:
+ * - -1 (NULL), if consumer is NULL, invalid arguments provided, fd
+ *   already (or not) adapted or failure
+ * - 0 (message pointer) on success
+ */
+#define EVM_DGRAM_SIZE 2048
+
+struct evm_dgram {
+	struct iovec iov; /*datagram bytes (first - struct iovec compatible)*/
+	struct sockaddr_storage addr; /*peer address*/
+	socklen_t addrlen; /*0 - no peer address*/
+};
+typedef struct evm_dgram evmDgramStruct;
+
+extern int evm_dgram_add(evmConsumerStruct *consumer, int fd, evmMsgtypeStruct *msgtype, evmMsgidStruct *msgid, void *ctx);
+extern int evm_dgram_del(evmConsumerStruct *consumer, int fd);
+extern int evm_dgram_send(evmConsumerStruct *consumer, int fd, evmMessageStruct *msg);
+extern evmMessageStruct * evm_dgram_message_new(evmMsgtypeStruct *msgtype, evmMsgidStruct *msgid, size_t size);
+
+/*
+ * Public API functions:
+ * - evm_shm_new() - shared memory transport with a ring of slots and a
+ *   pool of blocks (block_size payload bytes each)
+ * - evm_shm_delete()
+ * - evm_shm_attach() - receive passed messages by the (local) consumer
+ * - evm_shm_consumer_add() - remote consumer with id (see
+ *   evm_consumer_add()), messages passed to it (see evm_message_pass())
+ *   are delivered to the consumer attached in another process
+ * - evm_shm_message_new() - new message with data of size bytes in a
+ *   pool block (passed without copying)
+ *
+ * Inter-process consumer transport for prefork architectures: Create the
+ * transport before fork() (its mapping and wakeup eventfd are inherited),
+ * attach the receiving consumer in one process and pass messages to the
+ * remote consumer in others. Passing is lock free: a ring slot is
+ * reserved and published and the receiving consumer woken only when it
+ * ran out of work (no syscall while it keeps up). Data up to
+ * EVM_SHM_INLINE bytes is copied into the slot, larger into a pool block,
+ * pool block data is passed as is (memfd data by its fd, see
+ * evm_memfd_message_new()). Data is copied bytewise (no pointers)
+ * and messages are identified by msgtype and msgid ids, which must be
+ * the same in all processes. The local message gets deleted, when passed.
+ * Flow control is credit based: Up to slots messages may be passed, but
+ * not yet deleted by the receiving side (credits granted back, when they
+ * get handled), more are rejected with errno EAGAIN by
+ * evm_message_pass(), never blocking the sender. Memfd messages bypass
+ * credits (rejected, when the transport's socket is full).
+ * Data of a message with pool block data must not be taken over.
+ * Remote consumers can not subscribe to topics nor join groups (posts
+ * are never passed to other processes).
+ * Returns:
+ * - -1 (NULL), if invalid arguments provided, consumer already attached
+ *   (or with the same id already exists), no free pool block (or ring
+ *   slot - errno EAGAIN) or failure
+ * - 0 (pointer) on success
+ */
+#define EVM_SHM_INLINE 232
+
+extern evmShmStruct * evm_shm_new(unsigned int slots, unsigned int blocks, size_t block_size);
+extern void evm_shm_delete(evmShmStruct *shm);
+extern int evm_shm_attach(evmShmStruct *shm, evmConsumerStruct *consumer);
+extern evmConsumerStruct * evm_shm_consumer_add(evmStruct *evm, int id, evmShmStruct *shm);
+extern evmMessageStruct * evm_shm_message_new(evmShmStruct *shm, evmMsgtypeStruct *msgtype, evmMsgidStruct *msgid, size_t size);
+
+/*
+ * Public API functions:
+ * - evm_memfd_message_new() - new message with data of size bytes in a
+ *   mapped memfd
+ * - evm_memfd_message_fd_get() - memfd of the message's data
+ *
+ * For large payloads passed to remote consumers (see
+ * evm_shm_consumer_add()): The memfd gets sealed against resizing and
+ * sent over the transport's socket (SCM_RIGHTS), to be mapped again on
+ * arrival - data is never copied. Each side holds its own memfd and
+ * mapping, released when its message gets deleted, so the memory lives
+ * as long as it is referenced in any of the processes. Memfd messages
+ * may be passed out of order with other messages. Received memfds not
+ * sealed against shrinking (or smaller than claimed) are dropped. Data of
+ * a memfd message must not be taken over.
+ * Returns:
+ * - -1 (NULL), if msg is not a memfd message or failure
+ * - fd (message pointer) on success
+ */
+extern evmMessageStruct * evm_memfd_message_new(evmMsgtypeStruct *msgtype, evmMsgidStruct *msgid, size_t size);
+extern int evm_memfd_message_fd_get(evmMessageStruct *msg);
+
+/*
+ * Public API functions:
+ * - evm_bridge_add() - bridge topics with a peer evm instance over
+ *   connected stream socket fd (TCP or Unix, made non-blocking)
+ * - evm_bridge_del() - delete bridge (fd not closed)
+ * - evm_bridge_subscribe() - subscribe to peer's topic: messages posted
+ *   there get posted to the local topic with the same id
+ * - evm_bridge_unsubscribe()
+ *
+ * Bridge is served by the consumer's thread, with fd watched within its
+ * epoll set (see evm_fd_add()). Only topics subscribed by the peer cross
+ * the wire. Messages posted to them (from any thread) are framed (data
+ * copied bytewise with msgtype and msgid ids, which must be the same on
+ * both sides) and coalesced, to be written at once at the end of each
+ * evm_run_once() pass. Messages received over a bridge are never
+ * forwarded back to it. Flow control is credit based: The peer may
+ * forward up to EVM_BRIDGE_WINDOW posts not yet deleted by local
+ * subscribers (credits granted back with the next flush, as they get
+ * handled), more are not forwarded and counted as failed deliveries by
+ * evm_message_post() (errno EAGAIN) - the sender never blocks. When the
+ * peer goes away (or fails), remote subscriptions are dropped and
+ * bridge_down (if set) called - the bridge may be deleted from there.
+ * The peer is trusted: Message data is not validated (its layout must be
+ * the same on both sides), malformed frames (unknown kind, control frame
+ * with data, credits out of window) shut the bridge down.
+ * Returns:
+ * - -1 (NULL), if invalid arguments provided, bridge is down or failure
+ * - 0 (bridge pointer) on success
+ */
+#define EVM_BRIDGE_WINDOW 4096
+
+extern evmBridgeStruct * evm_bridge_add(evmConsumerStruct *consumer, int fd, int (*bridge_down)(evmConsumerStruct *consumer, evmBridgeStruct *bridge));
+extern int evm_bridge_del(evmBridgeStruct *bridge);
+extern int evm_bridge_subscribe(evmBridgeStruct *bridge, int topic_id);
+extern int evm_bridge_unsubscribe(evmBridgeStruct *bridge, int topic_id);
+
+/*
+ * Public API functions:
+ * - evm_clock_virtual_set()
+ * - evm_clock_advance()
+ * - evm_clock_gettime()
+ *
+ * Virtual (simulated) time mode of an evm instance, mainly for testing:
+ * - evm_clock_virtual_set() switches the evm timers to the virtual clock
+ *   starting at the provided time (call it before any timer is started).
+ * - Time only advances via evm_clock_advance() or by jumping to the
+ *   nearest timer expiration, when all consumers blocking in evm_run() or
+ *   evm_run_once() are idle. A consumer takes part in this idle
+ *   accounting from its first blocking evm_run_once() pass on, while
+ *   pending messages of any consumer keep the virtual time still.
+ * - evm_clock_gettime() returns the current (virtual or CLOCK_REALTIME)
+ *   evm time, which is also the base of all timers expirations.
+ * Returns:
+ * - -1, if evm is NULL or invalid time provided (or not in virtual mode
+ *   for evm_clock_advance())
+ * - 0 on success
+ */
+extern int evm_clock_virtual_set(evmStruct *evm, time_t tv_sec, long tv_nsec);
+extern int evm_clock_advance(evmStruct *evm, time_t tv_sec, long tv_nsec);
+extern int evm_clock_gettime(evmStruct *evm, struct timespec *ts);
+
 /*
  * Public API functions:
  * - evm_consumer_priv_set()
@@ -160,6 +600,41 @@ extern int evm_run(evmConsumerStruct *consumer);
 extern int evm_consumer_priv_set(evmConsumerStruct *consumer, void *priv);
 extern void * evm_consumer_priv_get(evmConsumerStruct *consumer);
 
+/*
+ * Public API functions:
+ * - evm_consumer_sched_set()
+ * - evm_consumer_sched_stats_get()
+ *
+ * Each evm_run_once() pass interleaves handling of expired timers and
+ * queued messages (one of each in turn), until there is no more work or
+ * the per pass budgets get exhausted. The budgets bound the work done in
+ * a single pass and weight timers against messages:
+ * - tmrs_budget: max expired timers handled per pass (0 - unlimited)
+ * - msgs_budget: max messages handled per pass (at least 1)
+ * Defaults: EVM_SCHED_TMRS_BUDGET, EVM_SCHED_MSGS_BUDGET
+ * The "starved" counters count passes which left expired timers or
+ * queued messages behind due to their exhausted budget, while
+ * "msgs_expired" counts messages dequeued after their deadline.
+ * Returns:
+ * - -1, if consumer (or stats) is NULL or invalid budget provided
+ * - 0 on success
+ */
+#define EVM_SCHED_TMRS_BUDGET 0
+#define EVM_SCHED_MSGS_BUDGET 1
+
+struct evm_sched_stats {
+	unsigned long passes;
+	unsigned long tmrs_handled;
+	unsigned long msgs_handled;
+	unsigned long tmrs_starved;
+	unsigned long msgs_starved;
+	unsigned long msgs_expired;
+};
+typedef struct evm_sched_stats evmSchedStatsStruct;
+
+extern int evm_consumer_sched_set(evmConsumerStruct *consumer, int tmrs_budget, int msgs_budget);
+extern int evm_consumer_sched_stats_get(evmConsumerStruct *consumer, evmSchedStatsStruct *stats);
+
 /*
  * Messages
  */
@@ -176,15 +651,39 @@ extern evmMsgtypeStruct * evm_msgtype_del(evmStruct *evm, int type);
 
 /*
  * Public API function:
- * - evm_msgtype_cb_parse_set()
+ * - evm_msgtype_cb_parse_set() - decode raw messages of msgtype (see
+ *   evm_message_decode()): The parser gets the message (ptr), resolves
+ *   its msgid (evm_message_msgid_set()) and returns:
+ *   - -1, if not decoded (message dropped)
+ *   - 0, if decoded (message delivered by the decode stage)
+ *   - 1, if the message was taken over (i.e. passed on by the parser)
  */
 extern int evm_msgtype_cb_parse_set(evmMsgtypeStruct *msgtype, int (*msgtype_parse)(void *ptr));
 
+/*
+ * Public API function:
+ * - evm_msgtype_prio_set()
+ *
+ * Consumers' message queues keep a separate FIFO per priority level
+ * (0 - lowest/default ... EVM_MSG_PRIO_LEVELS - 1 - highest) and always
+ * serve the highest non-empty level first. New messages of this msgtype
+ * get the provided priority level (see also evm_message_prio_set()).
+ * Returns:
+ * - -1, if msgtype is NULL or prio out of range
+ * - 0 on success
+ */
+#define EVM_MSG_PRIO_LEVELS 8
+
+extern int evm_msgtype_prio_set(evmMsgtypeStruct *msgtype, int prio);
+
 /*
  * Public API functions:
  * - evm_msgid_cb_handle_set()
+ * - evm_msgid_cb_expire_set() - optional handler of messages with their
+ *   deadline passed (instead of the regular one), NULL to just drop them
  */
 extern int evm_msgid_cb_handle_set(evmMsgidStruct *msgid_ptr, int (*msg_handle)(evmConsumerStruct *consumer, evmMessageStruct *msg));
+extern int evm_msgid_cb_expire_set(evmMsgidStruct *msgid_ptr, int (*msg_expire)(evmConsumerStruct *consumer, evmMessageStruct *msg));
 
 /*
  * Public API functions:
@@ -192,6 +691,20 @@ extern int evm_msgid_cb_handle_set(evmMsgidStruct *msgid_ptr, int (*msg_handle)(
  * - evm_message_delete()
  * - evm_message_alloc_add()
  * - evm_message_persistent_set()
+ * - evm_message_prio_set() - override msgtype's priority level before
+ *   passing/posting the message
+ * - evm_message_deadline_set() - absolute handling deadline (evm clock,
+ *   see evm_clock_gettime()) set before passing/posting the message or
+ *   NULL to clear it: Within a priority level messages with deadline are
+ *   served earliest-deadline-first (before those without it). Messages
+ *   dequeued after their deadline are not handled, but passed to their
+ *   msgid's expire handler (if set) or dropped.
+ * - evm_message_key_set() - conflation key (see evm_consumer_conflate_set())
+ * - evm_message_msgid_set() - resolve msgid (of message's msgtype), i.e.
+ *   when decoding raw messages
+ * - evm_message_field_set() - set message field (0 .. EVM_MSG_FIELDS - 1)
+ *   for subscription filters (see evm_topic_subscribe_filter())
+ * - evm_message_field_get()
  * - evm_message_ctx_set()
  * - evm_message_ctx_get()
  * - evm_message_data_get()
@@ -203,6 +716,12 @@ extern evmMessageStruct * evm_message_new(evmMsgtypeStruct *msgtype, evmMsgidStr
 extern void evm_message_delete(evmMessageStruct *msg);
 extern int evm_message_alloc_add(evmMessageStruct *msg, void *alloc);
 extern int evm_message_persistent_set(evmMessageStruct *msg);
+extern int evm_message_prio_set(evmMessageStruct *msg, int prio);
+extern int evm_message_deadline_set(evmMessageStruct *msg, const struct timespec *ts);
+extern int evm_message_key_set(evmMessageStruct *msg, unsigned long key);
+extern int evm_message_msgid_set(evmMessageStruct *msg, evmMsgidStruct *msgid);
+extern int evm_message_field_set(evmMessageStruct *msg, int field, long long value);
+extern int evm_message_field_get(evmMessageStruct *msg, int field, long long *value);
 extern int evm_message_ctx_set(evmMessageStruct *msg, void *ctx);
 extern void * evm_message_ctx_get(evmMessageStruct *msg);
 extern void * evm_message_data_get(evmMessageStruct *msg);
@@ -210,12 +729,231 @@ extern void * evm_message_data_takeover(evmMessageStruct *msg);
 
 /*
  * Public API functions:
- * - evm_message_pass()
- * - evm_message_post()
+ * - evm_message_pass() - pass message to the consumer
+ * - evm_message_post() - post message to the topic's subscribers (and
+ *   peers subscribed over bridges)
+ *
+ * The message is taken over, when queued to the consumer (any of the
+ * subscribers) or forwarded over any bridge (data copied), and deleted
+ * when handled by all of them. Otherwise (i.e. no matching subscribers
+ * or all queues full) it remains owned by the caller.
+ * Returns:
+ * - -1, if consumer (topic, msg) is NULL or the message is not taken
+ *   over (still owned by the caller)
+ * - 0 on success (message taken over), or for evm_message_post() the
+ *   number of subscribers (bridges) not delivered to
  */
 extern int evm_message_pass(evmConsumerStruct *consumer, evmMessageStruct *msg);
 extern int evm_message_post(evmTopicStruct *topic, evmMessageStruct *msg);
 
+/*
+ * Public API function:
+ * - evm_message_group_pass()
+ *
+ * Pass message to one of the group members (see evm_group_policy_set()).
+ * Returns:
+ * - -1, if group or msg is NULL, group without members or passing fails
+ * - 0 on success
+ */
+extern int evm_message_group_pass(evmGroupStruct *group, evmMessageStruct *msg);
+
+/*
+ * Public API functions:
+ * - evm_router_add()
+ * - evm_router_get()
+ * - evm_router_del()
+ */
+extern evmRouterStruct * evm_router_add(evmStruct *evm, int router_id);
+extern evmRouterStruct * evm_router_get(evmStruct *evm, int router_id);
+extern evmRouterStruct * evm_router_del(evmStruct *evm, int router_id);
+
+/*
+ * Public API functions:
+ * - evm_router_shard_add()
+ * - evm_router_shard_del()
+ * - evm_router_shard_stats_get()
+ * - evm_message_shard_pass()
+ *
+ * Sharded router spreads messages over its shard consumers, while
+ * keeping the order per message key (evm_message_key_set()): Each key is
+ * consistently hashed to one shard consumer, so adding or removing a
+ * shard (rebalancing) only moves keys from or to that shard (messages
+ * already queued are not moved). Shard stats report messages routed to
+ * the shard and its current queue depth. Deleting a consumer removes it
+ * from all routers.
+ * Returns:
+ * - -1, if any argument is NULL, consumer not a shard (stats), message
+ *   key not set, router without shards or passing fails
+ * - 0 on success
+ */
+struct evm_shard_stats {
+	unsigned long routed;
+	unsigned long depth;
+};
+typedef struct evm_shard_stats evmShardStatsStruct;
+
+extern int evm_router_shard_add(evmRouterStruct *router, evmConsumerStruct *consumer);
+extern int evm_router_shard_del(evmRouterStruct *router, evmConsumerStruct *consumer);
+extern int evm_router_shard_stats_get(evmRouterStruct *router, evmConsumerStruct *consumer, evmShardStatsStruct *stats);
+extern int evm_message_shard_pass(evmRouterStruct *router, evmMessageStruct *msg);
+
+/*
+ * Public API functions:
+ * - evm_msgtype_route_set()
+ * - evm_msgid_route_set()
+ * - evm_message_send()
+ *
+ * Route messages by their msgtype/msgid, so producers need not know
+ * their destinations: A consumer (passed), topic (posted), group (passed
+ * to one of its members) or sharded router (passed to the shard of the
+ * message key). The msgid's route overrides the msgtype's one. Routes
+ * are meant to be set before sending (not synchronized with sending),
+ * EVM_ROUTE_NONE (dest NULL) clears the route.
+ * Returns:
+ * - -1, if msgtype (msgid, msg) is NULL, invalid route kind or dest,
+ *   message without route or not taken over (still owned by the caller)
+ * - 0 (evm_message_post() result for topics) on success
+ */
+#define EVM_ROUTE_NONE 0
+#define EVM_ROUTE_CONSUMER 1
+#define EVM_ROUTE_TOPIC 2
+#define EVM_ROUTE_GROUP 3
+#define EVM_ROUTE_SHARD 4
+
+extern int evm_msgtype_route_set(evmMsgtypeStruct *msgtype, int route, void *dest);
+extern int evm_msgid_route_set(evmMsgidStruct *msgid, int route, void *dest);
+extern int evm_message_send(evmMessageStruct *msg);
+
+/*
+ * Public API functions:
+ * - evm_decode_threads_set() - number of decode threads (0 - raw messages
+ *   decoded by the calling thread, default)
+ * - evm_message_decode() - decode raw message (taken over) by its
+ *   msgtype's parser (see evm_msgtype_cb_parse_set()) and deliver it by
+ *   its routes (see evm_message_send()) or else, if not routed, pass it
+ *   to consumer (may be NULL) - deleted, if not delivered
+ *
+ * The decode stage of the evm: Raw input (i.e. received by the I/O
+ * engine or datagram adapters) gets decoded independently of handling
+ * consumers, on a pool of decode threads. Messages decoded by more
+ * threads may get reordered. Changing the number of threads lets the
+ * current ones finish already queued messages first.
+ * Returns:
+ * - -1, if evm (msg) is NULL, invalid threads provided, message without
+ *   msgtype, not decoded (or delivered) or failure
+ * - 0 on success (message queued for decode threads)
+ */
+extern int evm_decode_threads_set(evmStruct *evm, int threads);
+extern int evm_message_decode(evmConsumerStruct *consumer, evmMessageStruct *msg);
+
+/*
+ * Public API functions:
+ * - evm_pool_threads_set() - number of evm's worker threads (0 - workers
+ *   stopped, default)
+ * - evm_consumer_pool_add() - let consumer be run by the worker pool
+ * - evm_consumer_pool_del() - remove consumer from the pool (waits for a
+ *   worker to finish its current pass)
+ *
+ * M:N scheduling of consumers as lightweight actors: A pooled consumer
+ * gets runnable when messages get queued to it or its timer expires and
+ * then one of the workers runs its evm_run_async() pass - any worker,
+ * but never two at once (consumer's handlers remain single threaded).
+ * Each worker has its own run queue (consumers woken by its handlers are
+ * kept there) and steals from the others when idle. Pooled consumers
+ * must not be run by evm_run() (evm_run_once()) threads, their fd
+ * watchers are not served by the pool and timers started from other
+ * threads are only taken into account after their next pass. The pool
+ * follows CLOCK_REALTIME (not the virtual clock). A consumer must not
+ * remove itself from the pool (evm_consumer_del() removes it).
+ * Returns:
+ * - -1, if evm (consumer) is NULL, invalid threads provided, consumer
+ *   already (not) pooled or failure
+ * - 0 on success
+ */
+extern int evm_pool_threads_set(evmStruct *evm, int threads);
+extern int evm_consumer_pool_add(evmConsumerStruct *consumer);
+extern int evm_consumer_pool_del(evmConsumerStruct *consumer);
+
+/*
+ * Public API function:
+ * - evm_consumer_msgs_aging_set()
+ *
+ * Anti-starvation aging of consumer's message queue priority levels:
+ * After "aging_limit" messages in a row have been served from a higher
+ * level while lower levels were waiting, the next message is served from
+ * the lowest non-empty level (0 - no aging, default).
+ * Returns:
+ * - -1, if consumer is NULL or aging_limit negative
+ * - 0 on success
+ */
+extern int evm_consumer_msgs_aging_set(evmConsumerStruct *consumer, int aging_limit);
+
+/*
+ * Public API functions:
+ * - evm_consumer_queue_limit_set()
+ * - evm_consumer_queue_watermarks_set()
+ * - evm_consumer_queue_stats_get()
+ *
+ * Consumer's message queue capacity (0 - unlimited, default) and the
+ * policy applied, when a message is passed/posted to a full queue:
+ * - EVM_QUEUE_OVERFLOW_FAIL: message rejected (errno EAGAIN)
+ * - EVM_QUEUE_OVERFLOW_BLOCK: evm_message_pass() blocks until space is
+ *   available or the (relative, real time) timeout expires (NULL - no
+ *   timeout), then rejected as above - posts and passes by the consumer's
+ *   own handlers never block and get rejected right away
+ * - EVM_QUEUE_OVERFLOW_DROP_OLDEST: the oldest message of the lowest
+ *   priority level is dropped in favour of the new one
+ * - EVM_QUEUE_OVERFLOW_DROP_NEWEST: the new message is dropped
+ * Rejected messages remain owned by the caller (evm_message_pass()
+ * returns -1, evm_message_post() counts them as failed), while dropped
+ * ones are deleted as if handled.
+ * The watermark callback is called by the producer, when the queue depth
+ * reaches "high_wm" (above = true), and by the consumer, when it falls
+ * back to "low_wm" (above = false) - i.e. to pause/resume producers
+ * (high_wm 0 - no watermarks).
+ * Returns:
+ * - -1, if consumer (or stats) is NULL or invalid arguments provided
+ * - 0 on success
+ */
+#define EVM_QUEUE_OVERFLOW_FAIL 0
+#define EVM_QUEUE_OVERFLOW_BLOCK 1
+#define EVM_QUEUE_OVERFLOW_DROP_OLDEST 2
+#define EVM_QUEUE_OVERFLOW_DROP_NEWEST 3
+
+struct evm_queue_stats {
+	unsigned long depth;
+	unsigned long max_depth;
+	unsigned long enqueued;
+	unsigned long dequeued;
+	unsigned long dropped;
+	unsigned long rejected;
+	unsigned long conflated;
+};
+typedef struct evm_queue_stats evmQueueStatsStruct;
+
+extern int evm_consumer_queue_limit_set(evmConsumerStruct *consumer, int capacity, int overflow, const struct timespec *timeout);
+extern int evm_consumer_queue_watermarks_set(evmConsumerStruct *consumer, int high_wm, int low_wm, int (*watermark)(evmConsumerStruct *consumer, int above));
+extern int evm_consumer_queue_stats_get(evmConsumerStruct *consumer, evmQueueStatsStruct *stats);
+
+/*
+ * Public API functions:
+ * - evm_consumer_conflate_set()
+ * - evm_topic_conflate_set()
+ *
+ * Last-value conflation mode of a consumer's queue (for all messages
+ * enqueued) or of a topic (for messages posted to it): A keyed message
+ * (evm_message_key_set()) replaces the undelivered message with the same
+ * msgid and key in place (keeping its queue position, unless moved to its
+ * own priority level or deadline order), instead of being appended - the
+ * replaced message is deleted as if handled ("conflated" queue counter).
+ * Queue size is bound by the keys cardinality.
+ * Returns:
+ * - -1, if consumer or topic is NULL
+ * - 0 on success
+ */
+extern int evm_consumer_conflate_set(evmConsumerStruct *consumer, int conflate);
+extern int evm_topic_conflate_set(evmTopicStruct *topic, int conflate);
+
 /*
  * Timers
  */
@@ -248,6 +986,30 @@ extern int evm_timer_stop(evmTimerStruct *timer);
 extern int evm_timer_ctx_set(evmTimerStruct *timer, void *ctx);
 extern void * evm_timer_ctx_get(evmTimerStruct *timer);
 
+/*
+ * Public API function:
+ * - evm_timer_start_many()
+ *
+ * Starts a batch of timers with a single clock read and a single
+ * (merge-style) pass over the consumer's timers queue. Each "arms"
+ * element provides tmrid, relative expiration time and ctx, while its
+ * "timer" member returns the started timer (NULL, if tmrid is NULL).
+ * Returns:
+ * - -1, if consumer or arms is NULL or any timer allocation fails
+ *   (in this case none of the timers is started)
+ * - number of started timers
+ */
+struct evm_timer_arm {
+	evmTmridStruct *tmrid;
+	time_t tv_sec;
+	long tv_nsec;
+	void *ctx;
+	evmTimerStruct *timer;
+};
+typedef struct evm_timer_arm evmTimerArmStruct;
+
+extern int evm_timer_start_many(evmConsumerStruct *consumer, evmTimerArmStruct *arms, int count);
+
 /*
  * Public API function:
  * - evm_timer_delete()
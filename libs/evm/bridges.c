@@ -0,0 +1,608 @@
+/*
+ * The EVM topic bridges module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_bridges_c
+#define EVM_FILE_bridges_c
+#else
+#error Preprocesor macro EVM_FILE_bridges_c conflict!
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "evm/libevm.h"
+
+#include "evm.h"
+#include "fds.h"
+#include "bridges.h"
+
+#define U2UP_LOG_NAME EVM_BRDG
+#include <u2up-log/u2up-log.h>
+
+static int buf_reserve(bridges_buf_struct *buf, size_t len);
+static int frame_append(evm_bridge_struct *bridge, uint32_t kind, int topic_id, int msgtype_id, int msgid_id, const void *data, size_t size);
+static int topic_link(evm_bridge_struct *bridge, int topic_id);
+static void topic_unlink(evm_bridge_struct *bridge, int topic_id);
+static void bridge_shutdown(evm_bridge_struct *bridge);
+static int bridge_write(evm_bridge_struct *bridge);
+static int frame_receive(evm_bridge_struct *bridge, bridges_frame_struct *frame, const char *data);
+static int frames_receive(evm_bridge_struct *bridge);
+static int bridge_handle(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx);
+static void bridge_unref(evm_bridge_struct *bridge);
+static int credit_take(evm_bridge_struct *bridge);
+static void credit_grant(evm_bridge_struct *bridge);
+static void credit_release(void *ctx);
+
+static int buf_reserve(bridges_buf_struct *buf, size_t len)
+{
+	size_t size = (buf->size > 0) ? buf->size : 4096;
+	char *data;
+
+	if (buf->len + len <= buf->size)
+		return 0;
+
+	while (size < buf->len + len)
+		size <<= 1;
+	if ((data = (char *)realloc(buf->data, size)) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("realloc(): bridge buffer\n");
+		return -1;
+	}
+	buf->data = data;
+	buf->size = size;
+	return 0;
+}
+
+/*
+ * Coalesce frame (any thread) - the owner woken to flush, when first one.
+ */
+static int frame_append(evm_bridge_struct *bridge, uint32_t kind, int topic_id, int msgtype_id, int msgid_id, const void *data, size_t size)
+{
+	bridges_frame_struct frame;
+	int first;
+
+	frame.size = htonl((uint32_t)size);
+	frame.kind = htonl(kind);
+	frame.topic_id = htonl((uint32_t)topic_id);
+	frame.msgtype_id = htonl((uint32_t)msgtype_id);
+	frame.msgid_id = htonl((uint32_t)msgid_id);
+
+	pthread_mutex_lock(&bridge->out_mutex);
+	if ((bridge->out.len + sizeof(frame) + size > EVM_BRIDGE_OUT_MAX) || (buf_reserve(&bridge->out, sizeof(frame) + size) != 0)) {
+		pthread_mutex_unlock(&bridge->out_mutex);
+		__atomic_add_fetch(&bridge->dropped, 1, __ATOMIC_RELAXED);
+		u2up_log_debug("Bridge output full - frame dropped!\n");
+		return -1;
+	}
+	first = (bridge->out.len == 0);
+	memcpy(bridge->out.data + bridge->out.len, &frame, sizeof(frame));
+	if (size > 0)
+		memcpy(bridge->out.data + bridge->out.len + sizeof(frame), data, size);
+	bridge->out.len += sizeof(frame) + size;
+	pthread_mutex_unlock(&bridge->out_mutex);
+
+	if (first)
+		fds_signal(bridge->consumer);
+
+	return 0;
+}
+
+/*
+ * Received posts (and the owner) hold references - freed by the last one.
+ */
+static void bridge_unref(evm_bridge_struct *bridge)
+{
+	if (__atomic_sub_fetch(&bridge->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+
+	pthread_mutex_destroy(&bridge->out_mutex);
+	free(bridge->out.data);
+	free(bridge->wire.data);
+	free(bridge->in.data);
+	free(bridge->topics);
+	free(bridge);
+}
+
+/*
+ * Credits - posts forwarded, but not yet deleted by the peer.
+ */
+static int credit_take(evm_bridge_struct *bridge)
+{
+	int credits = __atomic_load_n(&bridge->credits, __ATOMIC_RELAXED);
+
+	do {
+		if (credits <= 0)
+			return -1;
+	} while (!__atomic_compare_exchange_n(&bridge->credits, &credits, credits - 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+	return 0;
+}
+
+/*
+ * Received post handled (any thread) - the credit granted back with the
+ * next flush. The owner is signalled under the output lock, so it can not
+ * get freed meanwhile (see evm_bridge_del()).
+ */
+static void credit_grant(evm_bridge_struct *bridge)
+{
+	if (__atomic_add_fetch(&bridge->granted, 1, __ATOMIC_ACQ_REL) == 1) {
+		pthread_mutex_lock(&bridge->out_mutex);
+		if (!bridge->deleted)
+			fds_signal(bridge->consumer);
+		pthread_mutex_unlock(&bridge->out_mutex);
+	}
+}
+
+/*
+ * Received post release hook (message deleted by any thread).
+ */
+static void credit_release(void *ctx)
+{
+	evm_bridge_struct *bridge = (evm_bridge_struct *)ctx;
+
+	credit_grant(bridge);
+	bridge_unref(bridge);
+}
+
+/*
+ * Topic subscribed by the peer - its posts forwarded.
+ */
+static int topic_link(evm_bridge_struct *bridge, int topic_id)
+{
+	evm_topic_struct *topic;
+	evm_bridge_struct **bridges;
+	int *topics;
+	int i;
+
+	for (i = 0; i < bridge->topics_num; i++) {
+		if (bridge->topics[i] == topic_id)
+			return 0;
+	}
+	if ((topic = evm_topic_add(bridge->consumer->evm, topic_id)) == NULL)
+		return -1;
+
+	if (bridge->topics_num == bridge->topics_size) {
+		if ((topics = (int *)realloc(bridge->topics, (bridge->topics_size + 8) * sizeof(int))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("realloc(): topics\n");
+			return -1;
+		}
+		bridge->topics = topics;
+		bridge->topics_size += 8;
+	}
+
+	pthread_mutex_lock(&topic->consumers_list->access_mutex);
+	if ((bridges = (evm_bridge_struct **)realloc(topic->bridges, (topic->bridges_num + 1) * sizeof(evm_bridge_struct *))) == NULL) {
+		pthread_mutex_unlock(&topic->consumers_list->access_mutex);
+		errno = ENOMEM;
+		u2up_log_system_error("realloc(): bridges\n");
+		return -1;
+	}
+	bridges[topic->bridges_num++] = bridge;
+	topic->bridges = bridges;
+	pthread_mutex_unlock(&topic->consumers_list->access_mutex);
+
+	bridge->topics[bridge->topics_num++] = topic_id;
+	return 0;
+}
+
+static void topic_unlink(evm_bridge_struct *bridge, int topic_id)
+{
+	evm_topic_struct *topic;
+	int i;
+
+	for (i = 0; i < bridge->topics_num; i++) {
+		if (bridge->topics[i] == topic_id)
+			break;
+	}
+	if (i == bridge->topics_num)
+		return;
+	bridge->topics[i] = bridge->topics[--bridge->topics_num];
+
+	/* Topic may be gone meanwhile. */
+	if ((topic = evm_topic_get(bridge->consumer->evm, topic_id)) == NULL)
+		return;
+
+	pthread_mutex_lock(&topic->consumers_list->access_mutex);
+	for (i = 0; i < topic->bridges_num; i++) {
+		if (topic->bridges[i] == bridge) {
+			topic->bridges[i] = topic->bridges[--topic->bridges_num];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&topic->consumers_list->access_mutex);
+}
+
+/*
+ * Peer gone (or failure) - nothing forwarded any more.
+ */
+static void bridge_shutdown(evm_bridge_struct *bridge)
+{
+	u2up_log_info("(entry) bridge=%p\n", bridge);
+
+	if (bridge->down)
+		return;
+
+	bridge->down = EVM_TRUE;
+	while (bridge->topics_num > 0)
+		topic_unlink(bridge, bridge->topics[0]);
+	evm_fd_del(bridge->consumer, bridge->fd);
+
+	if (bridge->bridge_down != NULL)
+		bridge->bridge_down(bridge->consumer, bridge);
+}
+
+static int bridge_write(evm_bridge_struct *bridge)
+{
+	bridges_buf_struct tmp;
+	ssize_t n;
+
+	while (!bridge->down) {
+		if (bridge->wire.off == bridge->wire.len) {
+			bridge->wire.off = 0;
+			bridge->wire.len = 0;
+			/* Take coalesced frames at once. */
+			pthread_mutex_lock(&bridge->out_mutex);
+			if (bridge->out.len == 0) {
+				pthread_mutex_unlock(&bridge->out_mutex);
+				break;
+			}
+			tmp = bridge->wire;
+			bridge->wire = bridge->out;
+			bridge->out = tmp;
+			pthread_mutex_unlock(&bridge->out_mutex);
+		}
+		if ((n = send(bridge->fd, bridge->wire.data + bridge->wire.off, bridge->wire.len - bridge->wire.off, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				if (!bridge->writable_wait) {
+					if (evm_fd_mod(bridge->consumer, bridge->fd, EPOLLIN | EPOLLOUT) == 0)
+						bridge->writable_wait = EVM_TRUE;
+				}
+				return 0;
+			}
+			u2up_log_system_error("send(): bridge\n");
+			bridge_shutdown(bridge);
+			return -1;
+		}
+		bridge->wire.off += n;
+	}
+
+	if (bridge->writable_wait && !bridge->down) {
+		if (evm_fd_mod(bridge->consumer, bridge->fd, EPOLLIN) == 0)
+			bridge->writable_wait = EVM_FALSE;
+	}
+	return 0;
+}
+
+/*
+ * Handle received frame: Control frames must carry no data and credits
+ * within the window, unknown kinds are protocol errors (the bridge gets
+ * shut down). Post data is taken as is - its layout is the peer's one.
+ */
+static int frame_receive(evm_bridge_struct *bridge, bridges_frame_struct *frame, const char *data)
+{
+	evm_struct *evm = bridge->consumer->evm;
+	evm_topic_struct *topic;
+	evm_msgtype_struct *msgtype;
+	evm_msgid_struct *msgid = NULL;
+	evm_message_struct *msg;
+
+	if ((frame->kind != BRIDGES_FRAME_POST) && (frame->size != 0)) {
+		u2up_log_error("Bridge control frame (kind=%u) with data!\n", (unsigned int)frame->kind);
+		return -1;
+	}
+
+	switch (frame->kind) {
+	case BRIDGES_FRAME_SUB:
+		topic_link(bridge, frame->topic_id);
+		break;
+	case BRIDGES_FRAME_UNSUB:
+		topic_unlink(bridge, frame->topic_id);
+		break;
+	case BRIDGES_FRAME_CREDIT:
+		if ((frame->topic_id == 0) || (frame->topic_id > EVM_BRIDGE_WINDOW)) {
+			u2up_log_error("Bridge credits (%u) out of window!\n", (unsigned int)frame->topic_id);
+			return -1;
+		}
+		__atomic_add_fetch(&bridge->credits, (int)frame->topic_id, __ATOMIC_RELEASE);
+		break;
+	case BRIDGES_FRAME_POST:
+		/* Dropped posts grant their credits back as well. */
+		if ((topic = evm_topic_get(evm, frame->topic_id)) == NULL) {
+			u2up_log_debug("Unknown topic (id=%d) - post dropped!\n", (int)frame->topic_id);
+			credit_grant(bridge);
+			break;
+		}
+		if ((msgtype = evm_msgtype_get(evm, frame->msgtype_id)) != NULL)
+			msgid = evm_msgid_get(msgtype, frame->msgid_id);
+		if (msgid == NULL) {
+			u2up_log_error("Unknown message (type=%d, id=%d) dropped!\n", (int)frame->msgtype_id, (int)frame->msgid_id);
+			credit_grant(bridge);
+			break;
+		}
+		if ((msg = evm_message_new(msgtype, msgid, frame->size)) == NULL) {
+			credit_grant(bridge);
+			break;
+		}
+		if (frame->size > 0)
+			memcpy(msg->data, data, frame->size);
+		/* Not forwarded back over this bridge. */
+		msg->bridge = bridge;
+		/* Credit granted back, when deleted (by all subscribers). */
+		__atomic_add_fetch(&bridge->refs, 1, __ATOMIC_RELAXED);
+		msg->release = credit_release;
+		msg->release_ctx = bridge;
+		/* Hold a reference - freed here, if nobody subscribed. */
+		pthread_mutex_lock(&msg->amtx);
+		msg->consumers++;
+		pthread_mutex_unlock(&msg->amtx);
+		if (evm_message_post(topic, msg) != 0)
+			u2up_log_debug("evm_message_post() not delivered to all subscribers\n");
+		evm_message_delete(msg);
+		break;
+	default:
+		u2up_log_error("Unknown bridge frame kind (%u)!\n", (unsigned int)frame->kind);
+		return -1;
+	}
+	return 0;
+}
+
+static int frames_receive(evm_bridge_struct *bridge)
+{
+	bridges_buf_struct *in = &bridge->in;
+	bridges_frame_struct frame;
+
+	while (!bridge->down && (in->len - in->off >= sizeof(frame))) {
+		memcpy(&frame, in->data + in->off, sizeof(frame));
+		frame.size = ntohl(frame.size);
+		if (frame.size > EVM_BRIDGE_FRAME_MAX) {
+			u2up_log_error("Bridge frame too big (%u)!\n", (unsigned int)frame.size);
+			return -1;
+		}
+		if (in->len - in->off < sizeof(frame) + frame.size)
+			break;
+		frame.kind = ntohl(frame.kind);
+		frame.topic_id = ntohl(frame.topic_id);
+		frame.msgtype_id = ntohl(frame.msgtype_id);
+		frame.msgid_id = ntohl(frame.msgid_id);
+		if (frame_receive(bridge, &frame, in->data + in->off + sizeof(frame)) != 0)
+			return -1;
+		in->off += sizeof(frame) + frame.size;
+	}
+
+	/* Keep partial frame only. */
+	if (in->off > 0) {
+		memmove(in->data, in->data + in->off, in->len - in->off);
+		in->len -= in->off;
+		in->off = 0;
+	}
+	return 0;
+}
+
+/*
+ * Socket ready (watched within the owner's epoll set).
+ */
+static int bridge_handle(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx)
+{
+	evm_bridge_struct *bridge = (evm_bridge_struct *)ctx;
+	ssize_t n;
+	u2up_log_info("(cb entry) fd=%d, revents=0x%x\n", fd, revents);
+
+	/* Bridge may be deleted, when shut down (see bridge_down()). */
+	if (revents & EPOLLOUT) {
+		if (bridge_write(bridge) != 0)
+			return 0;
+	}
+
+	if (!(revents & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+		return 0;
+
+	while (!bridge->down) {
+		if (buf_reserve(&bridge->in, EVM_BRIDGE_READ_SIZE) != 0) {
+			bridge_shutdown(bridge);
+			return -1;
+		}
+		if ((n = read(fd, bridge->in.data + bridge->in.len, bridge->in.size - bridge->in.len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+			u2up_log_system_error("read(): bridge\n");
+			bridge_shutdown(bridge);
+			return -1;
+		}
+		if (n == 0) {
+			u2up_log_debug("Bridge peer gone\n");
+			bridge_shutdown(bridge);
+			return 0;
+		}
+		bridge->in.len += n;
+		if (frames_receive(bridge) != 0) {
+			bridge_shutdown(bridge);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int bridges_forward(evm_topic_struct *topic, evm_message_struct *msg, int *forwarded)
+{
+	evm_bridge_struct *bridge;
+	int i, rv = 0;
+
+	if ((msg->msgtype == NULL) || (msg->msgid == NULL)) {
+		u2up_log_debug("Message without msgid not forwarded!\n");
+		return 0;
+	}
+
+	for (i = 0; i < topic->bridges_num; i++) {
+		if ((bridge = topic->bridges[i]) == msg->bridge)
+			continue;
+		/* Backpressure - the peer falls behind. */
+		if (credit_take(bridge) != 0) {
+			u2up_log_debug("No bridge credits - message rejected!\n");
+			__atomic_add_fetch(&bridge->dropped, 1, __ATOMIC_RELAXED);
+			errno = EAGAIN;
+			rv++;
+			continue;
+		}
+		if (frame_append(bridge, BRIDGES_FRAME_POST, topic->id, msg->msgtype->id, msg->msgid->id, msg->data, (msg->data != NULL) ? msg->size : 0) != 0) {
+			__atomic_add_fetch(&bridge->credits, 1, __ATOMIC_RELAXED);
+			errno = EAGAIN;
+			rv++;
+			continue;
+		}
+		(*forwarded)++;
+	}
+
+	return rv;
+}
+
+void bridges_flush(evm_consumer_struct *consumer)
+{
+	evm_bridge_struct *bridge, *next;
+
+	int granted;
+
+	for (bridge = consumer->bridges; bridge != NULL; bridge = next) {
+		next = bridge->next;
+		if (!bridge->down && ((granted = __atomic_exchange_n(&bridge->granted, 0, __ATOMIC_ACQ_REL)) > 0)) {
+			/* Not granted yet - retried with the next flush. */
+			if (frame_append(bridge, BRIDGES_FRAME_CREDIT, granted, 0, 0, NULL, 0) != 0)
+				__atomic_add_fetch(&bridge->granted, granted, __ATOMIC_ACQ_REL);
+		}
+		bridge_write(bridge);
+	}
+}
+
+void bridges_consumer_free(evm_consumer_struct *consumer)
+{
+	u2up_log_info("(entry)\n");
+
+	while (consumer->bridges != NULL)
+		evm_bridge_del(consumer->bridges);
+}
+
+/*
+ * Public API functions:
+ * - evm_bridge_add()
+ * - evm_bridge_del()
+ * - evm_bridge_subscribe()
+ * - evm_bridge_unsubscribe()
+ */
+evmBridgeStruct * evm_bridge_add(evmConsumerStruct *consumer, int fd, int (*bridge_down)(evmConsumerStruct *consumer, evmBridgeStruct *bridge))
+{
+	evm_bridge_struct *bridge;
+	int flags;
+	u2up_log_info("(entry) consumer=%p, fd=%d\n", consumer, fd);
+
+	if ((consumer == NULL) || (fd < 0))
+		return NULL;
+
+	if (((flags = fcntl(fd, F_GETFL)) < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+		u2up_log_system_error("fcntl(): O_NONBLOCK\n");
+		return NULL;
+	}
+	if ((bridge = (evm_bridge_struct *)calloc(1, sizeof(evm_bridge_struct))) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("calloc(): bridge\n");
+		return NULL;
+	}
+	bridge->consumer = consumer;
+	bridge->fd = fd;
+	bridge->bridge_down = bridge_down;
+	bridge->refs = 1;
+	pthread_mutex_init(&bridge->out_mutex, NULL);
+	if (evm_fd_add(consumer, fd, EPOLLIN, bridge_handle, bridge) < 0) {
+		pthread_mutex_destroy(&bridge->out_mutex);
+		free(bridge);
+		return NULL;
+	}
+	bridge->next = consumer->bridges;
+	consumer->bridges = bridge;
+
+	/* Initial window of the peer's posts (granted with the next flush, if failed). */
+	if (frame_append(bridge, BRIDGES_FRAME_CREDIT, EVM_BRIDGE_WINDOW, 0, 0, NULL, 0) != 0) {
+		__atomic_add_fetch(&bridge->granted, EVM_BRIDGE_WINDOW, __ATOMIC_ACQ_REL);
+		fds_signal(consumer);
+	}
+
+	return bridge;
+}
+
+int evm_bridge_del(evmBridgeStruct *bridge)
+{
+	evm_bridge_struct **ptr;
+	u2up_log_info("(entry) bridge=%p\n", bridge);
+
+	if (bridge == NULL)
+		return -1;
+
+	for (ptr = &bridge->consumer->bridges; *ptr != NULL; ptr = &(*ptr)->next) {
+		if (*ptr == bridge) {
+			*ptr = bridge->next;
+			break;
+		}
+	}
+	if (!bridge->down) {
+		while (bridge->topics_num > 0)
+			topic_unlink(bridge, bridge->topics[0]);
+		evm_fd_del(bridge->consumer, bridge->fd);
+	}
+	/* Received posts still alive keep it (no longer signalling the owner). */
+	pthread_mutex_lock(&bridge->out_mutex);
+	bridge->deleted = EVM_TRUE;
+	pthread_mutex_unlock(&bridge->out_mutex);
+	bridge_unref(bridge);
+
+	return 0;
+}
+
+int evm_bridge_subscribe(evmBridgeStruct *bridge, int topic_id)
+{
+	u2up_log_info("(entry) bridge=%p, topic_id=%d\n", bridge, topic_id);
+
+	if ((bridge == NULL) || bridge->down)
+		return -1;
+
+	return frame_append(bridge, BRIDGES_FRAME_SUB, topic_id, 0, 0, NULL, 0);
+}
+
+int evm_bridge_unsubscribe(evmBridgeStruct *bridge, int topic_id)
+{
+	u2up_log_info("(entry) bridge=%p, topic_id=%d\n", bridge, topic_id);
+
+	if ((bridge == NULL) || bridge->down)
+		return -1;
+
+	return frame_append(bridge, BRIDGES_FRAME_UNSUB, topic_id, 0, 0, NULL, 0);
+}
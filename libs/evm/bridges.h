@@ -0,0 +1,108 @@
+/*
+ * The EVM topic bridges module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+
+#ifndef EVM_FILE_bridges_h
+#define EVM_FILE_bridges_h
+
+#ifdef EVM_FILE_bridges_c
+/* PRIVATE usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN
+#else
+/* PUBLIC usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN extern
+#endif
+
+#include <stdint.h>
+
+/* Bytes read per read() */
+#define EVM_BRIDGE_READ_SIZE 65536
+/* Max frame data size */
+#define EVM_BRIDGE_FRAME_MAX (16 * 1024 * 1024)
+/* Max coalesced (not yet flushed) bytes - posts dropped above */
+#define EVM_BRIDGE_OUT_MAX (64 * 1024 * 1024)
+
+/* Frame kinds */
+#define BRIDGES_FRAME_POST 1
+#define BRIDGES_FRAME_SUB 2
+#define BRIDGES_FRAME_UNSUB 3
+#define BRIDGES_FRAME_CREDIT 4 /*credits granted in topic_id*/
+
+typedef struct bridges_buf bridges_buf_struct;
+typedef struct bridges_frame bridges_frame_struct;
+
+/*Frame header (network byte order, followed by size data bytes)*/
+struct bridges_frame {
+	uint32_t size;
+	uint32_t kind;
+	uint32_t topic_id;
+	uint32_t msgtype_id;
+	uint32_t msgid_id;
+}; /*bridges_frame_struct*/
+
+struct bridges_buf {
+	char *data;
+	size_t len; /*bytes filled*/
+	size_t off; /*bytes consumed*/
+	size_t size; /*bytes allocated*/
+}; /*bridges_buf_struct*/
+
+struct evm_bridge {
+	evm_consumer_struct *consumer; /*owner - bridge served by its thread*/
+	int fd; /*connected stream socket*/
+	int down; /*peer gone (or failure)*/
+	int writable_wait; /*EPOLLOUT watched*/
+	int (*bridge_down)(evm_consumer_struct *consumer, evm_bridge_struct *bridge);
+	pthread_mutex_t out_mutex;
+	bridges_buf_struct out; /*frames being coalesced (any thread)*/
+	bridges_buf_struct wire; /*frames being written*/
+	bridges_buf_struct in; /*frames being received*/
+	int *topics; /*topics subscribed by the peer*/
+	int topics_num;
+	int topics_size;
+	unsigned long dropped; /*posts dropped (EVM_BRIDGE_OUT_MAX or no credits)*/
+	int credits; /*posts forwardable (granted by the peer)*/
+	int granted; /*credits to be granted to the peer (received posts deleted)*/
+	int refs; /*received posts alive and the owner's reference*/
+	int deleted; /*owner gone (out_mutex)*/
+	evm_bridge_struct *next; /*owner's bridges*/
+}; /*evm_bridge_struct*/
+
+/*
+ * Forward message posted to topic (topic's subscriptions locked), with
+ * the number of bridges forwarded to (data copied) added to "forwarded".
+ * Returns number of bridges not forwarded to (no credits).
+ */
+EXTERN int bridges_forward(evm_topic_struct *topic_ptr, evm_message_struct *msg_ptr, int *forwarded);
+
+/*
+ * Write coalesced frames of consumer's bridges (end of each pass).
+ */
+EXTERN void bridges_flush(evm_consumer_struct *consumer_ptr);
+
+/*
+ * Free consumer's bridges.
+ */
+EXTERN void bridges_consumer_free(evm_consumer_struct *consumer_ptr);
+
+#endif /*EVM_FILE_bridges_h*/
@@ -0,0 +1,233 @@
+/*
+ * The EVM decoders module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_decoders_c
+#define EVM_FILE_decoders_c
+#else
+#error Preprocesor macro EVM_FILE_decoders_c conflict!
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "evm/libevm.h"
+
+#include "evm.h"
+#include "decoders.h"
+
+#define U2UP_LOG_NAME EVM_DCDR
+#include <u2up-log/u2up-log.h>
+
+static int decoder_decode(evm_consumer_struct *consumer, evm_message_struct *msg);
+static void * decoder_thread_start(void *arg);
+static void decoders_stop(decoders_struct *decoders);
+
+/*
+ * Decode raw message by its msgtype's parser and deliver it by its routes
+ * (or to the fallback consumer, if not routed). The message is always
+ * taken over (deleted, if not delivered).
+ */
+static int decoder_decode(evm_consumer_struct *consumer, evm_message_struct *msg)
+{
+	int rv;
+	int (*msgtype_parse)(void *ptr) = msg->msgtype->msgtype_parse;
+
+	if (msgtype_parse != NULL) {
+		if ((rv = msgtype_parse((void *)msg)) < 0) {
+			u2up_log_debug("Message not decoded - dropped!\n");
+			evm_message_delete(msg);
+			return -1;
+		}
+		/* Taken over by the parser. */
+		if (rv > 0)
+			return 0;
+	}
+
+	if (msg->msgid == NULL) {
+		u2up_log_debug("Message msgid not resolved - dropped!\n");
+		evm_message_delete(msg);
+		return -1;
+	}
+	if ((msg->msgid->route != EVM_ROUTE_NONE) || (msg->msgtype->route != EVM_ROUTE_NONE)) {
+		/* Routed - never delivered elsewhere (i.e. when rejected). */
+		if (evm_message_send(msg) >= 0)
+			return 0;
+	} else if ((consumer != NULL) && (evm_message_pass(consumer, msg) == 0))
+		return 0;
+
+	/* Not taken over by anyone. */
+	evm_message_delete(msg);
+	return -1;
+}
+
+static void * decoder_thread_start(void *arg)
+{
+	decoders_struct *decoders = (decoders_struct *)arg;
+	decoders_item_struct item;
+	u2up_log_info("(entry)\n");
+
+	pthread_mutex_lock(&decoders->mutex);
+	while (1) {
+		while ((decoders->items_num == 0) && !decoders->stop)
+			pthread_cond_wait(&decoders->cond, &decoders->mutex);
+		if (decoders->items_num == 0)
+			break;
+		item = decoders->items[decoders->items_first];
+		decoders->items_first = (decoders->items_first + 1) % decoders->items_size;
+		decoders->items_num--;
+		pthread_mutex_unlock(&decoders->mutex);
+
+		decoder_decode(item.consumer, item.msg);
+
+		pthread_mutex_lock(&decoders->mutex);
+	}
+	pthread_mutex_unlock(&decoders->mutex);
+
+	return NULL;
+}
+
+/*
+ * Stop decode threads (after decoding already queued messages).
+ */
+static void decoders_stop(decoders_struct *decoders)
+{
+	int i;
+
+	pthread_mutex_lock(&decoders->mutex);
+	decoders->stop = EVM_TRUE;
+	pthread_cond_broadcast(&decoders->cond);
+	pthread_mutex_unlock(&decoders->mutex);
+
+	for (i = 0; i < decoders->threads_num; i++)
+		pthread_join(decoders->threads[i], NULL);
+
+	pthread_mutex_lock(&decoders->mutex);
+	free(decoders->threads);
+	decoders->threads = NULL;
+	decoders->threads_num = 0;
+	decoders->stop = EVM_FALSE;
+	pthread_mutex_unlock(&decoders->mutex);
+}
+
+/*
+ * Public API functions:
+ * - evm_decode_threads_set()
+ * - evm_message_decode()
+ */
+int evm_decode_threads_set(evmStruct *evm, int threads)
+{
+	int rv = 0;
+	decoders_struct *decoders;
+	u2up_log_info("(entry) threads=%d\n", threads);
+
+	if ((evm == NULL) || (threads < 0))
+		return -1;
+
+	pthread_mutex_lock(&evm->decoders_mutex);
+	if ((decoders = evm->decoders) == NULL) {
+		if ((decoders = (decoders_struct *)calloc(1, sizeof(decoders_struct))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): decoders\n");
+			pthread_mutex_unlock(&evm->decoders_mutex);
+			return -1;
+		}
+		pthread_mutex_init(&decoders->mutex, NULL);
+		pthread_cond_init(&decoders->cond, NULL);
+		evm->decoders = decoders;
+	}
+
+	if (decoders->threads_num > 0)
+		decoders_stop(decoders);
+
+	if (threads > 0) {
+		if ((decoders->threads = (pthread_t *)calloc(threads, sizeof(pthread_t))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): threads\n");
+			rv = -1;
+		} else {
+			pthread_mutex_lock(&decoders->mutex);
+			for (decoders->threads_num = 0; decoders->threads_num < threads; decoders->threads_num++) {
+				if (pthread_create(&decoders->threads[decoders->threads_num], NULL, decoder_thread_start, decoders) != 0) {
+					u2up_log_system_error("pthread_create()\n");
+					rv = -1;
+					break;
+				}
+			}
+			pthread_mutex_unlock(&decoders->mutex);
+		}
+	}
+	pthread_mutex_unlock(&evm->decoders_mutex);
+
+	return rv;
+}
+
+int evm_message_decode(evmConsumerStruct *consumer, evmMessageStruct *msg)
+{
+	int i, size;
+	decoders_struct *decoders;
+	decoders_item_struct *items;
+	u2up_log_info("(entry) consumer=%p, msg=%p\n", consumer, msg);
+
+	if (msg == NULL)
+		return -1;
+
+	if (msg->msgtype == NULL) {
+		evm_message_delete(msg);
+		return -1;
+	}
+
+	if ((decoders = msg->msgtype->evm->decoders) == NULL)
+		return decoder_decode(consumer, msg);
+
+	pthread_mutex_lock(&decoders->mutex);
+	if ((decoders->threads_num == 0) || decoders->stop) {
+		/* Decoded by the calling thread. */
+		pthread_mutex_unlock(&decoders->mutex);
+		return decoder_decode(consumer, msg);
+	}
+	if (decoders->items_num == decoders->items_size) {
+		/* Grow the queue ring (unwrapped into the new one). */
+		size = (decoders->items_size == 0) ? 64 : (decoders->items_size * 2);
+		if ((items = (decoders_item_struct *)malloc(size * sizeof(decoders_item_struct))) == NULL) {
+			pthread_mutex_unlock(&decoders->mutex);
+			errno = ENOMEM;
+			u2up_log_system_error("malloc(): items\n");
+			evm_message_delete(msg);
+			return -1;
+		}
+		for (i = 0; i < decoders->items_num; i++)
+			items[i] = decoders->items[(decoders->items_first + i) % decoders->items_size];
+		free(decoders->items);
+		decoders->items = items;
+		decoders->items_first = 0;
+		decoders->items_size = size;
+	}
+	decoders->items[(decoders->items_first + decoders->items_num) % decoders->items_size].consumer = consumer;
+	decoders->items[(decoders->items_first + decoders->items_num) % decoders->items_size].msg = msg;
+	decoders->items_num++;
+	pthread_cond_signal(&decoders->cond);
+	pthread_mutex_unlock(&decoders->mutex);
+
+	return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * The EVM decoders module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_decoders_h
+#define EVM_FILE_decoders_h
+
+#ifdef EVM_FILE_decoders_c
+/* PRIVATE usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN
+#else
+/* PUBLIC usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN extern
+#endif
+
+typedef struct decoders_item decoders_item_struct;
+
+/*Raw message queued for decoding*/
+struct decoders_item {
+	evm_consumer_struct *consumer; /*fallback destination*/
+	evm_message_struct *msg;
+}; /*decoders_item_struct*/
+
+/*Decode stage (pool of decode threads) of an evm*/
+struct decoders {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int stop; /*decode threads exit, when queue drained*/
+	pthread_t *threads;
+	int threads_num;
+	decoders_item_struct *items; /*queue (ring)*/
+	int items_first;
+	int items_num;
+	int items_size;
+}; /*decoders_struct*/
+
+#endif /*EVM_FILE_decoders_h*/
@@ -0,0 +1,471 @@
+/*
+ * The EVM dgrams module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_dgrams_c
+#define EVM_FILE_dgrams_c
+#else
+#error Preprocesor macro EVM_FILE_dgrams_c conflict!
+#endif
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+
+#include "evm/libevm.h"
+
+#include "evm.h"
+#include "dgrams.h"
+
+#define U2UP_LOG_NAME EVM_DGRM
+#include <u2up-log/u2up-log.h>
+
+static dgrams_buf_struct * pool_get(dgrams_pool_struct *pool);
+static void pool_put(dgrams_pool_struct *pool, dgrams_buf_struct *buf);
+static void pool_release(void *ctx);
+static void pool_unref(dgrams_pool_struct *pool);
+static dgrams_adapter_struct * dgram_adapter_get(evm_consumer_struct *consumer, int fd);
+static int dgram_deliver(evm_consumer_struct *consumer, dgrams_adapter_struct *adapter, dgrams_buf_struct *buf, struct mmsghdr *hdr);
+static int dgram_recv(evm_consumer_struct *consumer, dgrams_adapter_struct *adapter);
+static int dgram_send(dgrams_adapter_struct *adapter);
+static int dgram_handle(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx);
+
+static dgrams_buf_struct * pool_get(dgrams_pool_struct *pool)
+{
+	dgrams_buf_struct *buf;
+
+	pthread_mutex_lock(&pool->mutex);
+	if ((buf = pool->free) != NULL)
+		pool->free = buf->next;
+	pool->refs++;
+	pthread_mutex_unlock(&pool->mutex);
+
+	/* Pool grows to the number of buffers in use. */
+	if (buf == NULL) {
+		if ((buf = (dgrams_buf_struct *)malloc(sizeof(dgrams_buf_struct))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("malloc(): dgram buf\n");
+			pool_unref(pool);
+			return NULL;
+		}
+		buf->pool = pool;
+	}
+	buf->next = NULL;
+
+	return buf;
+}
+
+static void pool_put(dgrams_pool_struct *pool, dgrams_buf_struct *buf)
+{
+	pthread_mutex_lock(&pool->mutex);
+	buf->next = pool->free;
+	pool->free = buf;
+	pthread_mutex_unlock(&pool->mutex);
+	pool_unref(pool);
+}
+
+/*
+ * Message release hook (message deleted by any thread).
+ */
+static void pool_release(void *ctx)
+{
+	dgrams_buf_struct *buf = (dgrams_buf_struct *)ctx;
+
+	pool_put(buf->pool, buf);
+}
+
+static void pool_unref(dgrams_pool_struct *pool)
+{
+	dgrams_buf_struct *buf;
+	int refs;
+
+	pthread_mutex_lock(&pool->mutex);
+	refs = --pool->refs;
+	pthread_mutex_unlock(&pool->mutex);
+	if (refs > 0)
+		return;
+
+	while ((buf = pool->free) != NULL) {
+		pool->free = buf->next;
+		free(buf);
+	}
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+static dgrams_adapter_struct * dgram_adapter_get(evm_consumer_struct *consumer, int fd)
+{
+	dgrams_adapter_struct *adapter = NULL;
+	evmlist_el_struct *tmp;
+
+	if ((consumer == NULL) || (consumer->dgrams == NULL))
+		return NULL;
+
+	pthread_mutex_lock(&consumer->dgrams->adapters_list->access_mutex);
+	tmp = evm_search_evmlist(consumer->dgrams->adapters_list, fd);
+	if ((tmp != NULL) && (tmp->id == fd))
+		adapter = (dgrams_adapter_struct *)tmp->el;
+	pthread_mutex_unlock(&consumer->dgrams->adapters_list->access_mutex);
+
+	return adapter;
+}
+
+/*
+ * Received datagram handed to the decode stage.
+ */
+static int dgram_deliver(evm_consumer_struct *consumer, dgrams_adapter_struct *adapter, dgrams_buf_struct *buf, struct mmsghdr *hdr)
+{
+	evm_message_struct *msg;
+	evmDgramStruct *dgram;
+
+	if ((msg = evm_message_new(adapter->msgtype, adapter->msgid, sizeof(evmDgramStruct))) == NULL) {
+		pool_put(adapter->pool, buf);
+		return -1;
+	}
+	dgram = (evmDgramStruct *)msg->data;
+	dgram->iov.iov_base = buf->data;
+	dgram->iov.iov_len = hdr->msg_len;
+	buf->data[hdr->msg_len] = '\0';
+	dgram->addrlen = hdr->msg_hdr.msg_namelen;
+	if (dgram->addrlen > 0)
+		memcpy(&dgram->addr, hdr->msg_hdr.msg_name, dgram->addrlen);
+	msg->ctx = adapter->ctx;
+	msg->release = pool_release;
+	msg->release_ctx = buf;
+
+	return evm_message_decode(consumer, msg);
+}
+
+static int dgram_recv(evm_consumer_struct *consumer, dgrams_adapter_struct *adapter)
+{
+	struct mmsghdr hdrs[EVM_DGRAM_BATCH];
+	struct iovec iovs[EVM_DGRAM_BATCH];
+	struct sockaddr_storage addrs[EVM_DGRAM_BATCH];
+	dgrams_buf_struct *bufs[EVM_DGRAM_BATCH];
+	int i, n, num, batch;
+
+	for (batch = 0; batch < EVM_DGRAM_BATCHES; batch++) {
+		for (num = 0; num < EVM_DGRAM_BATCH; num++) {
+			if ((bufs[num] = pool_get(adapter->pool)) == NULL)
+				break;
+			iovs[num].iov_base = bufs[num]->data;
+			iovs[num].iov_len = EVM_DGRAM_SIZE;
+			memset(&hdrs[num], 0, sizeof(struct mmsghdr));
+			hdrs[num].msg_hdr.msg_iov = &iovs[num];
+			hdrs[num].msg_hdr.msg_iovlen = 1;
+			hdrs[num].msg_hdr.msg_name = &addrs[num];
+			hdrs[num].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		}
+		if (num == 0)
+			return -1;
+
+		while ((n = recvmmsg(adapter->fd, hdrs, num, MSG_DONTWAIT, NULL)) < 0) {
+			if (errno != EINTR)
+				break;
+		}
+		if ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+			u2up_log_system_error("recvmmsg(): fd=%d\n", adapter->fd);
+
+		for (i = 0; i < num; i++) {
+			if (i < n)
+				dgram_deliver(consumer, adapter, bufs[i], &hdrs[i]);
+			else
+				pool_put(adapter->pool, bufs[i]);
+		}
+		/* Socket drained. */
+		if (n < num)
+			break;
+	}
+
+	return 0;
+}
+
+static int dgram_send(dgrams_adapter_struct *adapter)
+{
+	struct mmsghdr hdrs[EVM_DGRAM_BATCH];
+	evmDgramStruct *dgram;
+	int i, n, num;
+
+	while (adapter->sends_num > 0) {
+		num = (adapter->sends_num < EVM_DGRAM_BATCH) ? adapter->sends_num : EVM_DGRAM_BATCH;
+		for (i = 0; i < num; i++) {
+			dgram = (evmDgramStruct *)adapter->sends[i]->data;
+			memset(&hdrs[i], 0, sizeof(struct mmsghdr));
+			hdrs[i].msg_hdr.msg_iov = &dgram->iov;
+			hdrs[i].msg_hdr.msg_iovlen = 1;
+			if (dgram->addrlen > 0) {
+				hdrs[i].msg_hdr.msg_name = &dgram->addr;
+				hdrs[i].msg_hdr.msg_namelen = dgram->addrlen;
+			}
+		}
+		if ((n = sendmmsg(adapter->fd, hdrs, num, MSG_DONTWAIT | MSG_NOSIGNAL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return 1;
+			/* Failed datagram dropped. */
+			u2up_log_system_error("sendmmsg(): fd=%d\n", adapter->fd);
+			n = 1;
+		}
+		for (i = 0; i < n; i++)
+			evm_message_delete(adapter->sends[i]);
+		adapter->sends_num -= n;
+		memmove(adapter->sends, adapter->sends + n, adapter->sends_num * sizeof(evm_message_struct *));
+	}
+
+	return 0;
+}
+
+static int dgram_handle(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx)
+{
+	dgrams_adapter_struct *adapter = (dgrams_adapter_struct *)ctx;
+	u2up_log_info("(cb entry) fd=%d, revents=0x%x\n", fd, revents);
+
+	if (revents & EPOLLOUT)
+		dgrams_flush(consumer);
+
+	if (revents & (EPOLLIN | EPOLLERR))
+		dgram_recv(consumer, adapter);
+
+	return 0;
+}
+
+void dgrams_flush(evm_consumer_struct *consumer)
+{
+	dgrams_set_struct *dgrams = consumer->dgrams;
+	dgrams_adapter_struct *adapter;
+	evmlist_el_struct *tmp;
+	int backlog;
+
+	if ((dgrams == NULL) || (dgrams->pending == 0))
+		return;
+
+	pthread_mutex_lock(&dgrams->adapters_list->access_mutex);
+	dgrams->pending = 0;
+	for (tmp = dgrams->adapters_list->first; tmp != NULL; tmp = tmp->next) {
+		adapter = (dgrams_adapter_struct *)tmp->el;
+		if ((adapter->sends_num == 0) && !adapter->out_watched)
+			continue;
+		backlog = (dgram_send(adapter) > 0);
+		if (backlog)
+			dgrams->pending++;
+		/* Socket buffer full - continue when writable. */
+		if (backlog != adapter->out_watched) {
+			if (evm_fd_mod(consumer, adapter->fd, backlog ? (EPOLLIN | EPOLLOUT) : EPOLLIN) == 0)
+				adapter->out_watched = backlog;
+		}
+	}
+	pthread_mutex_unlock(&dgrams->adapters_list->access_mutex);
+}
+
+void dgrams_consumer_free(evm_consumer_struct *consumer)
+{
+	dgrams_set_struct *dgrams = consumer->dgrams;
+	dgrams_adapter_struct *adapter;
+	evmlist_el_struct *tmp, *next;
+	int i;
+	u2up_log_info("(entry)\n");
+
+	if (dgrams == NULL)
+		return;
+
+	for (tmp = dgrams->adapters_list->first; tmp != NULL; tmp = next) {
+		next = tmp->next;
+		adapter = (dgrams_adapter_struct *)tmp->el;
+		for (i = 0; i < adapter->sends_num; i++)
+			evm_message_delete(adapter->sends[i]);
+		free(adapter->sends);
+		pool_unref(adapter->pool);
+		free(adapter);
+		free(tmp);
+	}
+	free(dgrams->adapters_list);
+	free(dgrams);
+	consumer->dgrams = NULL;
+}
+
+/*
+ * Public API functions:
+ * - evm_dgram_add()
+ * - evm_dgram_del()
+ * - evm_dgram_send()
+ * - evm_dgram_message_new()
+ */
+int evm_dgram_add(evmConsumerStruct *consumer, int fd, evmMsgtypeStruct *msgtype, evmMsgidStruct *msgid, void *ctx)
+{
+	int rv = 0;
+	dgrams_set_struct *dgrams;
+	dgrams_adapter_struct *adapter = NULL;
+	evmlist_el_struct *tmp, *new;
+	u2up_log_info("(entry) fd=%d\n", fd);
+
+	if ((consumer == NULL) || (fd < 0) || (msgtype == NULL) || (msgid == NULL))
+		return -1;
+
+	if ((dgrams = consumer->dgrams) == NULL) {
+		if ((dgrams = (dgrams_set_struct *)calloc(1, sizeof(dgrams_set_struct))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): dgrams\n");
+			return -1;
+		}
+		if ((dgrams->adapters_list = calloc(1, sizeof(evmlist_head_struct))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): dgrams->adapters_list\n");
+			free(dgrams);
+			return -1;
+		}
+		pthread_mutex_init(&dgrams->adapters_list->access_mutex, NULL);
+		pthread_mutex_unlock(&dgrams->adapters_list->access_mutex);
+		consumer->dgrams = dgrams;
+	}
+
+	pthread_mutex_lock(&dgrams->adapters_list->access_mutex);
+	tmp = evm_search_evmlist(dgrams->adapters_list, fd);
+	if ((tmp != NULL) && (tmp->id == fd)) {
+		/* fd already adapted */
+		errno = EEXIST;
+		rv = -1;
+	} else if ((new = evm_new_evmlist_el(fd)) == NULL) {
+		rv = -1;
+	} else if (
+		((adapter = (dgrams_adapter_struct *)calloc(1, sizeof(dgrams_adapter_struct))) == NULL) ||
+		((adapter->pool = (dgrams_pool_struct *)calloc(1, sizeof(dgrams_pool_struct))) == NULL)
+	) {
+		errno = ENOMEM;
+		u2up_log_system_error("calloc(): adapter\n");
+		free(adapter);
+		free(new);
+		rv = -1;
+	} else {
+		adapter->fd = fd;
+		adapter->msgtype = msgtype;
+		adapter->msgid = msgid;
+		adapter->ctx = ctx;
+		pthread_mutex_init(&adapter->pool->mutex, NULL);
+		adapter->pool->refs = 1;
+		if (evm_fd_add(consumer, fd, EPOLLIN, dgram_handle, adapter) < 0) {
+			pool_unref(adapter->pool);
+			free(adapter);
+			free(new);
+			rv = -1;
+		} else {
+			new->el = (void *)adapter;
+			new->prev = tmp;
+			new->next = NULL;
+			if (tmp != NULL)
+				tmp->next = new;
+			else
+				dgrams->adapters_list->first = new;
+		}
+	}
+	pthread_mutex_unlock(&dgrams->adapters_list->access_mutex);
+
+	return rv;
+}
+
+int evm_dgram_del(evmConsumerStruct *consumer, int fd)
+{
+	int i, rv = -1;
+	dgrams_set_struct *dgrams;
+	dgrams_adapter_struct *adapter;
+	evmlist_el_struct *tmp;
+	u2up_log_info("(entry) fd=%d\n", fd);
+
+	if ((consumer == NULL) || ((dgrams = consumer->dgrams) == NULL))
+		return -1;
+
+	pthread_mutex_lock(&dgrams->adapters_list->access_mutex);
+	tmp = evm_search_evmlist(dgrams->adapters_list, fd);
+	if ((tmp != NULL) && (tmp->id == fd)) {
+		adapter = (dgrams_adapter_struct *)tmp->el;
+		evm_fd_del(consumer, fd);
+		if (tmp->prev != NULL)
+			tmp->prev->next = tmp->next;
+		else
+			dgrams->adapters_list->first = tmp->next;
+		if (tmp->next != NULL)
+			tmp->next->prev = tmp->prev;
+		free(tmp);
+		for (i = 0; i < adapter->sends_num; i++)
+			evm_message_delete(adapter->sends[i]);
+		free(adapter->sends);
+		/* Buffers of received messages still in use keep the pool. */
+		pool_unref(adapter->pool);
+		free(adapter);
+		rv = 0;
+	}
+	pthread_mutex_unlock(&dgrams->adapters_list->access_mutex);
+
+	return rv;
+}
+
+int evm_dgram_send(evmConsumerStruct *consumer, int fd, evmMessageStruct *msg)
+{
+	int size;
+	dgrams_adapter_struct *adapter;
+	evm_message_struct **sends;
+	u2up_log_info("(entry) fd=%d, msg=%p\n", fd, msg);
+
+	if ((msg == NULL) || (msg->data == NULL))
+		return -1;
+
+	if ((adapter = dgram_adapter_get(consumer, fd)) == NULL)
+		return -1;
+
+	if (adapter->sends_num == adapter->sends_size) {
+		size = (adapter->sends_size == 0) ? EVM_DGRAM_BATCH : (adapter->sends_size * 2);
+		if ((sends = realloc(adapter->sends, size * sizeof(evm_message_struct *))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("realloc(): sends\n");
+			return -1;
+		}
+		adapter->sends = sends;
+		adapter->sends_size = size;
+	}
+	adapter->sends[adapter->sends_num++] = msg;
+	consumer->dgrams->pending++;
+
+	return 0;
+}
+
+evmMessageStruct * evm_dgram_message_new(evmMsgtypeStruct *msgtype, evmMsgidStruct *msgid, size_t size)
+{
+	evm_message_struct *msg;
+	evmDgramStruct *dgram;
+	u2up_log_info("(entry) size=%zu\n", size);
+
+	if ((msg = evm_message_new(msgtype, msgid, sizeof(evmDgramStruct) + size + 1)) == NULL)
+		return NULL;
+
+	dgram = (evmDgramStruct *)msg->data;
+	memset(dgram, 0, sizeof(evmDgramStruct));
+	dgram->iov.iov_base = (char *)(dgram + 1);
+	dgram->iov.iov_len = size;
+	((char *)dgram->iov.iov_base)[size] = '\0';
+
+	return msg;
+}
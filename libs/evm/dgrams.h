@@ -0,0 +1,87 @@
+/*
+ * The EVM dgrams module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_dgrams_h
+#define EVM_FILE_dgrams_h
+
+#ifdef EVM_FILE_dgrams_c
+/* PRIVATE usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN
+#else
+/* PUBLIC usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN extern
+#endif
+
+/* Datagrams per recvmmsg() / sendmmsg() */
+#define EVM_DGRAM_BATCH 32
+/* Max receive batches per fd readiness */
+#define EVM_DGRAM_BATCHES 4
+
+typedef struct dgrams_buf dgrams_buf_struct;
+typedef struct dgrams_pool dgrams_pool_struct;
+typedef struct dgrams_adapter dgrams_adapter_struct;
+
+/*Pooled receive buffer (returned by the message release hook)*/
+struct dgrams_buf {
+	dgrams_pool_struct *pool;
+	dgrams_buf_struct *next;
+	char data[EVM_DGRAM_SIZE + 1]; /*nul terminated*/
+}; /*dgrams_buf_struct*/
+
+/*Receive buffers pool (outlives its adapter while buffers in use)*/
+struct dgrams_pool {
+	pthread_mutex_t mutex;
+	int refs; /*adapter and buffers in use*/
+	dgrams_buf_struct *free;
+}; /*dgrams_pool_struct*/
+
+/*Datagram socket adapter*/
+struct dgrams_adapter {
+	int fd;
+	evm_msgtype_struct *msgtype;
+	evm_msgid_struct *msgid;
+	void *ctx;
+	dgrams_pool_struct *pool;
+	evm_message_struct **sends; /*queued outgoing messages*/
+	int sends_num;
+	int sends_size;
+	int out_watched; /*EPOLLOUT watched (send backlog)*/
+}; /*dgrams_adapter_struct*/
+
+/*Per consumer datagram adapters*/
+struct dgrams_set {
+	evmlist_head_struct *adapters_list;
+	int pending; /*adapters with queued outgoing messages*/
+}; /*dgrams_set_struct*/
+
+/*
+ * Flush queued outgoing messages with sendmmsg() (end of loop pass).
+ */
+EXTERN void dgrams_flush(evm_consumer_struct *consumer_ptr);
+
+/*
+ * Free consumer's datagram adapters (queued messages dropped).
+ */
+EXTERN void dgrams_consumer_free(evm_consumer_struct *consumer_ptr);
+
+#endif /*EVM_FILE_dgrams_h*/
@@ -37,6 +37,16 @@
 #include "evm.h"
 #include "messages.h"
 #include "timers.h"
+#include "groups.h"
+#include "shards.h"
+#include "filters.h"
+#include "paths.h"
+#include "fds.h"
+#include "io.h"
+#include "dgrams.h"
+#include "signals.h"
+#include "bridges.h"
+#include "pools.h"
 
 #define U2UP_LOG_NAME EVM_CORE
 #include <u2up-log/u2up-log.h>
@@ -48,6 +58,13 @@ unsigned int evmVerPatch = EVM_VERSION_PATCH;
 
 static int handle_timer(evm_consumer_struct *consumer, evm_timer_struct *expd_tmr);
 static int handle_message(evm_consumer_struct *consumer, evm_message_struct *rcvd_msg);
+static int msg_expired(evm_consumer_struct *consumer, evm_message_struct *msg);
+static int run_once(evm_consumer_struct *consumer, int blocking);
+static void clock_idle_enter(evm_consumer_struct *consumer);
+static void clock_idle_leave(evm_consumer_struct *consumer);
+static void clock_run_leave(evm_consumer_struct *consumer);
+static void clock_jump(evm_struct *evm, evm_consumer_struct *leaving);
+static void clock_wake(evm_struct *evm, int expired_only);
 
 /*
  * Public API function:
@@ -119,6 +136,54 @@ evmStruct * evm_init(void)
 			pthread_mutex_unlock(&evm->topics_list->access_mutex);
 		}
 	}
+	if (evm != NULL) {
+		if ((evm->groups_list = calloc(1, sizeof(evmlist_head_struct))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): evm->groups_list\n");
+			free(evm->topics_list);
+			evm->topics_list = NULL;
+			free(evm->consumers_list);
+			evm->consumers_list = NULL;
+			free(evm->tmrids_list);
+			evm->tmrids_list = NULL;
+			free(evm->msgtypes_list);
+			evm->msgtypes_list = NULL;
+			free(evm);
+			evm = NULL;
+		} else {
+			pthread_mutex_init(&evm->groups_list->access_mutex, NULL);
+			pthread_mutex_unlock(&evm->groups_list->access_mutex);
+		}
+	}
+	if (evm != NULL) {
+		if ((evm->routers_list = calloc(1, sizeof(evmlist_head_struct))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): evm->routers_list\n");
+			free(evm->groups_list);
+			evm->groups_list = NULL;
+			free(evm->topics_list);
+			evm->topics_list = NULL;
+			free(evm->consumers_list);
+			evm->consumers_list = NULL;
+			free(evm->tmrids_list);
+			evm->tmrids_list = NULL;
+			free(evm->msgtypes_list);
+			evm->msgtypes_list = NULL;
+			free(evm);
+			evm = NULL;
+		} else {
+			pthread_mutex_init(&evm->routers_list->access_mutex, NULL);
+			pthread_mutex_unlock(&evm->routers_list->access_mutex);
+		}
+	}
+	if (evm != NULL) {
+		pthread_mutex_init(&evm->clock_mutex, NULL);
+		pthread_mutex_unlock(&evm->clock_mutex);
+		evm->clock_virtual = 0;
+		pthread_rwlock_init(&evm->paths_rwlock, NULL);
+		pthread_mutex_init(&evm->decoders_mutex, NULL);
+		pthread_mutex_init(&evm->pools_mutex, NULL);
+	}
 	return evm;
 }
 
@@ -214,6 +279,8 @@ evmConsumerStruct * evm_consumer_add(evmStruct *evm, int id)
 					if (consumer != NULL) {
 						consumer->evm = evm;
 						consumer->id = id;
+						consumer->sched_tmrs_budget = EVM_SCHED_TMRS_BUDGET;
+						consumer->sched_msgs_budget = EVM_SCHED_MSGS_BUDGET;
 						if (sem_init(&consumer->blocking_sem, 0, 0) != 0) {
 							free(consumer);
 							consumer = NULL;
@@ -285,12 +352,28 @@ evmConsumerStruct * evm_consumer_del(evmStruct *evm, int id)
 
 	if (evm != NULL) {
 		if (evm->consumers_list != NULL) {
+			/*
+			 * Leave the virtual clock accounting (clock_mutex taken before the list's)
+			 * and the pool (waits for a worker running its handlers) first.
+			 */
+			if ((consumer = evm_consumer_get(evm, id)) != NULL) {
+				clock_run_leave(consumer);
+				pools_consumer_free(consumer);
+			}
+			consumer = NULL;
 			pthread_mutex_lock(&evm->consumers_list->access_mutex);
 			tmp = evm_search_evmlist(evm->consumers_list, id);
 			if ((tmp != NULL) && (tmp->id == id)) {
 				/* required id already exists - delete existing element */
 				consumer = (evm_consumer_struct *)tmp->el;
 				if (consumer != NULL) {
+					groups_consumer_free(consumer);
+					shards_consumer_free(consumer);
+					bridges_consumer_free(consumer);
+					signals_consumer_free(consumer);
+					dgrams_consumer_free(consumer);
+					io_consumer_free(consumer);
+					fds_consumer_free(consumer);
 					free(consumer);
 				}
 				tmp->prev->next = tmp->next;
@@ -392,6 +475,12 @@ evmTopicStruct * evm_topic_del(evmStruct *evm, int id)
 	evmlist_el_struct *tmp;
 	u2up_log_info("(entry)\n");
 
+	/* Remove its path first (paths lock taken before topics lock). */
+	if ((topic = evm_topic_get(evm, id)) != NULL) {
+		paths_topic_unbind(topic);
+		topic = NULL;
+	}
+
 	if (evm != NULL) {
 		if (evm->topics_list != NULL) {
 			pthread_mutex_lock(&evm->topics_list->access_mutex);
@@ -400,6 +489,8 @@ evmTopicStruct * evm_topic_del(evmStruct *evm, int id)
 				/* required id already exists - delete existing element */
 				topic = (evm_topic_struct *)tmp->el;
 				if (topic != NULL) {
+					filters_index_free(topic->filters);
+					free(topic->bridges);
 					free(topic);
 				}
 				tmp->prev->next = tmp->next;
@@ -415,87 +506,240 @@ evmTopicStruct * evm_topic_del(evmStruct *evm, int id)
 }
 
 /*
- * Internal consumer topic addition and removal funstions:
- * topic_consumer_add()
- * topic_consumer_del()
+ * Internal consumer (or group) topic addition and removal funstions:
+ * topic_subscription_find()
+ * topic_subscriber_add()
+ * topic_subscriber_del()
  */
 /*
- * Function: topic_consumer_add()
+ * Function: topic_subscription_find()
+ * Returns (topic's consumers_list locked):
+ * - NULL, if list is empty
+ * - element of consumer's (or group's) subscription, if already existing
+ * - last element, if not subscribed
+ */
+static evmlist_el_struct * topic_subscription_find(evm_topic_struct *topic, evm_consumer_struct *consumer, evm_group_struct *group)
+{
+	evmlist_el_struct *tmp;
+	evm_subscription_struct *sub;
+
+	tmp = topic->consumers_list->first;
+	while (tmp != NULL) {
+		sub = (evm_subscription_struct *)tmp->el;
+		if ((sub->consumer == consumer) && (sub->group == group))
+			break;
+		if (tmp->next == NULL)
+			break;
+		tmp = tmp->next;
+	}
+	return tmp;
+}
+
+static int topic_subscription_match(evmlist_el_struct *tmp, evm_consumer_struct *consumer, evm_group_struct *group)
+{
+	evm_subscription_struct *sub;
+
+	if (tmp == NULL)
+		return EVM_FALSE;
+
+	sub = (evm_subscription_struct *)tmp->el;
+	return ((sub->consumer == consumer) && (sub->group == group));
+}
+
+/*
+ * Function: topic_subscriber_add()
+ * Subscriber is either a consumer or a group (the other one NULL).
+ * Non-NULL filter replaces subscription's filter (also if already added).
+ * Path subscriber references the subscription, otherwise it is direct.
  * Returns:
- * - NULL, if:
- *   - any of parameters is NULL
- *   - topic's consumer unsuccessfully added
- * - Same consumer pointer provided as parameter, when:
- *   - topic's consumer successully added
- *   - topic's consumer already added
+ * - -1, if:
+ *   - topic is NULL
+ *   - topic's subscriber unsuccessfully added
+ * - 0, when:
+ *   - topic's subscriber successully added
+ *   - topic's subscriber already added
  *
  *   If really added, then per topic consumers_list size increments!
  */
-static evm_consumer_struct * topic_consumer_add(evm_topic_struct *topic, evm_consumer_struct *consumer)
+static int topic_subscriber_add(evm_topic_struct *topic, evm_consumer_struct *consumer, evm_group_struct *group, const evmFilterStruct *filter, int path)
 {
+	int rv = 0;
 	evmlist_el_struct *tmp, *new;
+	evm_subscription_struct *sub = NULL;
 	u2up_log_info("(entry)\n");
 
-	if ((topic != NULL) && (consumer != NULL)) {
-		if (topic->consumers_list != NULL) {
-			pthread_mutex_lock(&topic->consumers_list->access_mutex);
-			tmp = evm_check_evmlist(topic->consumers_list, (void *)consumer);
-			if ((tmp == NULL) || (tmp->el != (void *)consumer)) {
-				/* List is empty or element not yet present */
-				/* create new evmlist element with id */
-				if ((new = evm_new_evmlist_el(consumer->id)) != NULL) {
-					/* add supplied consumer */
-					new->el = (void *)consumer;
-					new->prev = tmp;
-					new->next = NULL;
-					if (tmp != NULL)
-						tmp->next = new;
-					else
-						topic->consumers_list->first = new;
-				} else
-					consumer = NULL;
+	if ((topic == NULL) || (topic->consumers_list == NULL))
+		return -1;
+
+	/* Posts are queued locally - never reaching remote consumers. */
+	if ((consumer != NULL) && (consumer->shm != NULL))
+		return -1;
+
+	pthread_mutex_lock(&topic->consumers_list->access_mutex);
+	tmp = topic_subscription_find(topic, consumer, group);
+	if (!topic_subscription_match(tmp, consumer, group)) {
+		/* List is empty or element not yet present */
+		/* create new evmlist element with id */
+		if ((new = evm_new_evmlist_el((consumer != NULL) ? consumer->id : group->id)) != NULL) {
+			/* add new subscription */
+			if ((sub = (evm_subscription_struct *)calloc(1, sizeof(evm_subscription_struct))) == NULL) {
+				errno = ENOMEM;
+				u2up_log_system_error("calloc(): subscription\n");
+				free(new);
+				new = NULL;
 			}
-			pthread_mutex_unlock(&topic->consumers_list->access_mutex);
 		}
-	} else
-		consumer = NULL;
+		if (new != NULL) {
+			sub->topic = topic;
+			sub->consumer = consumer;
+			sub->group = group;
+			sub->linked = EVM_TRUE;
+			sub->posts_base = topic->posts;
+			if (path)
+				sub->path_refs = 1;
+			else
+				sub->direct = EVM_TRUE;
+			if (filter != NULL)
+				sub->filter = *filter;
+			new->el = (void *)sub;
+			new->prev = tmp;
+			new->next = NULL;
+			if (tmp != NULL)
+				tmp->next = new;
+			else
+				topic->consumers_list->first = new;
+			topic->filters_dirty = EVM_TRUE;
+		} else
+			rv = -1;
+	} else {
+		/* Already subscribed. */
+		sub = (evm_subscription_struct *)tmp->el;
+		if (path)
+			sub->path_refs++;
+		else
+			sub->direct = EVM_TRUE;
+		if (filter != NULL) {
+			/* Replace the filter. */
+			sub->filter = *filter;
+			topic->filters_dirty = EVM_TRUE;
+		}
+	}
+	pthread_mutex_unlock(&topic->consumers_list->access_mutex);
 
-	return consumer;
+	return rv;
 }
 
 /*
- * Function: topic_consumer_del()
+ * Function: topic_subscriber_del()
+ * Subscriber is either a consumer or a group (the other one NULL).
+ * Path subscriber releases its reference, otherwise the direct one.
+ * Subscription removed, when neither referenced nor direct any more.
  * Returns:
- * - NULL, if;
- *   - any of parameters is NULL
- * - Same consumer pointer as provided in parameter, when:
- *   - topic's consumer successully removed
- *   - topic's consumer not found (already removed)
+ * - -1, if topic is NULL
+ * - 0, when:
+ *   - topic's subscriber successully removed
+ *   - topic's subscriber not found (already removed)
  */
-static evm_consumer_struct * topic_consumer_del(evm_topic_struct *topic, evm_consumer_struct *consumer)
+static int topic_subscriber_del(evm_topic_struct *topic, evm_consumer_struct *consumer, evm_group_struct *group, int path)
 {
 	evmlist_el_struct *tmp;
+	evm_subscription_struct *sub = NULL;
 	u2up_log_info("(entry)\n");
 
-	if ((topic != NULL) && (consumer != NULL)) {
-		if (topic->consumers_list != NULL) {
-			pthread_mutex_lock(&topic->consumers_list->access_mutex);
-			tmp = evm_check_evmlist(topic->consumers_list, (void *)consumer);
-			if ((tmp != NULL) && (tmp->el == (void *)consumer)) {
-				/* List is not empty and element present */
-				/* Delete evmlist element */
-				tmp->prev->next = tmp->next;
-				if (tmp->next != NULL)
-					tmp->next->prev = tmp->prev;
-				free(tmp);
-				tmp = NULL;
-			}
-			pthread_mutex_unlock(&topic->consumers_list->access_mutex);
-		}
-	} else
-		consumer = NULL;
+	if ((topic == NULL) || (topic->consumers_list == NULL))
+		return -1;
 
-	return consumer;
+	pthread_mutex_lock(&topic->consumers_list->access_mutex);
+	tmp = topic_subscription_find(topic, consumer, group);
+	if (topic_subscription_match(tmp, consumer, group)) {
+		/* List is not empty and element present */
+		sub = (evm_subscription_struct *)tmp->el;
+		if (path) {
+			if (sub->path_refs > 0)
+				sub->path_refs--;
+		} else
+			sub->direct = EVM_FALSE;
+	}
+	if ((sub != NULL) && ((sub->path_refs > 0) || sub->direct)) {
+		/* Still subscribed (directly or by another path pattern). */
+		sub = NULL;
+	} else if (sub != NULL) {
+		/* Delete evmlist element */
+		if (tmp->prev != NULL)
+			tmp->prev->next = tmp->next;
+		else
+			topic->consumers_list->first = tmp->next;
+		if (tmp->next != NULL)
+			tmp->next->prev = tmp->prev;
+		free(tmp);
+		tmp = NULL;
+		topic->filters_dirty = EVM_TRUE;
+	}
+	pthread_mutex_unlock(&topic->consumers_list->access_mutex);
+	/* Freed, when no more of its messages queued. */
+	if (sub != NULL)
+		messages_subscription_unlink(sub);
+
+	return 0;
+}
+
+/*
+ * Internally global topic subscription functions (path patterns, groups):
+ * - evm_topic_path_subscriber_add()
+ * - evm_topic_path_subscriber_del()
+ * - evm_topics_group_unsubscribe()
+ */
+int evm_topic_path_subscriber_add(evm_topic_struct *topic, evm_consumer_struct *consumer)
+{
+	return topic_subscriber_add(topic, consumer, NULL, NULL, EVM_TRUE);
+}
+
+int evm_topic_path_subscriber_del(evm_topic_struct *topic, evm_consumer_struct *consumer)
+{
+	return topic_subscriber_del(topic, consumer, NULL, EVM_TRUE);
+}
+
+void evm_topics_group_unsubscribe(evm_group_struct *group)
+{
+	evmlist_el_struct *tmp;
+	u2up_log_info("(entry) group=%p\n", group);
+
+	if ((group == NULL) || (group->evm->topics_list == NULL))
+		return;
+
+	/* Topics kept (not deleted) meanwhile - posts done with the group under each topic's lock. */
+	pthread_mutex_lock(&group->evm->topics_list->access_mutex);
+	for (tmp = group->evm->topics_list->first; tmp != NULL; tmp = tmp->next) {
+		if (tmp->el != NULL)
+			topic_subscriber_del((evm_topic_struct *)tmp->el, NULL, group, EVM_FALSE);
+	}
+	pthread_mutex_unlock(&group->evm->topics_list->access_mutex);
+}
+
+/*
+ * Function: topic_subscription_get()
+ * Returns (topic's consumers_list locked on success):
+ * - NULL, if consumer not subscribed to topic with topic_id
+ * - consumer's subscription
+ */
+static evm_subscription_struct * topic_subscription_get(evm_consumer_struct *consumer, int topic_id)
+{
+	evm_topic_struct *topic;
+	evmlist_el_struct *tmp;
+
+	if ((consumer == NULL) || (consumer->msgs_queue == NULL))
+		return NULL;
+
+	if ((topic = evm_topic_get(consumer->evm, topic_id)) == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&topic->consumers_list->access_mutex);
+	tmp = topic_subscription_find(topic, consumer, NULL);
+	if (topic_subscription_match(tmp, consumer, NULL))
+		return (evm_subscription_struct *)tmp->el;
+
+	pthread_mutex_unlock(&topic->consumers_list->access_mutex);
+	return NULL;
 }
 
 /*
@@ -528,7 +772,7 @@ evmTopicStruct * evm_topic_subscribe(evmConsumerStruct *consumer, int topic_id)
 	} else
 		topic = NULL;
 	if (topic != NULL) {
-		if ((consumer = topic_consumer_add(topic, consumer)) == NULL) {
+		if (topic_subscriber_add(topic, consumer, NULL, NULL, EVM_FALSE) != 0) {
 			topic = NULL;
 		}
 	}
@@ -563,7 +807,7 @@ evmTopicStruct * evm_topic_unsubscribe(evmConsumerStruct *consumer, int id)
 	} else
 		topic = NULL;
 	if (topic != NULL) {
-		topic_consumer_del(topic, consumer);
+		topic_subscriber_del(topic, consumer, NULL, EVM_FALSE);
 	}
 
 	pthread_mutex_unlock(&evm->topics_list->access_mutex);
@@ -571,6 +815,127 @@ evmTopicStruct * evm_topic_unsubscribe(evmConsumerStruct *consumer, int id)
 	return topic;
 }
 
+/*
+ * Public API function:
+ * - evm_topic_subscribe_filter()
+ */
+evmTopicStruct * evm_topic_subscribe_filter(evmConsumerStruct *consumer, int topic_id, const evmFilterStruct *filter)
+{
+	evmTopicStruct *topic;
+	evmFilterStruct none;
+	u2up_log_info("(entry)\n");
+
+	if (consumer == NULL)
+		return NULL;
+
+	if (filter == NULL) {
+		/* Empty filter matches all messages. */
+		memset(&none, 0, sizeof(none));
+		filter = &none;
+	} else if (filters_check(filter) != 0)
+		return NULL;
+
+	if ((topic = evm_topic_get(consumer->evm, topic_id)) == NULL)
+		return NULL;
+
+	if (topic_subscriber_add(topic, consumer, NULL, filter, EVM_FALSE) != 0)
+		return NULL;
+
+	return topic;
+}
+
+/*
+ * Public API functions:
+ * - evm_topic_lag_limit_set()
+ * - evm_topic_lag_stats_get()
+ */
+int evm_topic_lag_limit_set(evmConsumerStruct *consumer, int topic_id, int lag_limit, int lag_policy, int (*lagged)(evmConsumerStruct *consumer, evmTopicStruct *topic))
+{
+	evm_subscription_struct *sub;
+	u2up_log_info("(entry)\n");
+
+	if (lag_limit < 0)
+		return -1;
+
+	switch (lag_policy) {
+	case EVM_SUB_LAG_DROP:
+	case EVM_SUB_LAG_CONFLATE:
+	case EVM_SUB_LAG_UNSUBSCRIBE:
+		break;
+	default:
+		return -1;
+	}
+
+	if ((sub = topic_subscription_get(consumer, topic_id)) == NULL)
+		return -1;
+
+	pthread_mutex_lock(&consumer->msgs_queue->access_mutex);
+	sub->lag_limit = lag_limit;
+	sub->lag_policy = lag_policy;
+	sub->lagged = lagged;
+	pthread_mutex_unlock(&consumer->msgs_queue->access_mutex);
+	pthread_mutex_unlock(&sub->topic->consumers_list->access_mutex);
+	return 0;
+}
+
+int evm_topic_lag_stats_get(evmConsumerStruct *consumer, int topic_id, evmSubStatsStruct *stats)
+{
+	evm_subscription_struct *sub;
+	u2up_log_info("(entry)\n");
+
+	if (stats == NULL)
+		return -1;
+
+	if ((sub = topic_subscription_get(consumer, topic_id)) == NULL)
+		return -1;
+
+	pthread_mutex_lock(&consumer->msgs_queue->access_mutex);
+	*stats = sub->stats;
+	pthread_mutex_unlock(&consumer->msgs_queue->access_mutex);
+	/* Not matched since subscribed. */
+	stats->filtered = sub->topic->posts - sub->posts_base - sub->matched;
+	pthread_mutex_unlock(&sub->topic->consumers_list->access_mutex);
+	return 0;
+}
+
+/*
+ * Public API functions:
+ * - evm_group_subscribe()
+ * - evm_group_unsubscribe()
+ */
+evmTopicStruct * evm_group_subscribe(evmGroupStruct *group, int topic_id)
+{
+	evmTopicStruct *topic;
+	u2up_log_info("(entry)\n");
+
+	if (group == NULL)
+		return NULL;
+
+	if ((topic = evm_topic_get(group->evm, topic_id)) == NULL)
+		return NULL;
+
+	if (topic_subscriber_add(topic, NULL, group, NULL, EVM_FALSE) != 0)
+		return NULL;
+
+	return topic;
+}
+
+evmTopicStruct * evm_group_unsubscribe(evmGroupStruct *group, int topic_id)
+{
+	evmTopicStruct *topic;
+	u2up_log_info("(entry)\n");
+
+	if (group == NULL)
+		return NULL;
+
+	if ((topic = evm_topic_get(group->evm, topic_id)) == NULL)
+		return NULL;
+
+	topic_subscriber_del(topic, NULL, group, EVM_FALSE);
+
+	return topic;
+}
+
 /*
  * Public API functions:
  * - evm_priv_set()
@@ -604,6 +969,207 @@ void * evm_priv_get(evmStruct *evm)
 	return (evm->priv);
 }
 
+/*
+ * Public API functions:
+ * - evm_clock_virtual_set()
+ * - evm_clock_advance()
+ * - evm_clock_gettime()
+ */
+int evm_clock_virtual_set(evmStruct *evm, time_t tv_sec, long tv_nsec)
+{
+	u2up_log_info("(entry) evm=%p\n", evm);
+
+	if (evm == NULL)
+		return -1;
+
+	if ((tv_sec < 0) || (tv_nsec < 0) || (tv_nsec >= 1000000000L))
+		return -1;
+
+	pthread_mutex_lock(&evm->clock_mutex);
+	evm->clock_ts.tv_sec = tv_sec;
+	evm->clock_ts.tv_nsec = tv_nsec;
+	__atomic_store_n(&evm->clock_virtual, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&evm->clock_mutex);
+
+	return 0;
+}
+
+int evm_clock_advance(evmStruct *evm, time_t tv_sec, long tv_nsec)
+{
+	u2up_log_info("(entry) evm=%p, sec=%ld, nsec=%ld\n", evm, tv_sec, tv_nsec);
+
+	if (evm == NULL)
+		return -1;
+
+	if ((tv_sec < 0) || (tv_nsec < 0))
+		return -1;
+
+	pthread_mutex_lock(&evm->clock_mutex);
+	if (evm->clock_virtual == 0) {
+		pthread_mutex_unlock(&evm->clock_mutex);
+		return -1;
+	}
+	evm->clock_ts.tv_sec += tv_sec;
+	evm->clock_ts.tv_nsec += tv_nsec;
+	while (evm->clock_ts.tv_nsec >= 1000000000L) {
+		evm->clock_ts.tv_sec++;
+		evm->clock_ts.tv_nsec -= 1000000000L;
+	}
+	/* Let idle consumers re-check their timers. */
+	clock_wake(evm, 0);
+	pthread_mutex_unlock(&evm->clock_mutex);
+
+	return 0;
+}
+
+int evm_clock_gettime(evmStruct *evm, struct timespec *ts)
+{
+	if ((evm == NULL) || (ts == NULL))
+		return -1;
+
+	/* Switched under the clock_mutex, read on every timer check. */
+	if (__atomic_load_n(&evm->clock_virtual, __ATOMIC_ACQUIRE) == 0)
+		return clock_gettime(CLOCK_REALTIME, ts);
+
+	pthread_mutex_lock(&evm->clock_mutex);
+	*ts = evm->clock_ts;
+	pthread_mutex_unlock(&evm->clock_mutex);
+
+	return 0;
+}
+
+/*
+ * Virtual time idle accounting:
+ * When all consumers blocking in virtual time mode are idle (nothing left
+ * to process), the virtual clock jumps to the nearest timer expiration
+ * and consumers with expired timers get woken up.
+ * The evm->clock_mutex has to be locked by the caller of clock_wake().
+ */
+static void clock_wake(evm_struct *evm, int expired_only)
+{
+	evmlist_el_struct *tmp;
+	evm_consumer_struct *consumer;
+	struct timespec *ts;
+
+	pthread_mutex_lock(&evm->consumers_list->access_mutex);
+	for (tmp = evm->consumers_list->first; tmp != NULL; tmp = tmp->next) {
+		consumer = (evm_consumer_struct *)tmp->el;
+		if ((consumer == NULL) || (consumer->clock_waiting == 0))
+			continue;
+		if (expired_only) {
+			ts = timers_next_ts(consumer);
+			if ((ts == NULL) || (ts->tv_sec > evm->clock_ts.tv_sec))
+				continue;
+			if ((ts->tv_sec == evm->clock_ts.tv_sec) && (ts->tv_nsec > evm->clock_ts.tv_nsec))
+				continue;
+		}
+		/* Woken consumers are not idle any more (prevents another jump). */
+		consumer->clock_waiting = 0;
+		evm->clock_waiters--;
+		fds_wake(consumer);
+	}
+	pthread_mutex_unlock(&evm->consumers_list->access_mutex);
+}
+
+static void clock_idle_enter(evm_consumer_struct *consumer)
+{
+	evm_struct *evm = consumer->evm;
+
+	pthread_mutex_lock(&evm->clock_mutex);
+	if (consumer->clock_running == 0) {
+		consumer->clock_running = 1;
+		evm->clock_runners++;
+	}
+	consumer->clock_waiting = 1;
+	evm->clock_waiters++;
+	if (evm->clock_waiters >= evm->clock_runners)
+		clock_jump(evm, NULL);
+	pthread_mutex_unlock(&evm->clock_mutex);
+}
+
+/*
+ * All consumers idle - jump to the nearest timer expiration (the leaving
+ * consumer not accounted for). The evm->clock_mutex has to be locked by
+ * the caller of clock_jump().
+ */
+static void clock_jump(evm_struct *evm, evm_consumer_struct *leaving)
+{
+	evmlist_el_struct *tmp;
+	evm_consumer_struct *other;
+	struct timespec *ts, next;
+	int sval, found = 0;
+
+	pthread_mutex_lock(&evm->consumers_list->access_mutex);
+	for (tmp = evm->consumers_list->first; tmp != NULL; tmp = tmp->next) {
+		other = (evm_consumer_struct *)tmp->el;
+		if ((other == NULL) || (other == leaving))
+			continue;
+		/* Consumers with pending messages (or not yet woken) are busy. */
+		if ((sem_getvalue(&other->blocking_sem, &sval) == 0) && (sval > 0)) {
+			pthread_mutex_unlock(&evm->consumers_list->access_mutex);
+			return;
+		}
+		if (other->clock_running == 0)
+			continue;
+		if ((ts = timers_next_ts(other)) == NULL)
+			continue;
+		if (
+			(found == 0) ||
+			(ts->tv_sec < next.tv_sec) ||
+			((ts->tv_sec == next.tv_sec) && (ts->tv_nsec < next.tv_nsec))
+		) {
+			next = *ts;
+			found = 1;
+		}
+	}
+	pthread_mutex_unlock(&evm->consumers_list->access_mutex);
+
+	if (found) {
+		if (
+			(next.tv_sec > evm->clock_ts.tv_sec) ||
+			((next.tv_sec == evm->clock_ts.tv_sec) && (next.tv_nsec > evm->clock_ts.tv_nsec))
+		) {
+			u2up_log_debug("Virtual clock jump: sec=%ld, nsec=%ld\n", next.tv_sec, next.tv_nsec);
+			evm->clock_ts = next;
+		}
+		clock_wake(evm, 1);
+	}
+}
+
+static void clock_idle_leave(evm_consumer_struct *consumer)
+{
+	evm_struct *evm = consumer->evm;
+
+	pthread_mutex_lock(&evm->clock_mutex);
+	if (consumer->clock_waiting) {
+		consumer->clock_waiting = 0;
+		evm->clock_waiters--;
+	}
+	pthread_mutex_unlock(&evm->clock_mutex);
+}
+
+/*
+ * Deleted consumer does not take part in the idle accounting any more.
+ */
+static void clock_run_leave(evm_consumer_struct *consumer)
+{
+	evm_struct *evm = consumer->evm;
+
+	pthread_mutex_lock(&evm->clock_mutex);
+	if (consumer->clock_running) {
+		if (consumer->clock_waiting) {
+			consumer->clock_waiting = 0;
+			evm->clock_waiters--;
+		}
+		consumer->clock_running = 0;
+		evm->clock_runners--;
+		/* The others may have been waiting for this one only. */
+		if ((evm->clock_runners > 0) && (evm->clock_waiters >= evm->clock_runners))
+			clock_jump(evm, consumer);
+	}
+	pthread_mutex_unlock(&evm->clock_mutex);
+}
+
 /*
  * Public API functions:
  * - evm_run_once()
@@ -612,47 +1178,117 @@ void * evm_priv_get(evmStruct *evm)
  *
  * Main event machine single pass-through
  */
-int evm_run_once(evmConsumerStruct *consumer)
+static int run_once(evm_consumer_struct *consumer, int blocking)
 {
 	int rv = 0;
+	int tmrs_done = 0, msgs_done = 0, progress;
+	int tmrs_budget = consumer->sched_tmrs_budget;
+	int msgs_budget = consumer->sched_msgs_budget;
+	evmSchedStatsStruct *stats = &consumer->sched_stats;
 	evm_timer_struct *expd_tmr;
 	evm_message_struct *rcvd_msg;
 	struct timespec *ts;
 	u2up_log_info("(entry)\n");
 
-	if (consumer == NULL) {
-		u2up_log_error("Event machine consumer object undefined!\n");
-		abort();
-	}
-
-	/* Loop exclusively over expired timers (non-blocking already)! */
-	for (;;) {
-		u2up_log_info("(loop entry) check and handle all expired timers\n");
-		/* Handle expired timer (NON-BLOCKING). */
-		if ((expd_tmr = timers_check(consumer)) != NULL) {
-			if ((rv = handle_timer(consumer, expd_tmr)) < 0)
-				u2up_log_debug("handle_timer() returned %d\n", rv);
-		} else {
-			ts = timers_next_ts(consumer);
-			break;
+	/* Handle ready watched fds and reset event fd before messages checked (NON-BLOCKING). */
+	if (!blocking && (consumer->fds != NULL))
+		fds_wait(consumer, NULL, EVM_FALSE);
+
+	/* Interleave expired timers and queued messages within per pass budgets (NON-BLOCKING). */
+	do {
+		u2up_log_info("(loop entry) check and handle expired timers and queued messages\n");
+		progress = EVM_FALSE;
+		if ((tmrs_budget == 0) || (tmrs_done < tmrs_budget)) {
+			/* Handle expired timer (NON-BLOCKING). */
+			if ((expd_tmr = timers_check(consumer)) != NULL) {
+				if ((rv = handle_timer(consumer, expd_tmr)) < 0)
+					u2up_log_debug("handle_timer() returned %d\n", rv);
+				tmrs_done++;
+				progress = EVM_TRUE;
+			}
+		}
+		if (msgs_done < msgs_budget) {
+			/* Handle queued message (NON-BLOCKING). */
+			if ((rcvd_msg = messages_try(consumer)) != NULL) {
+				if ((rv = handle_message(consumer, rcvd_msg)) < 0)
+					u2up_log_debug("handle_message() returned %d\n", rv);
+				msgs_done++;
+				progress = EVM_TRUE;
+			}
+		}
+	} while (progress);
+
+	/* Submit I/O requested by handlers (i.e. sends) at once. */
+	if (consumer->io != NULL)
+		io_flush(consumer);
+	if (consumer->dgrams != NULL)
+		dgrams_flush(consumer);
+	if (consumer->bridges != NULL)
+		bridges_flush(consumer);
+
+	if (blocking && (tmrs_done == 0) && (msgs_done == 0)) {
+		ts = timers_next_ts(consumer);
+		/* Handle received message (WAIT - THE ONLY POTENTIALLY BLOCKING POINT). */
+		if (__atomic_load_n(&consumer->evm->clock_virtual, __ATOMIC_ACQUIRE)) {
+			/* Virtual time does not pass while waiting - wait without timeout. */
+			clock_idle_enter(consumer);
+			if (consumer->fds != NULL)
+				rcvd_msg = fds_wait(consumer, NULL, EVM_TRUE);
+			else
+				rcvd_msg = messages_check(consumer, NULL);
+			clock_idle_leave(consumer);
+		} else if (consumer->fds != NULL) {
+			/* Watched fds, queued messages and next timer expiration in one epoll_wait(). */
+			rcvd_msg = fds_wait(consumer, ts, EVM_TRUE);
+		} else
+			rcvd_msg = messages_check(consumer, ts);
+		if (rcvd_msg != NULL) {
+			if ((rv = handle_message(consumer, rcvd_msg)) < 0)
+				u2up_log_debug("handle_message() returned %d\n", rv);
+			msgs_done++;
 		}
 	}
 
-	/* Handle handle received message (WAIT - THE ONLY POTENTIALLY BLOCKING POINT). */
-	if ((rcvd_msg = messages_check(consumer, ts)) != NULL) {
-		if ((rv = handle_message(consumer, rcvd_msg)) < 0)
-			u2up_log_debug("handle_message() returned %d\n", rv);
+	/* Scheduling counters (work left behind due to exhausted budgets). */
+	stats->passes++;
+	stats->tmrs_handled += tmrs_done;
+	stats->msgs_handled += msgs_done;
+	if ((tmrs_budget != 0) && (tmrs_done >= tmrs_budget) && timers_pending(consumer))
+		stats->tmrs_starved++;
+	if ((msgs_done >= msgs_budget) && messages_pending(consumer)) {
+		stats->msgs_starved++;
+		/* Keep external event loop polling (event fd reset above). */
+		if (!blocking && (consumer->fds != NULL) && consumer->fds->external)
+			fds_signal(consumer);
 	}
 
 	return 0;
 }
 
+int evm_run_once(evmConsumerStruct *consumer)
+{
+	int rv;
+	evm_consumer_struct *running = evm_consumer_running;
+	u2up_log_info("(entry)\n");
+
+	if (consumer == NULL) {
+		u2up_log_error("Event machine consumer object undefined!\n");
+		abort();
+	}
+
+	evm_consumer_running = consumer;
+	rv = run_once(consumer, EVM_TRUE);
+	evm_consumer_running = running;
+	return rv;
+}
+
 /*
  * Main event machine single pass-through (asynchronous - nonblocking)
  */
 int evm_run_async(evmConsumerStruct *consumer)
 {
-	sem_t *bsem;
+	int rv;
+	evm_consumer_struct *running = evm_consumer_running;
 	u2up_log_info("(entry)\n");
 
 	if (consumer == NULL) {
@@ -660,10 +1296,10 @@ int evm_run_async(evmConsumerStruct *consumer)
 		abort();
 	}
 
-	bsem = &consumer->blocking_sem;
-	u2up_log_info("Post blocking semaphore (UNBLOCK - prevent blocking)\n");
-	sem_post(bsem);
-	return evm_run_once(consumer);
+	evm_consumer_running = consumer;
+	rv = run_once(consumer, EVM_FALSE);
+	evm_consumer_running = running;
+	return rv;
 }
 
 /*
@@ -719,6 +1355,54 @@ void * evm_consumer_priv_get(evmConsumerStruct *consumer)
 	return (consumer->priv);
 }
 
+/*
+ * Public API functions:
+ * - evm_consumer_sched_set()
+ * - evm_consumer_sched_stats_get()
+ */
+int evm_consumer_sched_set(evmConsumerStruct *consumer, int tmrs_budget, int msgs_budget)
+{
+	u2up_log_info("(entry) consumer=%p, tmrs_budget=%d, msgs_budget=%d\n", consumer, tmrs_budget, msgs_budget);
+
+	if (consumer == NULL)
+		return -1;
+
+	if ((tmrs_budget < 0) || (msgs_budget < 1))
+		return -1;
+
+	consumer->sched_tmrs_budget = tmrs_budget;
+	consumer->sched_msgs_budget = msgs_budget;
+	return 0;
+}
+
+int evm_consumer_sched_stats_get(evmConsumerStruct *consumer, evmSchedStatsStruct *stats)
+{
+	u2up_log_info("(entry)\n");
+
+	if ((consumer == NULL) || (stats == NULL))
+		return -1;
+
+	*stats = consumer->sched_stats;
+	return 0;
+}
+
+/*
+ * Returns true, if message deadline has already passed (evm clock).
+ */
+static int msg_expired(evm_consumer_struct *consumer, evm_message_struct *msg)
+{
+	struct timespec now;
+
+	if (!msg->deadline_set)
+		return EVM_FALSE;
+
+	evm_clock_gettime(consumer->evm, &now);
+	if (now.tv_sec != msg->deadline.tv_sec)
+		return (now.tv_sec > msg->deadline.tv_sec);
+
+	return (now.tv_nsec > msg->deadline.tv_nsec);
+}
+
 static int handle_message(evm_consumer_struct *consumer, evm_message_struct *msg)
 {
 	int rv = 0;
@@ -736,6 +1420,17 @@ static int handle_message(evm_consumer_struct *consumer, evm_message_struct *msg
 		u2up_log_debug("msgid == NULL\n");
 		return -1;
 	}
+	if (msg_expired(consumer, msg)) {
+		/* Stale message - do not run its regular handler. */
+		consumer->sched_stats.msgs_expired++;
+		if (msg->msgid->msg_expire != NULL) {
+			if ((rv = msg->msgid->msg_expire(consumer, msg)) < 0)
+				u2up_log_debug("msg_expire returned %d\n", rv);
+		} else
+			u2up_log_debug("message expired - dropped\n");
+		evm_message_delete(msg);
+		return rv;
+	}
 	if (msg->msgid->msg_handle == NULL) {
 		u2up_log_debug("msg_handle == NULL\n");
 		return -1;
@@ -62,6 +62,11 @@ typedef struct evm_consumer evm_consumer_struct;
 typedef struct evm_topic evm_topic_struct;
 typedef struct evm_message evm_message_struct;
 typedef struct evm_timer evm_timer_struct;
+typedef struct evm_subscription evm_subscription_struct;
+typedef struct evm_group evm_group_struct;
+typedef struct evm_router evm_router_struct;
+typedef struct evm_shm evm_shm_struct;
+typedef struct evm_bridge evm_bridge_struct;
 
 /*Structure returned by evm_init()!*/
 struct evm {
@@ -69,6 +74,20 @@ struct evm {
 	evmlist_head_struct *tmrids_list;
 	evmlist_head_struct *consumers_list;
 	evmlist_head_struct *topics_list;
+	evmlist_head_struct *groups_list;
+	evmlist_head_struct *routers_list;
+	pthread_mutex_t clock_mutex;
+	int clock_virtual; /*virtual (simulated) time mode*/
+	struct timespec clock_ts; /*current virtual time*/
+	int clock_runners; /*consumers blocking in virtual time mode*/
+	int clock_waiters; /*consumers idle in virtual time mode*/
+	pthread_mutex_t decoders_mutex;
+	struct decoders *decoders; /*decode stage*/
+	pthread_mutex_t pools_mutex;
+	struct pools *pools; /*worker pool (M:N consumer scheduling)*/
+	pthread_rwlock_t paths_rwlock;
+	struct paths_node *paths_topics; /*trie of topic paths*/
+	struct paths_node *paths_patterns; /*trie of path subscription patterns*/
 	void *priv; /*private - application specific data*/
 }; /*evm_struct*/
 
@@ -78,21 +97,118 @@ typedef struct msgs_queue msgs_queue_struct;
 struct tmrs_queue;
 typedef struct tmrs_queue tmrs_queue_struct;
 
+struct filters_index;
+typedef struct filters_index filters_index_struct;
+
+struct fds_set;
+typedef struct fds_set fds_set_struct;
+
+struct io_set;
+typedef struct io_set io_set_struct;
+
+struct dgrams_set;
+typedef struct dgrams_set dgrams_set_struct;
+
+struct decoders;
+typedef struct decoders decoders_struct;
+
+struct signals_set;
+typedef struct signals_set signals_set_struct;
+
+struct pools;
+typedef struct pools pools_struct;
+
 struct evm_consumer {
 	evm_struct *evm;
 	int id;
 	sem_t blocking_sem;
 	msgs_queue_struct *msgs_queue; /*internal messages queue*/
 	tmrs_queue_struct *tmrs_queue; /*internal timers queue*/
+	int sched_tmrs_budget; /*max expired timers handled per pass (0 - unlimited)*/
+	int sched_msgs_budget; /*max messages handled per pass*/
+	evmSchedStatsStruct sched_stats; /*scheduling counters*/
+	int clock_running; /*taking part in virtual time idle accounting*/
+	int clock_waiting; /*idle in virtual time mode*/
+	fds_set_struct *fds; /*file descriptor watchers (epoll blocking point)*/
+	io_set_struct *io; /*socket I/O engine (io_uring or epoll)*/
+	dgrams_set_struct *dgrams; /*datagram socket adapters*/
+	signals_set_struct *signals; /*signals handled (signalfd)*/
+	evm_shm_struct *shm; /*remote consumer - messages passed through shared memory*/
+	evm_bridge_struct *bridges; /*topic bridges served*/
+	int pooled; /*run by the worker pool*/
+	int pool_state; /*POOLS_... (worker pool)*/
+	int pool_deadline_set;
+	struct timespec pool_deadline; /*next timer expiration known to the pool*/
 	void *priv; /*private - consumer specific data*/
 }; /*evm_consumer_struct*/
 
 struct evm_topic {
 	evm_struct *evm;
 	int id;
-	evmlist_head_struct *consumers_list;
+	evmlist_head_struct *consumers_list; /*consumers' subscriptions*/
+	int conflate; /*keyed messages posted in last-value conflation mode*/
+	unsigned long posts; /*messages posted*/
+	filters_index_struct *filters; /*subscriptions' filters index*/
+	int filters_dirty; /*subscriptions changed since the index built*/
+	struct paths_node *path_node; /*topic path (topics trie node)*/
+	evm_bridge_struct **bridges; /*bridges with the topic subscribed by peers*/
+	int bridges_num;
 }; /*evm_topic_struct*/
 
+/*Consumer group (topic messages delivered to one of its members)*/
+struct evm_group {
+	evm_struct *evm;
+	int id;
+	pthread_mutex_t access_mutex;
+	int policy; /*member selection policy (EVM_GROUP_...)*/
+	evm_consumer_struct **members;
+	int members_num;
+	int members_size;
+	unsigned int rr_next; /*round-robin position*/
+	unsigned int seed; /*random choices*/
+}; /*evm_group_struct*/
+
+/*Sharded router (message key consistently hashed to a shard consumer)*/
+struct evm_shard {
+	evm_consumer_struct *consumer;
+	unsigned long routed; /*messages routed to this shard*/
+}; /*evm_shard_struct*/
+
+struct evm_ring_point {
+	unsigned long long point; /*position on the hash ring*/
+	int shard; /*index into shards*/
+}; /*evm_ring_point_struct*/
+
+struct evm_router {
+	evm_struct *evm;
+	int id;
+	pthread_mutex_t access_mutex;
+	struct evm_shard *shards;
+	int shards_num;
+	int shards_size;
+	struct evm_ring_point *ring; /*sorted virtual nodes of all shards*/
+	int ring_num;
+}; /*evm_router_struct*/
+
+/*Consumer's (or group's) topic subscription (lag fields protected by consumer's messages queue lock)*/
+struct evm_subscription {
+	evm_topic_struct *topic;
+	evm_consumer_struct *consumer;
+	evm_group_struct *group; /*group subscription (consumer is NULL)*/
+	int linked; /*in topic's list (or auto-unsubscribe being notified)*/
+	int direct; /*subscribed by id (not only by path patterns)*/
+	int path_refs; /*path patterns matching the topic*/
+	int lag_limit; /*max posted messages queued (0 - unlimited)*/
+	int lag_policy; /*lag limit policy (EVM_SUB_LAG_...)*/
+	int (*lagged)(evm_consumer_struct *consumer, evm_topic_struct *topic);
+	struct msg_hanger *last_hanger; /*last queued posted message*/
+	evmSubStatsStruct stats;
+	evmFilterStruct filter; /*content filter (empty - matches all)*/
+	unsigned long posts_base; /*topic's posts before subscribed*/
+	unsigned long matched; /*posted messages matching the filter*/
+	evm_subscription_struct *gone_next; /*auto-unsubscribed chain*/
+}; /*evm_subscription_struct*/
+
 /*
  * Messages
  */
@@ -100,6 +216,9 @@ struct evm_msgtype {
 	evm_struct *evm;
 	int id; /* 0, 1, 2, 3,... */
 	int (*msgtype_parse)(void *ptr);
+	int prio; /*default priority level of its messages*/
+	int route; /*route of its messages (EVM_ROUTE_...)*/
+	void *route_dest;
 	evmlist_head_struct *msgids_list;
 }; /*evm_msgtype_struct*/
 
@@ -108,6 +227,9 @@ struct evm_msgid {
 	evm_msgtype_struct *msgtype;
 	int id;
 	int (*msg_handle)(evm_consumer_struct *consumer, evm_message_struct *ptr);
+	int (*msg_expire)(evm_consumer_struct *consumer, evm_message_struct *ptr);
+	int route; /*route of its messages (overrides msgtype's one)*/
+	void *route_dest;
 }; /*evm_msgid_struct*/
 
 struct evm_message {
@@ -117,8 +239,19 @@ struct evm_message {
 	pthread_mutex_t amtx;
 	int consumers;
 	int saved;
+	int prio; /*priority level in consumers' queues*/
+	int deadline_set;
+	struct timespec deadline; /*handling deadline (evm clock)*/
+	int key_set;
+	unsigned long key; /*conflation key*/
+	int fields_set; /*mask of set fields*/
+	long long fields[EVM_MSG_FIELDS]; /*filtered header fields*/
 	void *ctx;
 	void *data;
+	size_t size; /*data size*/
+	evm_bridge_struct *bridge; /*received over (not forwarded back)*/
+	void (*release)(void *release_ctx); /*pooled data release hook (on delete)*/
+	void *release_ctx;
 }; /*evm_message_struct*/
 
 /*
@@ -168,4 +301,32 @@ EXTERN evmlist_el_struct * evm_check_evmlist(evmlist_head_struct *head, void *el
  */
 EXTERN evmlist_el_struct * evm_new_evmlist_el(int id);
 
+/*
+ * Internally global topic subscription functions (path patterns, groups):
+ */
+/*
+ * evm_topic_path_subscriber_add()
+ * - reference consumer's topic subscription (subscribe, if not yet)
+ * evm_topic_path_subscriber_del()
+ * - release consumer's topic subscription reference (unsubscribe, if
+ *   not referenced any more and not subscribed directly)
+ * Returns:
+ * - -1, if topic is NULL or subscription allocation fails
+ * - 0 on success
+ */
+EXTERN int evm_topic_path_subscriber_add(evm_topic_struct *topic, evm_consumer_struct *consumer);
+EXTERN int evm_topic_path_subscriber_del(evm_topic_struct *topic, evm_consumer_struct *consumer);
+
+/*
+ * evm_topics_group_unsubscribe()
+ * - unsubscribe group from all topics (before deleted)
+ */
+EXTERN void evm_topics_group_unsubscribe(evm_group_struct *group);
+
+/*
+ * Consumer being run (evm_run_once() or evm_run_async()) by the calling
+ * thread, if any - i.e. to prevent it from blocking on its own queue.
+ */
+EXTERN __thread evm_consumer_struct *evm_consumer_running;
+
 #endif /*EVM_FILE_evm_h*/
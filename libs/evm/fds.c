@@ -0,0 +1,411 @@
+/*
+ * The EVM fds module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_fds_c
+#define EVM_FILE_fds_c
+#else
+#error Preprocesor macro EVM_FILE_fds_c conflict!
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "evm/libevm.h"
+
+#include "evm.h"
+#include "messages.h"
+#include "fds.h"
+#include "pools.h"
+
+#define U2UP_LOG_NAME EVM_FDS
+#include <u2up-log/u2up-log.h>
+
+/* Max events handled per epoll_wait() */
+#define EVM_FDS_EVENTS 32
+
+static fds_set_struct * fds_init(evm_consumer_struct *consumer);
+static int fds_timeout(const struct timespec *ts);
+static void fds_dispatch(evm_consumer_struct *consumer, struct epoll_event *events, int num);
+
+static fds_set_struct * fds_init(evm_consumer_struct *consumer)
+{
+	fds_set_struct *fds;
+	struct epoll_event ev;
+	u2up_log_info("(entry)\n");
+
+	if ((fds = (fds_set_struct *)calloc(1, sizeof(fds_set_struct))) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("calloc(): fds\n");
+		return NULL;
+	}
+	if ((fds->watchers_list = calloc(1, sizeof(evmlist_head_struct))) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("calloc(): fds->watchers_list\n");
+		free(fds);
+		return NULL;
+	}
+	pthread_mutex_init(&fds->watchers_list->access_mutex, NULL);
+	pthread_mutex_unlock(&fds->watchers_list->access_mutex);
+
+	if ((fds->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		u2up_log_system_error("epoll_create1()\n");
+		free(fds->watchers_list);
+		free(fds);
+		return NULL;
+	}
+	if ((fds->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		u2up_log_system_error("eventfd()\n");
+		close(fds->epoll_fd);
+		free(fds->watchers_list);
+		free(fds);
+		return NULL;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL; /*event fd*/
+	if (epoll_ctl(fds->epoll_fd, EPOLL_CTL_ADD, fds->event_fd, &ev) < 0) {
+		u2up_log_system_error("epoll_ctl(): event fd\n");
+		close(fds->event_fd);
+		close(fds->epoll_fd);
+		free(fds->watchers_list);
+		free(fds);
+		return NULL;
+	}
+
+	/* Published to producers (see fds_wake()). */
+	__atomic_store_n(&consumer->fds, fds, __ATOMIC_RELEASE);
+	return fds;
+}
+
+void fds_signal(evm_consumer_struct *consumer)
+{
+	fds_set_struct *fds = consumer->fds;
+	uint64_t one = 1;
+
+	if (__atomic_exchange_n(&fds->signalled, EVM_TRUE, __ATOMIC_SEQ_CST))
+		return;
+
+	if (write(fds->event_fd, &one, sizeof(one)) < 0) {
+		if (errno != EAGAIN)
+			u2up_log_system_error("write(): event fd\n");
+	}
+}
+
+void fds_wake(evm_consumer_struct *consumer)
+{
+	fds_set_struct *fds;
+
+	sem_post(&consumer->blocking_sem);
+	if (__atomic_load_n(&consumer->pooled, __ATOMIC_ACQUIRE))
+		pools_schedule(consumer);
+
+	/* Pairs with "sleeping" set before messages checked in fds_wait(). */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if ((fds = __atomic_load_n(&consumer->fds, __ATOMIC_ACQUIRE)) == NULL)
+		return;
+
+	if (__atomic_load_n(&fds->sleeping, __ATOMIC_RELAXED) || __atomic_load_n(&fds->external, __ATOMIC_RELAXED))
+		fds_signal(consumer);
+}
+
+/*
+ * Milliseconds (rounded up) until the absolute time ts, -1 without it.
+ */
+static int fds_timeout(const struct timespec *ts)
+{
+	struct timespec now;
+	long long ms;
+
+	if (ts == NULL)
+		return -1;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	ms = (ts->tv_sec - now.tv_sec) * 1000LL + (ts->tv_nsec - now.tv_nsec + 999999) / 1000000;
+	if (ms < 0)
+		return 0;
+	if (ms > 0x7fffffff)
+		return 0x7fffffff;
+	return (int)ms;
+}
+
+static void fds_dispatch(evm_consumer_struct *consumer, struct epoll_event *events, int num)
+{
+	int i;
+	uint64_t value;
+	fds_set_struct *fds = consumer->fds;
+	fds_watcher_struct *watcher;
+
+	fds->dispatching = EVM_TRUE;
+	for (i = 0; i < num; i++) {
+		if ((watcher = (fds_watcher_struct *)events[i].data.ptr) == NULL) {
+			/*
+			 * Event fd - just reset (messages checked by the caller
+			 * afterwards). Re-armed only after reset, or a signal landing
+			 * in between would be consumed with "signalled" left set.
+			 */
+			if (read(fds->event_fd, &value, sizeof(value)) < 0) {
+				if (errno != EAGAIN)
+					u2up_log_system_error("read(): event fd\n");
+			}
+			__atomic_store_n(&fds->signalled, EVM_FALSE, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		if (watcher->deleted)
+			continue;
+		if (watcher->fd_handle(consumer, watcher->fd, events[i].events, watcher->ctx) < 0)
+			u2up_log_debug("fd_handle() failed (fd=%d)\n", watcher->fd);
+	}
+	fds->dispatching = EVM_FALSE;
+
+	while ((watcher = fds->gone) != NULL) {
+		fds->gone = watcher->gone_next;
+		free(watcher);
+	}
+}
+
+evm_message_struct * fds_wait(evm_consumer_struct *consumer, const struct timespec *ts, int blocking)
+{
+	int num, timeout = 0;
+	fds_set_struct *fds = consumer->fds;
+	evm_message_struct *msg;
+	struct epoll_event events[EVM_FDS_EVENTS];
+	u2up_log_info("(entry)\n");
+
+	if (blocking) {
+		timeout = fds_timeout(ts);
+		/* Dekker: announce sleeping before checking messages (see fds_wake()). */
+		__atomic_store_n(&fds->sleeping, EVM_TRUE, __ATOMIC_SEQ_CST);
+		if ((msg = messages_try(consumer)) != NULL) {
+			__atomic_store_n(&fds->sleeping, EVM_FALSE, __ATOMIC_RELAXED);
+			return msg;
+		}
+	}
+
+	u2up_log_info("Wait for watched fds, messages (event fd) until timeout\n");
+	while ((num = epoll_wait(fds->epoll_fd, events, EVM_FDS_EVENTS, timeout)) < 0) {
+		if (errno != EINTR) {
+			u2up_log_system_error("epoll_wait()\n");
+			break;
+		}
+		/* Restart if interrupted by signal (timeout not adjusted). */
+	}
+	__atomic_store_n(&fds->sleeping, EVM_FALSE, __ATOMIC_RELAXED);
+
+	if (num > 0)
+		fds_dispatch(consumer, events, num);
+
+	if (blocking)
+		return messages_try(consumer);
+
+	return NULL;
+}
+
+void fds_consumer_free(evm_consumer_struct *consumer)
+{
+	fds_set_struct *fds = consumer->fds;
+	evmlist_el_struct *tmp, *next;
+	u2up_log_info("(entry)\n");
+
+	if (fds == NULL)
+		return;
+
+	for (tmp = fds->watchers_list->first; tmp != NULL; tmp = next) {
+		next = tmp->next;
+		free(tmp->el);
+		free(tmp);
+	}
+	free(fds->watchers_list);
+	close(fds->event_fd);
+	close(fds->epoll_fd);
+	free(fds);
+	consumer->fds = NULL;
+}
+
+/*
+ * Public API functions:
+ * - evm_consumer_fd_get()
+ */
+int evm_consumer_fd_get(evmConsumerStruct *consumer)
+{
+	fds_set_struct *fds;
+	int sval;
+	u2up_log_info("(entry)\n");
+
+	if (consumer == NULL)
+		return -1;
+
+	if ((fds = consumer->fds) == NULL) {
+		if ((fds = fds_init(consumer)) == NULL)
+			return -1;
+	}
+
+	if (!fds->external) {
+		__atomic_store_n(&fds->external, EVM_TRUE, __ATOMIC_SEQ_CST);
+		/* Messages queued before. */
+		if ((sem_getvalue(&consumer->blocking_sem, &sval) == 0) && (sval > 0))
+			fds_signal(consumer);
+	}
+
+	return fds->epoll_fd;
+}
+
+/*
+ * Public API functions:
+ * - evm_fd_add()
+ * - evm_fd_mod()
+ * - evm_fd_del()
+ */
+int evm_fd_add(evmConsumerStruct *consumer, int fd, unsigned int events, int (*fd_handle)(evmConsumerStruct *consumer, int fd, unsigned int revents, void *ctx), void *ctx)
+{
+	int rv = 0;
+	fds_set_struct *fds;
+	fds_watcher_struct *watcher = NULL;
+	evmlist_el_struct *tmp, *new;
+	struct epoll_event ev;
+	u2up_log_info("(entry) fd=%d\n", fd);
+
+	if ((consumer == NULL) || (fd < 0) || (fd_handle == NULL))
+		return -1;
+
+	if ((fds = consumer->fds) == NULL) {
+		if ((fds = fds_init(consumer)) == NULL)
+			return -1;
+	}
+
+	pthread_mutex_lock(&fds->watchers_list->access_mutex);
+	tmp = evm_search_evmlist(fds->watchers_list, fd);
+	if ((tmp != NULL) && (tmp->id == fd)) {
+		/* fd already watched */
+		errno = EEXIST;
+		rv = -1;
+	} else if ((new = evm_new_evmlist_el(fd)) == NULL) {
+		rv = -1;
+	} else if ((watcher = (fds_watcher_struct *)calloc(1, sizeof(fds_watcher_struct))) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("calloc(): fd watcher\n");
+		free(new);
+		rv = -1;
+	} else {
+		watcher->fd = fd;
+		watcher->events = events;
+		watcher->fd_handle = fd_handle;
+		watcher->ctx = ctx;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.ptr = watcher;
+		if (epoll_ctl(fds->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			u2up_log_system_error("epoll_ctl(): fd=%d\n", fd);
+			free(watcher);
+			free(new);
+			rv = -1;
+		} else {
+			new->el = (void *)watcher;
+			new->prev = tmp;
+			new->next = NULL;
+			if (tmp != NULL)
+				tmp->next = new;
+			else
+				fds->watchers_list->first = new;
+		}
+	}
+	pthread_mutex_unlock(&fds->watchers_list->access_mutex);
+
+	return rv;
+}
+
+int evm_fd_mod(evmConsumerStruct *consumer, int fd, unsigned int events)
+{
+	int rv = -1;
+	fds_set_struct *fds;
+	fds_watcher_struct *watcher;
+	evmlist_el_struct *tmp;
+	struct epoll_event ev;
+	u2up_log_info("(entry) fd=%d\n", fd);
+
+	if ((consumer == NULL) || ((fds = consumer->fds) == NULL))
+		return -1;
+
+	pthread_mutex_lock(&fds->watchers_list->access_mutex);
+	tmp = evm_search_evmlist(fds->watchers_list, fd);
+	if ((tmp != NULL) && (tmp->id == fd)) {
+		watcher = (fds_watcher_struct *)tmp->el;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.ptr = watcher;
+		if (epoll_ctl(fds->epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+			u2up_log_system_error("epoll_ctl(): fd=%d\n", fd);
+		} else {
+			watcher->events = events;
+			rv = 0;
+		}
+	}
+	pthread_mutex_unlock(&fds->watchers_list->access_mutex);
+
+	return rv;
+}
+
+int evm_fd_del(evmConsumerStruct *consumer, int fd)
+{
+	int rv = -1;
+	fds_set_struct *fds;
+	fds_watcher_struct *watcher;
+	evmlist_el_struct *tmp;
+	u2up_log_info("(entry) fd=%d\n", fd);
+
+	if ((consumer == NULL) || ((fds = consumer->fds) == NULL))
+		return -1;
+
+	pthread_mutex_lock(&fds->watchers_list->access_mutex);
+	tmp = evm_search_evmlist(fds->watchers_list, fd);
+	if ((tmp != NULL) && (tmp->id == fd)) {
+		watcher = (fds_watcher_struct *)tmp->el;
+		/* Already closed fds are removed from epoll set automatically. */
+		if ((epoll_ctl(fds->epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0) && (errno != EBADF))
+			u2up_log_system_error("epoll_ctl(): fd=%d\n", fd);
+		if (tmp->prev != NULL)
+			tmp->prev->next = tmp->next;
+		else
+			fds->watchers_list->first = tmp->next;
+		if (tmp->next != NULL)
+			tmp->next->prev = tmp->prev;
+		free(tmp);
+		if (fds->dispatching) {
+			/* Its events may still be pending in this dispatch. */
+			watcher->deleted = EVM_TRUE;
+			watcher->gone_next = fds->gone;
+			fds->gone = watcher;
+		} else
+			free(watcher);
+		rv = 0;
+	}
+	pthread_mutex_unlock(&fds->watchers_list->access_mutex);
+
+	return rv;
+}
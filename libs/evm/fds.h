@@ -0,0 +1,85 @@
+/*
+ * The EVM fds module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_fds_h
+#define EVM_FILE_fds_h
+
+#ifdef EVM_FILE_fds_c
+/* PRIVATE usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN
+#else
+/* PUBLIC usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN extern
+#endif
+
+typedef struct fds_watcher fds_watcher_struct;
+
+struct fds_watcher {
+	int fd;
+	unsigned int events; /*EPOLL... events watched*/
+	int (*fd_handle)(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx);
+	void *ctx;
+	int deleted; /*deleted while dispatching its events*/
+	fds_watcher_struct *gone_next; /*deleted while dispatching chain*/
+}; /*fds_watcher_struct*/
+
+/*Per consumer file descriptor watchers (consumer's blocking point)*/
+struct fds_set {
+	int epoll_fd;
+	int event_fd; /*wakes epoll_wait() on queued messages*/
+	int sleeping; /*consumer (about to be) blocked in epoll_wait()*/
+	int external; /*epoll fd polled by an external event loop*/
+	int signalled; /*event fd written (not yet reset)*/
+	int dispatching; /*consumer dispatching watchers' events*/
+	evmlist_head_struct *watchers_list;
+	fds_watcher_struct *gone; /*watchers freed after dispatching*/
+}; /*fds_set_struct*/
+
+/*
+ * Wake up the consumer blocked for messages (message queued): Post its
+ * blocking semaphore and signal its event fd, if blocked in epoll_wait()
+ * or polled by an external event loop.
+ */
+EXTERN void fds_wake(evm_consumer_struct *consumer_ptr);
+
+/*
+ * Signal consumer's event fd (unless already signalled).
+ */
+EXTERN void fds_signal(evm_consumer_struct *consumer_ptr);
+
+/*
+ * Wait for watched fds, messages and timers (ts - the next timer
+ * expiration, NULL - none) - if blocking, or just poll watched fds.
+ * Ready fds' handlers called.
+ * Return:
+ * - the first queued message (blocking only)
+ * - NULL, if none queued
+ */
+EXTERN evm_message_struct * fds_wait(evm_consumer_struct *consumer_ptr, const struct timespec *ts, int blocking);
+
+/*
+ * Free consumer's watchers and close its epoll and event fds.
+ */
+EXTERN void fds_consumer_free(evm_consumer_struct *consumer_ptr);
+
+#endif /*EVM_FILE_fds_h*/
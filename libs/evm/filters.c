@@ -0,0 +1,333 @@
+/*
+ * The EVM filters module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_filters_c
+#define EVM_FILE_filters_c
+#else
+#error Preprocesor macro EVM_FILE_filters_c conflict!
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <semaphore.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "evm/libevm.h"
+
+#include "evm.h"
+#include "filters.h"
+
+#define U2UP_LOG_NAME EVM_FLTR
+#include <u2up-log/u2up-log.h>
+
+static int filter_realloc(void **ptr, size_t size);
+static int filter_msgids_match(const evmFilterStruct *filter, evm_message_struct *msg);
+static void filter_range_scalar(const long long *min, const long long *max, int words, long long value, unsigned long long *bits);
+#if defined(__x86_64__) || defined(__i386__)
+static void filter_range_sse42(const long long *min, const long long *max, int words, long long value, unsigned long long *bits);
+static void filter_range_avx2(const long long *min, const long long *max, int words, long long value, unsigned long long *bits);
+#endif
+static void filter_kernel_select(void);
+
+/* Range kernel (selected at runtime according to CPU features) */
+static void (*filter_range)(const long long *min, const long long *max, int words, long long value, unsigned long long *bits);
+static pthread_once_t filter_kernel_once = PTHREAD_ONCE_INIT;
+
+int filters_check(const evmFilterStruct *filter)
+{
+	int i;
+	u2up_log_info("(entry)\n");
+
+	if (filter == NULL)
+		return -1;
+
+	if ((filter->msgids_num < 0) || (filter->msgids_num > EVM_FILTER_MSGIDS))
+		return -1;
+
+	if ((filter->ranges_num < 0) || (filter->ranges_num > EVM_FILTER_RANGES))
+		return -1;
+
+	for (i = 0; i < filter->ranges_num; i++) {
+		if ((filter->ranges[i].field < 0) || (filter->ranges[i].field >= EVM_MSG_FIELDS))
+			return -1;
+		if (filter->ranges[i].min > filter->ranges[i].max)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Range kernels: Clear bits of rows (64 per bitmap word), whose range
+ * [min, max] does not include the value. Words already cleared skipped.
+ */
+static void filter_range_scalar(const long long *min, const long long *max, int words, long long value, unsigned long long *bits)
+{
+	int w, i, row;
+	unsigned long long fail;
+
+	for (w = 0; w < words; w++) {
+		if (bits[w] == 0)
+			continue;
+		fail = 0;
+		for (i = 0; i < 64; i++) {
+			row = (w << 6) + i;
+			if ((min[row] > value) || (value > max[row]))
+				fail |= (1ULL << i);
+		}
+		bits[w] &= ~fail;
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2")))
+static void filter_range_sse42(const long long *min, const long long *max, int words, long long value, unsigned long long *bits)
+{
+	int w, i;
+	unsigned long long fail;
+	__m128i v = _mm_set1_epi64x(value);
+	__m128i lo, hi;
+
+	for (w = 0; w < words; w++) {
+		if (bits[w] == 0)
+			continue;
+		fail = 0;
+		for (i = 0; i < 64; i += 2) {
+			lo = _mm_loadu_si128((const __m128i *)&min[(w << 6) + i]);
+			hi = _mm_loadu_si128((const __m128i *)&max[(w << 6) + i]);
+			lo = _mm_or_si128(_mm_cmpgt_epi64(lo, v), _mm_cmpgt_epi64(v, hi));
+			fail |= (unsigned long long)_mm_movemask_pd(_mm_castsi128_pd(lo)) << i;
+		}
+		bits[w] &= ~fail;
+	}
+}
+
+__attribute__((target("avx2")))
+static void filter_range_avx2(const long long *min, const long long *max, int words, long long value, unsigned long long *bits)
+{
+	int w, i;
+	unsigned long long fail;
+	__m256i v = _mm256_set1_epi64x(value);
+	__m256i lo, hi;
+
+	for (w = 0; w < words; w++) {
+		if (bits[w] == 0)
+			continue;
+		fail = 0;
+		for (i = 0; i < 64; i += 4) {
+			lo = _mm256_loadu_si256((const __m256i *)&min[(w << 6) + i]);
+			hi = _mm256_loadu_si256((const __m256i *)&max[(w << 6) + i]);
+			lo = _mm256_or_si256(_mm256_cmpgt_epi64(lo, v), _mm256_cmpgt_epi64(v, hi));
+			fail |= (unsigned long long)_mm256_movemask_pd(_mm256_castsi256_pd(lo)) << i;
+		}
+		bits[w] &= ~fail;
+	}
+}
+#endif
+
+static void filter_kernel_select(void)
+{
+	filter_range = filter_range_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		filter_range = filter_range_avx2;
+	else if (__builtin_cpu_supports("sse4.2"))
+		filter_range = filter_range_sse42;
+#endif
+}
+
+static int filter_realloc(void **ptr, size_t size)
+{
+	void *new;
+
+	if ((new = realloc(*ptr, size)) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("realloc(): filters index\n");
+		return -1;
+	}
+	*ptr = new;
+	return 0;
+}
+
+static int filter_msgids_match(const evmFilterStruct *filter, evm_message_struct *msg)
+{
+	int i;
+
+	if (msg->msgid == NULL)
+		return EVM_FALSE;
+
+	for (i = 0; i < filter->msgids_num; i++) {
+		if (filter->msgids[i] == msg->msgid->id)
+			return EVM_TRUE;
+	}
+	return EVM_FALSE;
+}
+
+int filters_index_build(evm_topic_struct *topic)
+{
+	int i, f, row, rows_num = 0, words, size;
+	filters_index_struct *index;
+	evmlist_el_struct *tmp;
+	evm_subscription_struct *sub;
+	const struct evm_filter_range *range;
+	u2up_log_info("(entry)\n");
+
+	pthread_once(&filter_kernel_once, filter_kernel_select);
+
+	if ((index = topic->filters) == NULL) {
+		if ((index = (filters_index_struct *)calloc(1, sizeof(filters_index_struct))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): filters index\n");
+			return -1;
+		}
+		topic->filters = index;
+	}
+
+	for (tmp = topic->consumers_list->first; tmp != NULL; tmp = tmp->next)
+		rows_num++;
+	if ((words = (rows_num + 63) >> 6) == 0)
+		words = 1;
+	size = words << 6;
+
+	if (size > index->rows_size) {
+		/* Grow all columns (rows_size updated, when all grown). */
+		if (filter_realloc((void **)&index->rows, size * sizeof(evmlist_el_struct *)) != 0)
+			return -1;
+		for (f = 0; f < EVM_MSG_FIELDS; f++) {
+			if (filter_realloc((void **)&index->min[f], size * sizeof(long long)) != 0)
+				return -1;
+			if (filter_realloc((void **)&index->max[f], size * sizeof(long long)) != 0)
+				return -1;
+			if (filter_realloc((void **)&index->ranged[f], words * sizeof(unsigned long long)) != 0)
+				return -1;
+		}
+		if (filter_realloc((void **)&index->msgids, words * sizeof(unsigned long long)) != 0)
+			return -1;
+		if (filter_realloc((void **)&index->valid, words * sizeof(unsigned long long)) != 0)
+			return -1;
+		if (filter_realloc((void **)&index->bits, words * sizeof(unsigned long long)) != 0)
+			return -1;
+		index->rows_size = size;
+	}
+
+	for (f = 0; f < EVM_MSG_FIELDS; f++) {
+		index->ranged_num[f] = 0;
+		memset(index->ranged[f], 0, words * sizeof(unsigned long long));
+		for (row = 0; row < size; row++) {
+			index->min[f][row] = LLONG_MIN;
+			index->max[f][row] = LLONG_MAX;
+		}
+	}
+	index->msgids_num = 0;
+	memset(index->msgids, 0, words * sizeof(unsigned long long));
+	memset(index->valid, 0, words * sizeof(unsigned long long));
+
+	for (row = 0, tmp = topic->consumers_list->first; tmp != NULL; row++, tmp = tmp->next) {
+		sub = (evm_subscription_struct *)tmp->el;
+		index->rows[row] = tmp;
+		index->valid[row >> 6] |= (1ULL << (row & 63));
+		if (sub->filter.msgids_num > 0) {
+			index->msgids[row >> 6] |= (1ULL << (row & 63));
+			index->msgids_num++;
+		}
+		for (i = 0; i < sub->filter.ranges_num; i++) {
+			/* Ranges on the same field intersect. */
+			range = &sub->filter.ranges[i];
+			f = range->field;
+			if (range->min > index->min[f][row])
+				index->min[f][row] = range->min;
+			if (range->max < index->max[f][row])
+				index->max[f][row] = range->max;
+			if (!(index->ranged[f][row >> 6] & (1ULL << (row & 63)))) {
+				index->ranged[f][row >> 6] |= (1ULL << (row & 63));
+				index->ranged_num[f]++;
+			}
+		}
+	}
+	index->rows_num = rows_num;
+	index->words = words;
+	topic->filters_dirty = EVM_FALSE;
+
+	return 0;
+}
+
+unsigned long long * filters_index_match(filters_index_struct *index, evm_message_struct *msg)
+{
+	int w, f, row;
+	unsigned long long *bits = index->bits;
+	unsigned long long check;
+	evm_subscription_struct *sub;
+
+	memcpy(bits, index->valid, index->words * sizeof(unsigned long long));
+
+	if (index->msgids_num > 0) {
+		for (w = 0; w < index->words; w++) {
+			check = index->msgids[w];
+			while (check != 0) {
+				row = (w << 6) + __builtin_ctzll(check);
+				check &= check - 1;
+				sub = (evm_subscription_struct *)index->rows[row]->el;
+				if (!filter_msgids_match(&sub->filter, msg))
+					bits[w] &= ~(1ULL << (row & 63));
+			}
+		}
+	}
+
+	for (f = 0; f < EVM_MSG_FIELDS; f++) {
+		if (index->ranged_num[f] == 0)
+			continue;
+		if (!(msg->fields_set & (1 << f))) {
+			/* Unset message field never matches a range. */
+			for (w = 0; w < index->words; w++)
+				bits[w] &= ~index->ranged[f][w];
+		} else
+			filter_range(index->min[f], index->max[f], index->words, msg->fields[f], bits);
+	}
+
+	return bits;
+}
+
+void filters_index_free(filters_index_struct *index)
+{
+	int f;
+	u2up_log_info("(entry)\n");
+
+	if (index == NULL)
+		return;
+
+	for (f = 0; f < EVM_MSG_FIELDS; f++) {
+		free(index->min[f]);
+		free(index->max[f]);
+		free(index->ranged[f]);
+	}
+	free(index->rows);
+	free(index->msgids);
+	free(index->valid);
+	free(index->bits);
+	free(index);
+}
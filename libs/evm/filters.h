@@ -0,0 +1,82 @@
+/*
+ * The EVM filters module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_filters_h
+#define EVM_FILE_filters_h
+
+#ifdef EVM_FILE_filters_c
+/* PRIVATE usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN
+#else
+/* PUBLIC usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN extern
+#endif
+
+/*
+ * Validate subscription filter.
+ * Return:
+ * - 0, if filter valid
+ * - -1, if invalid number of msgids or ranges or invalid range
+ */
+EXTERN int filters_check(const evmFilterStruct *filter);
+
+/*
+ * Columnar index of topic's subscription filters (row per subscription in
+ * topic's consumers_list order), rebuilt when topic's filters are dirty.
+ */
+struct filters_index {
+	int rows_num; /*subscriptions indexed*/
+	int rows_size; /*allocated rows (multiple of 64)*/
+	int words; /*used bitmap words*/
+	evmlist_el_struct **rows; /*row -> topic's consumers_list element*/
+	long long *min[EVM_MSG_FIELDS]; /*range columns (LLONG_MIN .. LLONG_MAX - no range)*/
+	long long *max[EVM_MSG_FIELDS];
+	int ranged_num[EVM_MSG_FIELDS]; /*rows with range on field*/
+	unsigned long long *ranged[EVM_MSG_FIELDS]; /*bitmap of rows with range on field*/
+	int msgids_num; /*rows with msgids set*/
+	unsigned long long *msgids; /*bitmap of rows with msgids set*/
+	unsigned long long *valid; /*bitmap of indexed rows*/
+	unsigned long long *bits; /*bitmap of rows matching the last message*/
+}; /*filters_index_struct*/
+
+/*
+ * Rebuild topic's filters index (topic's consumers_list locked).
+ * Return:
+ * - 0, if index rebuilt (topic's filters not dirty any more)
+ * - -1, if index allocation fails
+ */
+EXTERN int filters_index_build(evm_topic_struct *topic);
+
+/*
+ * Evaluate indexed filters against the message (before enqueuing).
+ * Return:
+ * - bitmap of matching rows (valid until the next evaluation)
+ */
+EXTERN unsigned long long * filters_index_match(filters_index_struct *index, evm_message_struct *msg);
+
+/*
+ * Free topic's filters index.
+ */
+EXTERN void filters_index_free(filters_index_struct *index);
+
+#endif /*EVM_FILE_filters_h*/
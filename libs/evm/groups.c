@@ -0,0 +1,314 @@
+/*
+ * The EVM groups module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_groups_c
+#define EVM_FILE_groups_c
+#else
+#error Preprocesor macro EVM_FILE_groups_c conflict!
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <semaphore.h>
+#include <pthread.h>
+
+#include "evm/libevm.h"
+
+#include "evm.h"
+#include "messages.h"
+#include "groups.h"
+
+#define U2UP_LOG_NAME EVM_GRPS
+#include <u2up-log/u2up-log.h>
+
+/*
+ * Public API functions:
+ * - evm_group_add()
+ * - evm_group_get()
+ * - evm_group_del()
+ */
+evmGroupStruct * evm_group_add(evmStruct *evm, int id)
+{
+	evmGroupStruct *group = NULL;
+	evmlist_el_struct *tmp, *new;
+	u2up_log_info("(entry)\n");
+
+	if (evm != NULL) {
+		if (evm->groups_list != NULL) {
+			pthread_mutex_lock(&evm->groups_list->access_mutex);
+			tmp = evm_search_evmlist(evm->groups_list, id);
+			if ((tmp != NULL) && (tmp->id == id)) {
+				/* required id already exists - return existing element */
+				group = (evm_group_struct *)tmp->el;
+			} else {
+				/* create new evmlist element with id */
+				if ((new = evm_new_evmlist_el(id)) != NULL) {
+					/* create new group */
+					if ((group = (evm_group_struct *)calloc(1, sizeof(evm_group_struct))) == NULL) {
+						errno = ENOMEM;
+						u2up_log_system_error("calloc(): group\n");
+						free(new);
+						new = NULL;
+					}
+					if (group != NULL) {
+						group->evm = evm;
+						group->id = id;
+						group->policy = EVM_GROUP_ROUND_ROBIN;
+						group->seed = (unsigned int)id;
+						pthread_mutex_init(&group->access_mutex, NULL);
+						pthread_mutex_unlock(&group->access_mutex);
+					}
+				}
+				if (new != NULL) {
+					new->id = id;
+					new->el = (void *)group;
+					new->prev = tmp;
+					new->next = NULL;
+					if (tmp != NULL)
+						tmp->next = new;
+					else
+						evm->groups_list->first = new;
+				}
+			}
+			pthread_mutex_unlock(&evm->groups_list->access_mutex);
+		}
+	}
+	return group;
+}
+
+evmGroupStruct * evm_group_get(evmStruct *evm, int id)
+{
+	evmGroupStruct *group = NULL;
+	evmlist_el_struct *tmp;
+	u2up_log_info("(entry)\n");
+
+	if (evm != NULL) {
+		if (evm->groups_list != NULL) {
+			pthread_mutex_lock(&evm->groups_list->access_mutex);
+			tmp = evm_search_evmlist(evm->groups_list, id);
+			if ((tmp != NULL) && (tmp->id == id)) {
+				/* required id already exists - return existing element */
+				group = (evm_group_struct *)tmp->el;
+			}
+			pthread_mutex_unlock(&evm->groups_list->access_mutex);
+		}
+	}
+	return group;
+}
+
+evmGroupStruct * evm_group_del(evmStruct *evm, int id)
+{
+	evmGroupStruct *group = NULL;
+	evmlist_el_struct *tmp;
+	u2up_log_info("(entry)\n");
+
+	if (evm != NULL) {
+		if (evm->groups_list != NULL) {
+			pthread_mutex_lock(&evm->groups_list->access_mutex);
+			tmp = evm_search_evmlist(evm->groups_list, id);
+			if ((tmp != NULL) && (tmp->id == id)) {
+				/* required id already exists - return existing element */
+				group = (evm_group_struct *)tmp->el;
+				if (group != NULL) {
+					/* Not referenced by topic subscriptions any more. */
+					evm_topics_group_unsubscribe(group);
+					free(group->members);
+					free(group);
+				}
+				if (tmp->prev != NULL)
+					tmp->prev->next = tmp->next;
+				else
+					evm->groups_list->first = tmp->next;
+				if (tmp->next != NULL)
+					tmp->next->prev = tmp->prev;
+				free(tmp);
+				tmp = NULL;
+			}
+			pthread_mutex_unlock(&evm->groups_list->access_mutex);
+		}
+	}
+	return group;
+}
+
+/*
+ * Public API functions:
+ * - evm_group_member_add()
+ * - evm_group_member_del()
+ * - evm_group_policy_set()
+ */
+int evm_group_member_add(evmGroupStruct *group, evmConsumerStruct *consumer)
+{
+	int i;
+	evm_consumer_struct **members;
+	u2up_log_info("(entry)\n");
+
+	if ((group == NULL) || (consumer == NULL))
+		return -1;
+
+	/* Group deliveries of posts are queued locally - never reaching remote consumers. */
+	if (consumer->shm != NULL)
+		return -1;
+
+	pthread_mutex_lock(&group->access_mutex);
+	for (i = 0; i < group->members_num; i++) {
+		if (group->members[i] == consumer) {
+			/* already a member */
+			pthread_mutex_unlock(&group->access_mutex);
+			return 0;
+		}
+	}
+	if (group->members_num == group->members_size) {
+		members = (evm_consumer_struct **)realloc(group->members, ((group->members_size != 0) ? (group->members_size * 2) : 4) * sizeof(evm_consumer_struct *));
+		if (members == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("realloc(): group members\n");
+			pthread_mutex_unlock(&group->access_mutex);
+			return -1;
+		}
+		group->members = members;
+		group->members_size = (group->members_size != 0) ? (group->members_size * 2) : 4;
+	}
+	group->members[group->members_num++] = consumer;
+	pthread_mutex_unlock(&group->access_mutex);
+	return 0;
+}
+
+int evm_group_member_del(evmGroupStruct *group, evmConsumerStruct *consumer)
+{
+	int i;
+	u2up_log_info("(entry)\n");
+
+	if ((group == NULL) || (consumer == NULL))
+		return -1;
+
+	pthread_mutex_lock(&group->access_mutex);
+	for (i = 0; i < group->members_num; i++) {
+		if (group->members[i] == consumer) {
+			group->members_num--;
+			memmove(&group->members[i], &group->members[i + 1], (group->members_num - i) * sizeof(evm_consumer_struct *));
+			break;
+		}
+	}
+	pthread_mutex_unlock(&group->access_mutex);
+	return 0;
+}
+
+int evm_group_policy_set(evmGroupStruct *group, int policy)
+{
+	u2up_log_info("(entry)\n");
+
+	if (group == NULL)
+		return -1;
+
+	switch (policy) {
+	case EVM_GROUP_ROUND_ROBIN:
+	case EVM_GROUP_LEAST_DEPTH:
+	case EVM_GROUP_TWO_CHOICES:
+		break;
+	default:
+		return -1;
+	}
+
+	pthread_mutex_lock(&group->access_mutex);
+	group->policy = policy;
+	pthread_mutex_unlock(&group->access_mutex);
+	return 0;
+}
+
+evm_consumer_struct * groups_member_select(evm_group_struct *group)
+{
+	int i, a, b;
+	evm_consumer_struct *consumer = NULL;
+	u2up_log_info("(entry)\n");
+
+	if (group == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&group->access_mutex);
+	if (group->members_num == 0) {
+		pthread_mutex_unlock(&group->access_mutex);
+		return NULL;
+	}
+
+	switch (group->policy) {
+	case EVM_GROUP_LEAST_DEPTH:
+		/* Queue depths are sampled without locking - good enough to balance. */
+		consumer = group->members[0];
+		for (i = 1; i < group->members_num; i++) {
+			if (messages_depth(group->members[i]) < messages_depth(consumer))
+				consumer = group->members[i];
+		}
+		break;
+	case EVM_GROUP_TWO_CHOICES:
+		/* Power of two random choices - the less loaded one of two random members. */
+		a = rand_r(&group->seed) % group->members_num;
+		b = rand_r(&group->seed) % group->members_num;
+		if ((a != b) && (messages_depth(group->members[b]) < messages_depth(group->members[a])))
+			a = b;
+		consumer = group->members[a];
+		break;
+	default:
+		consumer = group->members[group->rr_next % group->members_num];
+		group->rr_next++;
+	}
+	pthread_mutex_unlock(&group->access_mutex);
+
+	return consumer;
+}
+
+void groups_consumer_free(evm_consumer_struct *consumer)
+{
+	evm_struct *evm = consumer->evm;
+	evmlist_el_struct *tmp;
+	u2up_log_info("(entry)\n");
+
+	if (evm->groups_list == NULL)
+		return;
+
+	pthread_mutex_lock(&evm->groups_list->access_mutex);
+	for (tmp = evm->groups_list->first; tmp != NULL; tmp = tmp->next) {
+		if (tmp->el != NULL)
+			evm_group_member_del((evm_group_struct *)tmp->el, consumer);
+	}
+	pthread_mutex_unlock(&evm->groups_list->access_mutex);
+}
+
+/*
+ * Public API function:
+ * - evm_message_group_pass()
+ */
+int evm_message_group_pass(evmGroupStruct *group, evmMessageStruct *msg)
+{
+	evm_consumer_struct *consumer;
+	u2up_log_info("(entry) group=%p, msg=%p\n", group, msg);
+
+	if ((group == NULL) || (msg == NULL))
+		return -1;
+
+	if ((consumer = groups_member_select(group)) == NULL) {
+		u2up_log_debug("Group without members!\n");
+		return -1;
+	}
+
+	return evm_message_pass(consumer, msg);
+}
@@ -0,0 +1,819 @@
+/*
+ * The EVM io module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_io_c
+#define EVM_FILE_io_c
+#else
+#error Preprocesor macro EVM_FILE_io_c conflict!
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+
+#include "evm/libevm.h"
+
+#include "evm.h"
+#include "io.h"
+
+#define U2UP_LOG_NAME EVM_IO
+#include <u2up-log/u2up-log.h>
+
+/* Max receives per fd readiness (epoll) */
+#define EVM_IO_RECV_BATCH 16
+
+static int ring_setup(io_set_struct *io);
+static void ring_free(io_set_struct *io);
+static struct io_uring_sqe * ring_sqe(io_set_struct *io);
+static int ring_submit(io_set_struct *io, unsigned int flags);
+static void ring_buf_return(io_set_struct *io, unsigned short bid);
+static int ring_handle(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx);
+static io_set_struct * io_init(evm_consumer_struct *consumer, int backend);
+static int io_deliver(evm_consumer_struct *consumer, io_recv_struct *rcv, const char *data, size_t len);
+static int io_recv_arm(io_set_struct *io, io_recv_struct *rcv);
+static void io_recv_complete(evm_consumer_struct *consumer, io_set_struct *io, io_recv_struct *rcv, int res, unsigned int flags);
+static int io_fd_recv(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx);
+static int io_send_next(io_set_struct *io, io_sender_struct *sender);
+static void io_send_complete(io_set_struct *io, io_sender_struct *sender, int res);
+static int io_recv_cancel(io_set_struct *io, io_recv_struct *rcv);
+static void io_retry(io_set_struct *io);
+
+/*
+ * Map the rings of a new io_uring instance and register the provided
+ * receive buffers ring (required for multishot receives).
+ */
+static int ring_setup(io_set_struct *io)
+{
+	struct io_ring *ring = &io->ring;
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	size_t sq_size, cq_size;
+	unsigned short bid;
+	char *rings;
+	u2up_log_info("(entry)\n");
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = EVM_IO_CQ_ENTRIES;
+	if ((ring->fd = syscall(__NR_io_uring_setup, EVM_IO_SQ_ENTRIES, &p)) < 0) {
+		u2up_log_debug("io_uring_setup() failed (errno=%d)\n", errno);
+		return -1;
+	}
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		u2up_log_debug("io_uring too old (no single mmap)\n");
+		return -1;
+	}
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->rings_size = (sq_size > cq_size) ? sq_size : cq_size;
+	rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (rings == MAP_FAILED) {
+		u2up_log_system_error("mmap(): io_uring rings\n");
+		return -1;
+	}
+	ring->rings = rings;
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		u2up_log_system_error("mmap(): io_uring sqes\n");
+		ring->sqes = NULL;
+		return -1;
+	}
+	ring->sq_head = (unsigned int *)(rings + p.sq_off.head);
+	ring->sq_tail = (unsigned int *)(rings + p.sq_off.tail);
+	ring->sq_flags = (unsigned int *)(rings + p.sq_off.flags);
+	ring->sq_array = (unsigned int *)(rings + p.sq_off.array);
+	ring->sq_mask = *(unsigned int *)(rings + p.sq_off.ring_mask);
+	ring->sq_entries = p.sq_entries;
+	ring->sq_local = *ring->sq_tail;
+	ring->cq_head = (unsigned int *)(rings + p.cq_off.head);
+	ring->cq_tail = (unsigned int *)(rings + p.cq_off.tail);
+	ring->cq_mask = *(unsigned int *)(rings + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(rings + p.cq_off.cqes);
+
+	/* Provided receive buffers (picked by the kernel on completion). */
+	io->br_size = EVM_IO_BUFS * sizeof(struct io_uring_buf);
+	io->br = mmap(NULL, io->br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (io->br == MAP_FAILED) {
+		u2up_log_system_error("mmap(): buffers ring\n");
+		io->br = NULL;
+		return -1;
+	}
+	if ((io->bufs = malloc(EVM_IO_BUFS * EVM_IO_BUF_SIZE)) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("malloc(): bufs\n");
+		return -1;
+	}
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t)io->br;
+	reg.ring_entries = EVM_IO_BUFS;
+	reg.bgid = EVM_IO_BGID;
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		u2up_log_debug("io_uring provided buffers ring not supported (errno=%d)\n", errno);
+		return -1;
+	}
+	for (bid = 0; bid < EVM_IO_BUFS; bid++)
+		ring_buf_return(io, bid);
+
+	return 0;
+}
+
+static void ring_free(io_set_struct *io)
+{
+	struct io_ring *ring = &io->ring;
+
+	if (ring->fd >= 0)
+		close(ring->fd);
+	ring->fd = -1;
+	if (ring->sqes != NULL)
+		munmap(ring->sqes, ring->sqes_size);
+	ring->sqes = NULL;
+	if (ring->rings != NULL)
+		munmap(ring->rings, ring->rings_size);
+	ring->rings = NULL;
+	if (io->br != NULL)
+		munmap(io->br, io->br_size);
+	io->br = NULL;
+	free(io->bufs);
+	io->bufs = NULL;
+}
+
+/*
+ * Next free submission queue entry (submitting prepared ones, if full).
+ */
+static struct io_uring_sqe * ring_sqe(io_set_struct *io)
+{
+	struct io_ring *ring = &io->ring;
+	struct io_uring_sqe *sqe;
+	unsigned int idx;
+
+	if ((ring->sq_local - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) >= ring->sq_entries) {
+		ring_submit(io, 0);
+		if ((ring->sq_local - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) >= ring->sq_entries) {
+			u2up_log_error("io_uring submission queue full!\n");
+			return NULL;
+		}
+	}
+	idx = ring->sq_local & ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sq_array[idx] = idx;
+	ring->sq_local++;
+
+	return sqe;
+}
+
+static int ring_submit(io_set_struct *io, unsigned int flags)
+{
+	struct io_ring *ring = &io->ring;
+	unsigned int to_submit;
+	int rv;
+
+	__atomic_store_n(ring->sq_tail, ring->sq_local, __ATOMIC_RELEASE);
+	to_submit = ring->sq_local - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if ((to_submit == 0) && (flags == 0))
+		return 0;
+
+	while ((rv = syscall(__NR_io_uring_enter, ring->fd, to_submit, 0, flags, NULL, 0)) < 0) {
+		if (errno == EINTR)
+			continue;
+		if ((errno != EAGAIN) && (errno != EBUSY))
+			u2up_log_system_error("io_uring_enter()\n");
+		/* Not consumed entries submitted again next time. */
+		return -1;
+	}
+
+	return rv;
+}
+
+static void ring_buf_return(io_set_struct *io, unsigned short bid)
+{
+	struct io_uring_buf *buf = &io->br->bufs[io->br_tail & (EVM_IO_BUFS - 1)];
+
+	/* Fields set separately (the first entry overlays the ring tail). */
+	buf->addr = (uintptr_t)(io->bufs + bid * EVM_IO_BUF_SIZE);
+	buf->len = EVM_IO_BUF_SIZE;
+	buf->bid = bid;
+	io->br_tail++;
+	__atomic_store_n(&io->br->tail, io->br_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Completions ready (io_uring fd watched within the consumer's epoll set).
+ */
+static int ring_handle(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx)
+{
+	io_set_struct *io = (io_set_struct *)ctx;
+	struct io_ring *ring = &io->ring;
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail, flags;
+	int *op, res, overflow;
+	u2up_log_info("(cb entry) fd=%d\n", fd);
+
+	do {
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail) {
+			cqe = &ring->cqes[head & ring->cq_mask];
+			op = (int *)(uintptr_t)cqe->user_data;
+			res = cqe->res;
+			flags = cqe->flags;
+			head++;
+			__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+			if (op == NULL) {
+				/* Cancel request. */
+				continue;
+			}
+			if (*op == IO_OP_RECV)
+				io_recv_complete(consumer, io, (io_recv_struct *)op, res, flags);
+			else
+				io_send_complete(io, (io_sender_struct *)op, res);
+		}
+		/* Completions overflown (CQ ring full) flushed into the ring. */
+		if ((overflow = (__atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)))
+			ring_submit(io, IORING_ENTER_GETEVENTS);
+	} while (overflow);
+
+	/* Receives rearmed and next sends. */
+	ring_submit(io, 0);
+
+	return 0;
+}
+
+static io_set_struct * io_init(evm_consumer_struct *consumer, int backend)
+{
+	io_set_struct *io;
+	u2up_log_info("(entry) backend=%d\n", backend);
+
+	if ((io = (io_set_struct *)calloc(1, sizeof(io_set_struct))) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("calloc(): io\n");
+		return NULL;
+	}
+	io->ring.fd = -1;
+	if (
+		((io->recvs_list = calloc(1, sizeof(evmlist_head_struct))) == NULL) ||
+		((io->senders_list = calloc(1, sizeof(evmlist_head_struct))) == NULL) ||
+		((io->buf = malloc(EVM_IO_BUF_SIZE)) == NULL)
+	) {
+		errno = ENOMEM;
+		u2up_log_system_error("calloc(): io lists\n");
+		free(io->recvs_list);
+		free(io->senders_list);
+		free(io);
+		return NULL;
+	}
+	pthread_mutex_init(&io->recvs_list->access_mutex, NULL);
+	pthread_mutex_unlock(&io->recvs_list->access_mutex);
+	pthread_mutex_init(&io->senders_list->access_mutex, NULL);
+	pthread_mutex_unlock(&io->senders_list->access_mutex);
+
+	io->backend = EVM_IO_EPOLL;
+	if (backend == EVM_IO_URING) {
+		if ((ring_setup(io) == 0) && (evm_fd_add(consumer, io->ring.fd, EPOLLIN, ring_handle, io) == 0)) {
+			io->backend = EVM_IO_URING;
+		} else {
+			ring_free(io);
+			u2up_log_notice("io_uring not available - using epoll\n");
+		}
+	}
+
+	consumer->io = io;
+	return io;
+}
+
+void io_flush(evm_consumer_struct *consumer)
+{
+	io_set_struct *io = consumer->io;
+
+	if ((io != NULL) && (io->backend == EVM_IO_URING)) {
+		if (io->retry)
+			io_retry(io);
+		ring_submit(io, 0);
+	}
+}
+
+/*
+ * Prepare sends, receives and cancels left without submission queue entry.
+ */
+static void io_retry(io_set_struct *io)
+{
+	evmlist_el_struct *tmp;
+	io_sender_struct *sender;
+	io_recv_struct *rcv;
+
+	io->retry = EVM_FALSE;
+	pthread_mutex_lock(&io->senders_list->access_mutex);
+	for (tmp = io->senders_list->first; tmp != NULL; tmp = tmp->next) {
+		sender = (io_sender_struct *)tmp->el;
+		if ((sender->first != NULL) && !sender->in_flight)
+			io_send_next(io, sender);
+	}
+	pthread_mutex_unlock(&io->senders_list->access_mutex);
+
+	pthread_mutex_lock(&io->recvs_list->access_mutex);
+	for (tmp = io->recvs_list->first; tmp != NULL; tmp = tmp->next) {
+		rcv = (io_recv_struct *)tmp->el;
+		if (rcv->rearm && (io_recv_arm(io, rcv) == 0))
+			rcv->rearm = EVM_FALSE;
+	}
+	for (rcv = io->gone; rcv != NULL; rcv = rcv->gone_next) {
+		if (rcv->cancel)
+			io_recv_cancel(io, rcv);
+	}
+	pthread_mutex_unlock(&io->recvs_list->access_mutex);
+}
+
+void io_consumer_free(evm_consumer_struct *consumer)
+{
+	io_set_struct *io = consumer->io;
+	evmlist_el_struct *tmp, *next;
+	io_sender_struct *sender;
+	io_send_buf_struct *buf;
+	io_recv_struct *rcv;
+	u2up_log_info("(entry)\n");
+
+	if (io == NULL)
+		return;
+
+	/* Closing io_uring cancels all pending requests. */
+	ring_free(io);
+	for (tmp = io->recvs_list->first; tmp != NULL; tmp = next) {
+		next = tmp->next;
+		free(tmp->el);
+		free(tmp);
+	}
+	while ((rcv = io->gone) != NULL) {
+		io->gone = rcv->gone_next;
+		free(rcv);
+	}
+	for (tmp = io->senders_list->first; tmp != NULL; tmp = next) {
+		next = tmp->next;
+		sender = (io_sender_struct *)tmp->el;
+		while ((buf = sender->first) != NULL) {
+			sender->first = buf->next;
+			free(buf);
+		}
+		free(sender);
+		free(tmp);
+	}
+	free(io->recvs_list);
+	free(io->senders_list);
+	free(io->buf);
+	free(io);
+	consumer->io = NULL;
+}
+
+/*
+ * Received data turned into a message: data (struct iovec) of the message
+ * refers to the received bytes (nul terminated) within the same allocation,
+ * handed to the decode stage.
+ */
+static int io_deliver(evm_consumer_struct *consumer, io_recv_struct *rcv, const char *data, size_t len)
+{
+	evm_message_struct *msg;
+	struct iovec *iov;
+
+	if ((msg = evm_message_new(rcv->msgtype, rcv->msgid, sizeof(struct iovec) + len + 1)) == NULL)
+		return -1;
+
+	iov = (struct iovec *)msg->data;
+	iov->iov_base = (char *)(iov + 1);
+	iov->iov_len = len;
+	if (len > 0)
+		memcpy(iov->iov_base, data, len);
+	((char *)iov->iov_base)[len] = '\0';
+	msg->ctx = rcv->ctx;
+
+	return evm_message_decode(consumer, msg);
+}
+
+static int io_recv_arm(io_set_struct *io, io_recv_struct *rcv)
+{
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = ring_sqe(io)) == NULL) {
+		io->retry = EVM_TRUE;
+		return -1;
+	}
+
+	/* Multishot receive into provided buffers. */
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = rcv->fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = EVM_IO_BGID;
+	sqe->user_data = (uintptr_t)rcv;
+	rcv->armed = EVM_TRUE;
+
+	return 0;
+}
+
+static void io_recv_complete(evm_consumer_struct *consumer, io_set_struct *io, io_recv_struct *rcv, int res, unsigned int flags)
+{
+	io_recv_struct **gone;
+	unsigned short bid;
+
+	if (flags & IORING_CQE_F_BUFFER) {
+		bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		if ((res > 0) && !rcv->deleted) {
+			rcv->received = EVM_TRUE;
+			io_deliver(consumer, rcv, io->bufs + bid * EVM_IO_BUF_SIZE, res);
+		}
+		ring_buf_return(io, bid);
+	}
+	if (flags & IORING_CQE_F_MORE)
+		return;
+
+	/* Multishot receive terminated. */
+	rcv->armed = EVM_FALSE;
+	if (rcv->deleted) {
+		for (gone = &io->gone; *gone != NULL; gone = &(*gone)->gone_next) {
+			if (*gone == rcv) {
+				*gone = rcv->gone_next;
+				break;
+			}
+		}
+		free(rcv);
+		return;
+	}
+	if ((res > 0) || (res == -ENOBUFS)) {
+		/* Submission queue full - re-armed with the next flush. */
+		if (io_recv_arm(io, rcv) != 0)
+			rcv->rearm = EVM_TRUE;
+		return;
+	}
+	if ((res == -EINVAL) && !rcv->received) {
+		/* Multishot receives not supported by the kernel - receive via epoll. */
+		if (evm_fd_add(consumer, rcv->fd, EPOLLIN, io_fd_recv, rcv) == 0) {
+			rcv->watched = EVM_TRUE;
+			return;
+		}
+	}
+	if (res < 0)
+		u2up_log_debug("receive failed (fd=%d, res=%d)\n", rcv->fd, res);
+
+	/* Peer shutdown (or failure) - final empty message. */
+	rcv->done = EVM_TRUE;
+	io_deliver(consumer, rcv, NULL, 0);
+}
+
+static int io_fd_recv(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx)
+{
+	io_recv_struct *rcv = (io_recv_struct *)ctx;
+	io_set_struct *io = consumer->io;
+	ssize_t n;
+	int i;
+
+	for (i = 0; i < EVM_IO_RECV_BATCH; i++) {
+		if ((n = recv(fd, io->buf, EVM_IO_BUF_SIZE, MSG_DONTWAIT)) > 0) {
+			io_deliver(consumer, rcv, io->buf, n);
+			continue;
+		}
+		if (n < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+			if (errno == EINTR)
+				continue;
+			u2up_log_system_error("recv(): fd=%d\n", fd);
+		}
+		/* Peer shutdown (or failure) - final empty message. */
+		evm_fd_del(consumer, fd);
+		rcv->watched = EVM_FALSE;
+		rcv->done = EVM_TRUE;
+		io_deliver(consumer, rcv, NULL, 0);
+		break;
+	}
+
+	return 0;
+}
+
+static int io_send_next(io_set_struct *io, io_sender_struct *sender)
+{
+	io_send_buf_struct *buf = sender->first;
+	struct io_uring_sqe *sqe;
+
+	sender->in_flight = EVM_FALSE;
+	if (buf == NULL)
+		return 0;
+
+	if ((sqe = ring_sqe(io)) == NULL) {
+		/* Still queued - retried with the next flush. */
+		io->retry = EVM_TRUE;
+		return -1;
+	}
+
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = sender->fd;
+	sqe->addr = (uintptr_t)(buf->data + buf->off);
+	sqe->len = buf->len - buf->off;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = (uintptr_t)sender;
+	sender->in_flight = EVM_TRUE;
+
+	return 0;
+}
+
+static void io_send_complete(io_set_struct *io, io_sender_struct *sender, int res)
+{
+	io_send_buf_struct *buf;
+
+	if ((buf = sender->first) == NULL) {
+		sender->in_flight = EVM_FALSE;
+		return;
+	}
+	if (res <= 0) {
+		/* Drop data queued for the failed socket. */
+		u2up_log_debug("send failed (fd=%d, res=%d)\n", sender->fd, res);
+		while ((buf = sender->first) != NULL) {
+			sender->first = buf->next;
+			free(buf);
+		}
+		sender->last = NULL;
+		sender->in_flight = EVM_FALSE;
+		return;
+	}
+
+	/* Partially sent data continued. */
+	buf->off += res;
+	if (buf->off >= buf->len) {
+		if ((sender->first = buf->next) == NULL)
+			sender->last = NULL;
+		free(buf);
+	}
+	io_send_next(io, sender);
+}
+
+/*
+ * Public API functions:
+ * - evm_io_backend_set()
+ * - evm_io_backend_get()
+ */
+int evm_io_backend_set(evmConsumerStruct *consumer, int backend)
+{
+	io_set_struct *io;
+	u2up_log_info("(entry) backend=%d\n", backend);
+
+	if ((consumer == NULL) || (consumer->io != NULL))
+		return -1;
+
+	if ((backend != EVM_IO_EPOLL) && (backend != EVM_IO_URING))
+		return -1;
+
+	if ((io = io_init(consumer, backend)) == NULL)
+		return -1;
+
+	return (io->backend == backend) ? 0 : -1;
+}
+
+int evm_io_backend_get(evmConsumerStruct *consumer)
+{
+	io_set_struct *io;
+	u2up_log_info("(entry)\n");
+
+	if (consumer == NULL)
+		return -1;
+
+	if ((io = consumer->io) == NULL) {
+		if ((io = io_init(consumer, EVM_IO_URING)) == NULL)
+			return -1;
+	}
+
+	return io->backend;
+}
+
+/*
+ * Public API functions:
+ * - evm_io_recv_add()
+ * - evm_io_recv_del()
+ * - evm_io_send()
+ */
+int evm_io_recv_add(evmConsumerStruct *consumer, int fd, evmMsgtypeStruct *msgtype, evmMsgidStruct *msgid, void *ctx)
+{
+	int rv = 0;
+	io_set_struct *io;
+	io_recv_struct *rcv = NULL;
+	evmlist_el_struct *tmp, *new;
+	u2up_log_info("(entry) fd=%d\n", fd);
+
+	if ((consumer == NULL) || (fd < 0) || (msgtype == NULL) || (msgid == NULL))
+		return -1;
+
+	if ((io = consumer->io) == NULL) {
+		if ((io = io_init(consumer, EVM_IO_URING)) == NULL)
+			return -1;
+	}
+
+	pthread_mutex_lock(&io->recvs_list->access_mutex);
+	tmp = evm_search_evmlist(io->recvs_list, fd);
+	if ((tmp != NULL) && (tmp->id == fd)) {
+		/* fd already receiving */
+		errno = EEXIST;
+		rv = -1;
+	} else if ((new = evm_new_evmlist_el(fd)) == NULL) {
+		rv = -1;
+	} else if ((rcv = (io_recv_struct *)calloc(1, sizeof(io_recv_struct))) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("calloc(): rcv\n");
+		free(new);
+		rv = -1;
+	} else {
+		rcv->op = IO_OP_RECV;
+		rcv->fd = fd;
+		rcv->msgtype = msgtype;
+		rcv->msgid = msgid;
+		rcv->ctx = ctx;
+		if (io->backend == EVM_IO_URING) {
+			if ((rv = io_recv_arm(io, rcv)) == 0)
+				ring_submit(io, 0);
+		} else {
+			if ((rv = evm_fd_add(consumer, fd, EPOLLIN, io_fd_recv, rcv)) == 0)
+				rcv->watched = EVM_TRUE;
+		}
+		if (rv < 0) {
+			free(rcv);
+			free(new);
+		} else {
+			new->el = (void *)rcv;
+			new->prev = tmp;
+			new->next = NULL;
+			if (tmp != NULL)
+				tmp->next = new;
+			else
+				io->recvs_list->first = new;
+		}
+	}
+	pthread_mutex_unlock(&io->recvs_list->access_mutex);
+
+	return rv;
+}
+
+/*
+ * Cancel deleted multishot receive (receive freed on its final completion).
+ */
+static int io_recv_cancel(io_set_struct *io, io_recv_struct *rcv)
+{
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = ring_sqe(io)) == NULL) {
+		/* Retried with the next flush. */
+		rcv->cancel = EVM_TRUE;
+		io->retry = EVM_TRUE;
+		return -1;
+	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = (uintptr_t)rcv;
+	sqe->user_data = 0;
+	rcv->cancel = EVM_FALSE;
+
+	return 0;
+}
+
+int evm_io_recv_del(evmConsumerStruct *consumer, int fd)
+{
+	int rv = -1;
+	io_set_struct *io;
+	io_recv_struct *rcv;
+	evmlist_el_struct *tmp;
+	u2up_log_info("(entry) fd=%d\n", fd);
+
+	if ((consumer == NULL) || ((io = consumer->io) == NULL))
+		return -1;
+
+	pthread_mutex_lock(&io->recvs_list->access_mutex);
+	tmp = evm_search_evmlist(io->recvs_list, fd);
+	if ((tmp != NULL) && (tmp->id == fd)) {
+		rcv = (io_recv_struct *)tmp->el;
+		if (tmp->prev != NULL)
+			tmp->prev->next = tmp->next;
+		else
+			io->recvs_list->first = tmp->next;
+		if (tmp->next != NULL)
+			tmp->next->prev = tmp->prev;
+		free(tmp);
+		if (rcv->watched)
+			evm_fd_del(consumer, fd);
+		if (rcv->armed) {
+			/* Freed on its final (canceled) completion. */
+			rcv->deleted = EVM_TRUE;
+			rcv->gone_next = io->gone;
+			io->gone = rcv;
+			if (io_recv_cancel(io, rcv) == 0)
+				ring_submit(io, 0);
+		} else
+			free(rcv);
+		rv = 0;
+	}
+	pthread_mutex_unlock(&io->recvs_list->access_mutex);
+
+	return rv;
+}
+
+int evm_io_send(evmConsumerStruct *consumer, int fd, const void *data, size_t len)
+{
+	int rv = 0;
+	io_set_struct *io;
+	io_sender_struct *sender = NULL;
+	io_send_buf_struct *buf;
+	evmlist_el_struct *tmp, *new;
+	size_t off = 0;
+	ssize_t n;
+	u2up_log_info("(entry) fd=%d, len=%zu\n", fd, len);
+
+	if ((consumer == NULL) || (fd < 0) || (data == NULL) || (len == 0))
+		return -1;
+
+	if ((io = consumer->io) == NULL) {
+		if ((io = io_init(consumer, EVM_IO_URING)) == NULL)
+			return -1;
+	}
+
+	if (io->backend == EVM_IO_EPOLL) {
+		/* Sent synchronously. */
+		while (off < len) {
+			if ((n = send(fd, (const char *)data + off, len - off, MSG_NOSIGNAL)) < 0) {
+				if (errno == EINTR)
+					continue;
+				u2up_log_system_error("send(): fd=%d\n", fd);
+				return -1;
+			}
+			off += n;
+		}
+		return 0;
+	}
+
+	if ((buf = (io_send_buf_struct *)malloc(sizeof(io_send_buf_struct) + len)) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("malloc(): send buf\n");
+		return -1;
+	}
+	buf->next = NULL;
+	buf->len = len;
+	buf->off = 0;
+	memcpy(buf->data, data, len);
+
+	pthread_mutex_lock(&io->senders_list->access_mutex);
+	tmp = evm_search_evmlist(io->senders_list, fd);
+	if ((tmp != NULL) && (tmp->id == fd)) {
+		sender = (io_sender_struct *)tmp->el;
+	} else if ((new = evm_new_evmlist_el(fd)) == NULL) {
+		rv = -1;
+	} else if ((sender = (io_sender_struct *)calloc(1, sizeof(io_sender_struct))) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("calloc(): sender\n");
+		free(new);
+		rv = -1;
+	} else {
+		sender->op = IO_OP_SEND;
+		sender->fd = fd;
+		new->el = (void *)sender;
+		new->prev = tmp;
+		new->next = NULL;
+		if (tmp != NULL)
+			tmp->next = new;
+		else
+			io->senders_list->first = new;
+	}
+	if (rv == 0) {
+		/* Queued behind data in flight (submitted by io_flush()). */
+		if (sender->last != NULL)
+			sender->last->next = buf;
+		else
+			sender->first = buf;
+		sender->last = buf;
+		if (!sender->in_flight)
+			io_send_next(io, sender);
+	} else
+		free(buf);
+	pthread_mutex_unlock(&io->senders_list->access_mutex);
+
+	return rv;
+}
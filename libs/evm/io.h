@@ -0,0 +1,132 @@
+/*
+ * The EVM io module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_io_h
+#define EVM_FILE_io_h
+
+#ifdef EVM_FILE_io_c
+/* PRIVATE usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN
+#else
+/* PUBLIC usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN extern
+#endif
+
+#include <linux/io_uring.h>
+
+/* Submission queue entries */
+#define EVM_IO_SQ_ENTRIES 64
+/* Completion queue entries */
+#define EVM_IO_CQ_ENTRIES 1024
+/* Provided receive buffers (power of 2) */
+#define EVM_IO_BUFS 64
+/* Provided receive buffer group */
+#define EVM_IO_BGID 0
+
+#define IO_OP_RECV 1
+#define IO_OP_SEND 2
+
+typedef struct io_recv io_recv_struct;
+typedef struct io_send_buf io_send_buf_struct;
+typedef struct io_sender io_sender_struct;
+
+/*Receiving socket (completions turned into messages)*/
+struct io_recv {
+	int op; /*IO_OP_RECV - first (completion user_data)*/
+	int fd;
+	evm_msgtype_struct *msgtype;
+	evm_msgid_struct *msgid;
+	void *ctx;
+	int armed; /*multishot receive submitted (io_uring)*/
+	int received; /*any data received (multishot receive supported)*/
+	int watched; /*fd watcher receiving (epoll)*/
+	int deleted; /*freed on the final completion*/
+	int done; /*peer shutdown or receive failure*/
+	int cancel; /*cancel request not submitted yet (retried by io_flush())*/
+	int rearm; /*receive not re-armed yet (retried by io_flush())*/
+	io_recv_struct *gone_next; /*deleted while armed chain*/
+}; /*io_recv_struct*/
+
+struct io_send_buf {
+	io_send_buf_struct *next;
+	size_t len;
+	size_t off; /*already sent*/
+	char data[];
+}; /*io_send_buf_struct*/
+
+/*Sending socket (one send in flight to keep data ordered)*/
+struct io_sender {
+	int op; /*IO_OP_SEND - first (completion user_data)*/
+	int fd;
+	int in_flight;
+	io_send_buf_struct *first;
+	io_send_buf_struct *last;
+}; /*io_sender_struct*/
+
+/*Shared io_uring rings mapping*/
+struct io_ring {
+	int fd;
+	void *rings;
+	size_t rings_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_flags;
+	unsigned int *sq_array;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int sq_local; /*local tail (prepared entries)*/
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+}; /*io_ring_struct*/
+
+/*Per consumer I/O engine*/
+struct io_set {
+	int backend; /*EVM_IO_...*/
+	struct io_ring ring;
+	struct io_uring_buf_ring *br; /*provided buffers ring*/
+	size_t br_size;
+	unsigned short br_tail;
+	char *bufs; /*provided buffers*/
+	char *buf; /*receive buffer (epoll)*/
+	evmlist_head_struct *recvs_list;
+	io_recv_struct *gone; /*deleted receives (final completion pending)*/
+	evmlist_head_struct *senders_list;
+	int retry; /*sends, receives or cancels without submission queue entry (retried by io_flush())*/
+}; /*io_set_struct*/
+
+/*
+ * Submit prepared io_uring entries (i.e. sends from handlers), preparing
+ * those not prepared before (submission queue full) first.
+ */
+EXTERN void io_flush(evm_consumer_struct *consumer_ptr);
+
+/*
+ * Free consumer's I/O engine (io_uring closed, pending I/O dropped).
+ */
+EXTERN void io_consumer_free(evm_consumer_struct *consumer_ptr);
+
+#endif /*EVM_FILE_io_h*/
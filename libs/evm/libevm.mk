@@ -26,7 +26,7 @@ _INSTDIR_ := $(_INSTALL_PREFIX_)/lib
 HPATH := $(_INSTALL_PREFIX_)/include/evm
 
 # Files to be compiled:
-SRCS := evm.c messages.c timers.c
+SRCS := evm.c messages.c timers.c groups.c shards.c filters.c paths.c fds.c io.c dgrams.c decoders.c signals.c shm.c memfds.c bridges.c pools.c
 CFLAGS += -fPIC
 
 # include automatic _OBJS_ compilation and SRCS dependencies generation
@@ -0,0 +1,260 @@
+/*
+ * The EVM memfd payloads module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_memfds_c
+#define EVM_FILE_memfds_c
+#else
+#error Preprocesor macro EVM_FILE_memfds_c conflict!
+#endif
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "evm/libevm.h"
+
+#include "evm.h"
+#include "memfds.h"
+
+#define U2UP_LOG_NAME EVM_MFD
+#include <u2up-log/u2up-log.h>
+
+static void memfds_release(void *ctx);
+static evm_message_struct * memfds_message(evm_msgtype_struct *msgtype, evm_msgid_struct *msgid, int fd, size_t size);
+
+/*
+ * Message release hook (unmaps data and closes this side's memfd).
+ */
+static void memfds_release(void *ctx)
+{
+	memfds_buf_struct *buf = (memfds_buf_struct *)ctx;
+	evm_message_struct *msg = buf->msg;
+
+	if (msg->data != NULL) {
+		munmap(msg->data, buf->size);
+		msg->data = NULL;
+	}
+	close(buf->fd);
+	free(buf);
+}
+
+static evm_message_struct * memfds_message(evm_msgtype_struct *msgtype, evm_msgid_struct *msgid, int fd, size_t size)
+{
+	evm_message_struct *msg;
+	memfds_buf_struct *buf;
+	void *addr = NULL;
+
+	if ((buf = (memfds_buf_struct *)calloc(1, sizeof(memfds_buf_struct))) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("calloc(): buf\n");
+		return NULL;
+	}
+	/* Empty memfds not mapped. */
+	if (size > 0) {
+		if ((addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+			u2up_log_system_error("mmap(): memfd\n");
+			free(buf);
+			return NULL;
+		}
+	}
+	if ((msg = evm_message_new(msgtype, msgid, 0)) == NULL) {
+		if (addr != NULL)
+			munmap(addr, size);
+		free(buf);
+		return NULL;
+	}
+	buf->msg = msg;
+	buf->fd = fd;
+	buf->size = size;
+	msg->data = addr;
+	msg->size = size;
+	msg->release = memfds_release;
+	msg->release_ctx = buf;
+
+	return msg;
+}
+
+int memfds_is(evm_message_struct *msg)
+{
+	return (msg->release == memfds_release);
+}
+
+int memfds_send(int sock, evm_message_struct *msg)
+{
+	memfds_buf_struct *buf = (memfds_buf_struct *)msg->release_ctx;
+	memfds_hdr_struct hdr;
+	struct iovec iov;
+	struct msghdr mh;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} cmsg;
+	struct cmsghdr *cm;
+	u2up_log_info("(entry) sock=%d, msg=%p\n", sock, msg);
+
+	if ((msg->msgtype == NULL) || (msg->msgid == NULL))
+		return -1;
+
+	/* The receiver maps it - size must not change any more. */
+	if (fcntl(buf->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+		u2up_log_system_error("fcntl(): F_ADD_SEALS\n");
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msgtype_id = msg->msgtype->id;
+	hdr.msgid_id = msg->msgid->id;
+	hdr.size = buf->size;
+	iov.iov_base = &hdr;
+	iov.iov_len = sizeof(hdr);
+	memset(&mh, 0, sizeof(mh));
+	memset(&cmsg, 0, sizeof(cmsg));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cmsg.buf;
+	mh.msg_controllen = sizeof(cmsg.buf);
+	cm = CMSG_FIRSTHDR(&mh);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &buf->fd, sizeof(int));
+
+	while (sendmsg(sock, &mh, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+		if (errno == EINTR)
+			continue;
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+			u2up_log_system_error("sendmsg(): memfd\n");
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+evm_message_struct * memfds_recv(evm_struct *evm, int sock)
+{
+	evm_msgtype_struct *msgtype;
+	evm_msgid_struct *msgid = NULL;
+	evm_message_struct *msg;
+	memfds_hdr_struct hdr;
+	struct iovec iov;
+	struct msghdr mh;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} cmsg;
+	struct cmsghdr *cm;
+	struct stat st;
+	ssize_t n;
+	int fd = -1, seals;
+	u2up_log_info("(entry) sock=%d\n", sock);
+
+	iov.iov_base = &hdr;
+	iov.iov_len = sizeof(hdr);
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cmsg.buf;
+	mh.msg_controllen = sizeof(cmsg.buf);
+
+	while ((n = recvmsg(sock, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC)) < 0) {
+		if (errno == EINTR)
+			continue;
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+			u2up_log_system_error("recvmsg(): memfd\n");
+		}
+		return NULL;
+	}
+	for (cm = CMSG_FIRSTHDR(&mh); cm != NULL; cm = CMSG_NXTHDR(&mh, cm)) {
+		if ((cm->cmsg_level == SOL_SOCKET) && (cm->cmsg_type == SCM_RIGHTS))
+			memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+	}
+	if (fd < 0) {
+		u2up_log_error("Missing memfd - message dropped!\n");
+		return NULL;
+	}
+	if ((n != sizeof(hdr)) || (mh.msg_flags & MSG_CTRUNC)) {
+		u2up_log_error("Malformed memfd message dropped!\n");
+		close(fd);
+		return NULL;
+	}
+	/* Mapped as claimed - must not be (or get) smaller (SIGBUS on access). */
+	if (((seals = fcntl(fd, F_GET_SEALS)) < 0) || !(seals & F_SEAL_SHRINK) || (fstat(fd, &st) < 0) || ((unsigned long long)st.st_size < (unsigned long long)hdr.size)) {
+		u2up_log_error("Memfd not sealed or smaller than claimed - message dropped!\n");
+		close(fd);
+		return NULL;
+	}
+
+	if ((msgtype = evm_msgtype_get(evm, hdr.msgtype_id)) != NULL)
+		msgid = evm_msgid_get(msgtype, hdr.msgid_id);
+	if (msgid == NULL) {
+		u2up_log_error("Unknown message (type=%d, id=%d) dropped!\n", hdr.msgtype_id, hdr.msgid_id);
+		close(fd);
+		return NULL;
+	}
+	if ((msg = memfds_message(msgtype, msgid, fd, hdr.size)) == NULL)
+		close(fd);
+
+	return msg;
+}
+
+/*
+ * Public API functions:
+ * - evm_memfd_message_new()
+ * - evm_memfd_message_fd_get()
+ */
+evmMessageStruct * evm_memfd_message_new(evmMsgtypeStruct *msgtype, evmMsgidStruct *msgid, size_t size)
+{
+	evmMessageStruct *msg;
+	int fd;
+	u2up_log_info("(entry) size=%zu\n", size);
+
+	if ((fd = memfd_create("evm", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+		u2up_log_system_error("memfd_create()\n");
+		return NULL;
+	}
+	if (ftruncate(fd, size) < 0) {
+		u2up_log_system_error("ftruncate(): memfd\n");
+		close(fd);
+		return NULL;
+	}
+	if ((msg = memfds_message(msgtype, msgid, fd, size)) == NULL)
+		close(fd);
+
+	return msg;
+}
+
+int evm_memfd_message_fd_get(evmMessageStruct *msg)
+{
+	u2up_log_info("(entry) msg=%p\n", msg);
+
+	if ((msg == NULL) || !memfds_is(msg))
+		return -1;
+
+	return ((memfds_buf_struct *)msg->release_ctx)->fd;
+}
@@ -0,0 +1,68 @@
+/*
+ * The EVM memfd payloads module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+
+#ifndef EVM_FILE_memfds_h
+#define EVM_FILE_memfds_h
+
+#ifdef EVM_FILE_memfds_c
+/* PRIVATE usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN
+#else
+/* PUBLIC usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN extern
+#endif
+
+typedef struct memfds_buf memfds_buf_struct;
+typedef struct memfds_hdr memfds_hdr_struct;
+
+/*Mapped memfd message data (released with the message)*/
+struct memfds_buf {
+	evm_message_struct *msg;
+	int fd;
+	size_t size; /*mapped size*/
+}; /*memfds_buf_struct*/
+
+/*Message header sent along with the memfd (SCM_RIGHTS)*/
+struct memfds_hdr {
+	int msgtype_id;
+	int msgid_id;
+	size_t size;
+}; /*memfds_hdr_struct*/
+
+/*
+ * Check for memfd message data.
+ */
+EXTERN int memfds_is(evm_message_struct *msg_ptr);
+
+/*
+ * Send memfd of the message to sock (non blocking - errno EAGAIN).
+ */
+EXTERN int memfds_send(int sock, evm_message_struct *msg_ptr);
+
+/*
+ * Receive memfd message from sock (mapped, NULL - none or failure).
+ */
+EXTERN evm_message_struct * memfds_recv(evm_struct *evm_ptr, int sock);
+
+#endif /*EVM_FILE_memfds_h*/
@@ -25,6 +25,7 @@
 #error Preprocesor macro EVM_FILE_messages_c conflict!
 #endif
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
@@ -35,12 +36,33 @@
 
 #include "evm.h"
 #include "messages.h"
+#include "fds.h"
+#include "groups.h"
+#include "filters.h"
+#include "shm.h"
+#include "bridges.h"
 
 #define U2UP_LOG_NAME EVM_MSGS
 #include <u2up-log/u2up-log.h>
 
-static int msg_enqueue(evm_consumer_struct *consumer, evm_message_struct *msg);
+static int msg_space_wait(msgs_queue_struct *msgs_queue);
+static int msg_enqueue(evm_consumer_struct *consumer, evm_message_struct *msg, evm_subscription_struct *sub, msg_hanger_struct **dropped, int wait);
+static void msg_dropped(msg_hanger_struct *msg_hanger);
 static evm_message_struct * msg_dequeue(evm_consumer_struct *consumer, const struct timespec *ts);
+static msg_hanger_struct * msg_unlink(msgs_queue_struct *msgs_queue, int prio);
+static void msg_link(msgs_queue_struct *msgs_queue, msg_hanger_struct *msg_hanger);
+static void msg_level_remove(msgs_queue_struct *msgs_queue, msg_hanger_struct *msg_hanger);
+static void msg_replace(msgs_queue_struct *msgs_queue, msg_hanger_struct *msg_hanger, evm_message_struct *msg, evm_subscription_struct *sub, int conflate);
+static void msg_sub_enter(msg_hanger_struct *msg_hanger, evm_subscription_struct *sub);
+static void msg_sub_leave(msg_hanger_struct *msg_hanger);
+static evm_message_struct * msg_take(evm_consumer_struct *consumer);
+static int msg_level_select(msgs_queue_struct *msgs_queue);
+static int msg_route_check(int route, void *dest);
+static int msg_deadline_before(evm_message_struct *a, evm_message_struct *b);
+static unsigned int msg_key_hash(msgs_queue_struct *msgs_queue, evm_message_struct *msg);
+static msg_hanger_struct * msg_key_find(msgs_queue_struct *msgs_queue, evm_message_struct *msg);
+static void msg_key_insert(msgs_queue_struct *msgs_queue, msg_hanger_struct *msg_hanger);
+static void msg_key_remove(msgs_queue_struct *msgs_queue, msg_hanger_struct *msg_hanger);
 
 msgs_queue_struct * messages_consumer_queue_init(evm_consumer_struct *consumer)
 {
@@ -61,22 +83,146 @@ msgs_queue_struct * messages_consumer_queue_init(evm_consumer_struct *consumer)
 	consumer->msgs_queue = msgs_queue;
 	pthread_mutex_init(&consumer->msgs_queue->access_mutex, NULL);
 	pthread_mutex_unlock(&consumer->msgs_queue->access_mutex);
+	pthread_cond_init(&consumer->msgs_queue->space_cond, NULL);
 
 	return msgs_queue;
 }
 
-static int msg_enqueue(evm_consumer_struct *consumer, evm_message_struct *msg)
+/*
+ * Wait for free space in a full consumer's queue (queue locked):
+ * Returns -1 on block timeout (real time), 0 otherwise.
+ */
+static int msg_space_wait(msgs_queue_struct *msgs_queue)
+{
+	struct timespec ts;
+
+	if (msgs_queue->block_timeout_set) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += msgs_queue->block_timeout.tv_sec;
+		ts.tv_nsec += msgs_queue->block_timeout.tv_nsec;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+	}
+
+	while ((msgs_queue->capacity != 0) && (msgs_queue->depth >= msgs_queue->capacity)) {
+		if (!msgs_queue->block_timeout_set)
+			pthread_cond_wait(&msgs_queue->space_cond, &msgs_queue->access_mutex);
+		else if (pthread_cond_timedwait(&msgs_queue->space_cond, &msgs_queue->access_mutex, &ts) == ETIMEDOUT)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Keys index of queued keyed messages (queue locked):
+ * Open hash on (msgid, key), grown when its load exceeds 1.
+ */
+static unsigned int msg_key_hash(msgs_queue_struct *msgs_queue, evm_message_struct *msg)
+{
+	unsigned long long h;
+
+	h = ((unsigned long long)(uintptr_t)msg->msgid ^ msg->key) * 0x9e3779b97f4a7c15ULL;
+	return (unsigned int)(h >> 32) & (msgs_queue->keys_size - 1);
+}
+
+static msg_hanger_struct * msg_key_find(msgs_queue_struct *msgs_queue, evm_message_struct *msg)
+{
+	msg_hanger_struct *msg_hanger;
+
+	if (msgs_queue->keys_count == 0)
+		return NULL;
+
+	msg_hanger = msgs_queue->keys[msg_key_hash(msgs_queue, msg)];
+	while (msg_hanger != NULL) {
+		if ((msg_hanger->msg->msgid == msg->msgid) && (msg_hanger->msg->key == msg->key))
+			break;
+		msg_hanger = msg_hanger->key_next;
+	}
+	return msg_hanger;
+}
+
+static void msg_key_insert(msgs_queue_struct *msgs_queue, msg_hanger_struct *msg_hanger)
+{
+	msg_hanger_struct **keys, **old_keys, *tmp;
+	unsigned int i, old_size, bucket;
+
+	if (msgs_queue->keys_count >= msgs_queue->keys_size) {
+		/* Grow (and rehash) the index - not indexed, if allocation fails. */
+		old_keys = msgs_queue->keys;
+		old_size = msgs_queue->keys_size;
+		if ((keys = (msg_hanger_struct **)calloc((old_size != 0) ? (old_size * 2) : 64, sizeof(msg_hanger_struct *))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): message keys index\n");
+			return;
+		}
+		msgs_queue->keys = keys;
+		msgs_queue->keys_size = (old_size != 0) ? (old_size * 2) : 64;
+		for (i = 0; i < old_size; i++) {
+			while ((tmp = old_keys[i]) != NULL) {
+				old_keys[i] = tmp->key_next;
+				bucket = msg_key_hash(msgs_queue, tmp->msg);
+				tmp->key_next = keys[bucket];
+				keys[bucket] = tmp;
+			}
+		}
+		free(old_keys);
+	}
+
+	bucket = msg_key_hash(msgs_queue, msg_hanger->msg);
+	msg_hanger->key_next = msgs_queue->keys[bucket];
+	msgs_queue->keys[bucket] = msg_hanger;
+	msg_hanger->keyed = EVM_TRUE;
+	msgs_queue->keys_count++;
+}
+
+static void msg_key_remove(msgs_queue_struct *msgs_queue, msg_hanger_struct *msg_hanger)
+{
+	msg_hanger_struct **link;
+
+	link = &msgs_queue->keys[msg_key_hash(msgs_queue, msg_hanger->msg)];
+	while (*link != NULL) {
+		if (*link == msg_hanger) {
+			*link = msg_hanger->key_next;
+			msgs_queue->keys_count--;
+			break;
+		}
+		link = &(*link)->key_next;
+	}
+	msg_hanger->key_next = NULL;
+	msg_hanger->keyed = EVM_FALSE;
+}
+
+/*
+ * Enqueue message to the consumer's queue according to its capacity and
+ * overflow policy (and lag limit policy of the topic subscription "sub",
+ * if posted). In conflation mode (of the queue or the posting topic) a
+ * keyed message replaces the queued one with the same msgid and key in
+ * place, keeping its queue position. A message dropped due to overflow
+ * or lag (an older one or the new one itself) is returned via "dropped"
+ * hanger, to be deleted by the caller outside of queue lock (see
+ * msg_dropped()). The BLOCK overflow policy only waits, if "wait" is set
+ * (no other locks held by the caller), otherwise the message is rejected.
+ * Returns:
+ * - -EAGAIN, if rejected due to full queue
+ * - -1 on other failure
+ * - 1, if the subscription is to be unsubscribed due to its lag
+ * - 0 on success
+ */
+static int msg_enqueue(evm_consumer_struct *consumer, evm_message_struct *msg, evm_subscription_struct *sub, msg_hanger_struct **dropped, int wait)
 {
 	int rv = 0;
+	int post = EVM_TRUE, above = EVM_FALSE, conflate;
 	msgs_queue_struct *msgs_queue;
-	msg_hanger_struct *msg_hanger;
-	sem_t *bsem;
+	msg_hanger_struct *msg_hanger, *keyed;
+	int (*watermark)(evm_consumer_struct *consumer, int above);
 	pthread_mutex_t *amtx;
 	u2up_log_info("(entry)\n");
 
+	*dropped = NULL;
 	if (consumer != NULL) {
 		msgs_queue = consumer->msgs_queue;
-		bsem = &consumer->blocking_sem;
 		if (msgs_queue != NULL)
 			amtx = &msgs_queue->access_mutex;
 		else
@@ -85,44 +231,123 @@ static int msg_enqueue(evm_consumer_struct *consumer, evm_message_struct *msg)
 		rv = -1;
 
 	if (rv == 0) {
-		pthread_mutex_lock(amtx);
 		if ((msg_hanger = (msg_hanger_struct *)calloc(1, sizeof(msg_hanger_struct))) == NULL) {
 			errno = ENOMEM;
 			u2up_log_system_error("calloc(): message hanger\n");
-			pthread_mutex_unlock(amtx);
 			return -1;
 		}
 		msg_hanger->msg = msg;
-		if (msgs_queue->last_hanger == NULL)
-			msgs_queue->first_hanger = msg_hanger;
-		else
-			msgs_queue->last_hanger->next = msg_hanger;
-
-		msgs_queue->last_hanger = msg_hanger;
-		msg_hanger->next = NULL;
+		pthread_mutex_lock(amtx);
+		conflate = msg->key_set && (msgs_queue->conflate || ((sub != NULL) && sub->topic->conflate));
+		if (conflate && ((keyed = msg_key_find(msgs_queue, msg)) != NULL)) {
+			/* Last-value conflation - the queued message with the same key gets replaced. */
+			msg_hanger->msg = keyed->msg;
+			msg_replace(msgs_queue, keyed, msg, sub, conflate);
+			msgs_queue->stats.conflated++;
+			pthread_mutex_unlock(amtx);
+			*dropped = msg_hanger;
+			return 0;
+		}
+		if ((sub != NULL) && (sub->lag_limit != 0) && (sub->stats.lag >= sub->lag_limit)) {
+			switch (sub->lag_policy) {
+			case EVM_SUB_LAG_CONFLATE:
+				if (sub->last_hanger != NULL) {
+					/* Replace the latest queued message of this subscription (keep its position). */
+					msg_hanger->msg = sub->last_hanger->msg;
+					msg_replace(msgs_queue, sub->last_hanger, msg, sub, conflate);
+					sub->stats.conflated++;
+					pthread_mutex_unlock(amtx);
+					*dropped = msg_hanger;
+					return 0;
+				}
+				break;
+			case EVM_SUB_LAG_UNSUBSCRIBE:
+				pthread_mutex_unlock(amtx);
+				free(msg_hanger);
+				return 1;
+			default:
+				sub->stats.dropped++;
+				pthread_mutex_unlock(amtx);
+				*dropped = msg_hanger;
+				return 0;
+			}
+		}
+		if ((msgs_queue->capacity != 0) && (msgs_queue->depth >= msgs_queue->capacity)) {
+			switch (msgs_queue->overflow) {
+			case EVM_QUEUE_OVERFLOW_BLOCK:
+				rv = wait ? msg_space_wait(msgs_queue) : -1;
+				break;
+			case EVM_QUEUE_OVERFLOW_DROP_OLDEST:
+				/* Replace the oldest message of the lowest priority level (keep its semaphore count). */
+				*dropped = msg_unlink(msgs_queue, __builtin_ctz(msgs_queue->levels_mask));
+				msgs_queue->depth--;
+				msgs_queue->stats.dropped++;
+				post = EVM_FALSE;
+				break;
+			case EVM_QUEUE_OVERFLOW_DROP_NEWEST:
+				msgs_queue->stats.dropped++;
+				pthread_mutex_unlock(amtx);
+				*dropped = msg_hanger;
+				return 0;
+			default:
+				rv = -1;
+			}
+			if (rv != 0) {
+				msgs_queue->stats.rejected++;
+				pthread_mutex_unlock(amtx);
+				free(msg_hanger);
+				return -EAGAIN;
+			}
+		}
+		msg_link(msgs_queue, msg_hanger);
+		if (conflate)
+			msg_key_insert(msgs_queue, msg_hanger);
+		if (sub != NULL)
+			msg_sub_enter(msg_hanger, sub);
+		msgs_queue->depth++;
+		msgs_queue->stats.enqueued++;
+		if (msgs_queue->depth > msgs_queue->stats.max_depth)
+			msgs_queue->stats.max_depth = msgs_queue->depth;
+		if ((msgs_queue->high_wm != 0) && !msgs_queue->above_wm && (msgs_queue->depth >= msgs_queue->high_wm)) {
+			msgs_queue->above_wm = EVM_TRUE;
+			above = EVM_TRUE;
+		}
+		watermark = msgs_queue->watermark;
 		pthread_mutex_unlock(amtx);
-		u2up_log_info("Post blocking semaphore (UNBLOCK)\n");
-		sem_post(bsem);
+		if (post) {
+			u2up_log_info("Post blocking semaphore (UNBLOCK)\n");
+			fds_wake(consumer);
+		}
+		if (above && (watermark != NULL))
+			watermark(consumer, EVM_TRUE);
 	}
 	return rv;
 }
 
+/*
+ * Delete message dropped by msg_enqueue() (if any).
+ */
+static void msg_dropped(msg_hanger_struct *msg_hanger)
+{
+	if (msg_hanger == NULL)
+		return;
+
+	u2up_log_debug("Consumer queue full - message dropped!\n");
+	evm_message_delete(msg_hanger->msg);
+	free(msg_hanger);
+}
+
 static evm_message_struct * msg_dequeue(evm_consumer_struct *consumer, const struct timespec *ts)
 {
-	evm_message_struct *msg;
 	msgs_queue_struct *msgs_queue;
-	msg_hanger_struct *msg_hanger;
 	sem_t *bsem;
 	int rv;
-	pthread_mutex_t *amtx;
 	u2up_log_info("(entry)\n");
 
 	if (consumer != NULL) {
 		msgs_queue = (msgs_queue_struct *)consumer->msgs_queue;
 		bsem = &consumer->blocking_sem;
-		if (msgs_queue != NULL)
-			amtx = &msgs_queue->access_mutex;
-		else
+		if (msgs_queue == NULL)
 			return NULL;
 	} else
 		return NULL;
@@ -152,23 +377,244 @@ static evm_message_struct * msg_dequeue(evm_consumer_struct *consumer, const str
 		break;
 	}
 
+	return msg_take(consumer);
+}
+
+/*
+ * Select the priority level to be served next (queue locked and not empty):
+ * The highest non-empty level, unless lower levels have already been
+ * bypassed "aging_limit" times in a row - then the lowest non-empty one.
+ */
+static int msg_level_select(msgs_queue_struct *msgs_queue)
+{
+	unsigned int mask = msgs_queue->levels_mask;
+	int highest = (int)(sizeof(mask) * 8) - 1 - __builtin_clz(mask);
+
+	if ((msgs_queue->aging_limit == 0) || ((mask & ~(1U << highest)) == 0)) {
+		msgs_queue->aging_count = 0;
+		return highest;
+	}
+
+	if (++msgs_queue->aging_count <= msgs_queue->aging_limit)
+		return highest;
+
+	msgs_queue->aging_count = 0;
+	return __builtin_ctz(mask);
+}
+
+/*
+ * Returns true, if message "a" has to be handled before message "b"
+ * (both with deadline set).
+ */
+static int msg_deadline_before(evm_message_struct *a, evm_message_struct *b)
+{
+	if (a->deadline.tv_sec != b->deadline.tv_sec)
+		return (a->deadline.tv_sec < b->deadline.tv_sec);
+
+	return (a->deadline.tv_nsec < b->deadline.tv_nsec);
+}
+
+/*
+ * Unlink the first message of the priority level (queue locked, level not
+ * empty) - earliest deadline first, then FIFO.
+ */
+static msg_hanger_struct * msg_unlink(msgs_queue_struct *msgs_queue, int prio)
+{
+	struct msgs_level *level = &msgs_queue->levels[prio];
+	msg_hanger_struct *msg_hanger;
+
+	if ((msg_hanger = level->edf_first) != NULL) {
+		level->edf_first = msg_hanger->next;
+		if (level->edf_first == NULL)
+			level->edf_last = NULL;
+		else
+			level->edf_first->prev = NULL;
+	} else {
+		msg_hanger = level->first_hanger;
+		level->first_hanger = msg_hanger->next;
+		if (level->first_hanger == NULL)
+			level->last_hanger = NULL;
+	}
+	if ((level->edf_first == NULL) && (level->first_hanger == NULL))
+		msgs_queue->levels_mask &= ~(1U << prio);
+
+	if (msg_hanger->keyed)
+		msg_key_remove(msgs_queue, msg_hanger);
+
+	msg_sub_leave(msg_hanger);
+
+	return msg_hanger;
+}
+
+/*
+ * Link message hanger into its message's priority level (queue locked).
+ */
+static void msg_link(msgs_queue_struct *msgs_queue, msg_hanger_struct *msg_hanger)
+{
+	evm_message_struct *msg = msg_hanger->msg;
+	struct msgs_level *level = &msgs_queue->levels[msg->prio];
+	msg_hanger_struct *prev;
+
+	if (msg->deadline_set) {
+		/* Sorted insert - deadlines mostly arrive in order, so scan from the tail. */
+		prev = level->edf_last;
+		while ((prev != NULL) && msg_deadline_before(msg, prev->msg))
+			prev = prev->prev;
+		msg_hanger->prev = prev;
+		if (prev == NULL) {
+			msg_hanger->next = level->edf_first;
+			level->edf_first = msg_hanger;
+		} else {
+			msg_hanger->next = prev->next;
+			prev->next = msg_hanger;
+		}
+		if (msg_hanger->next == NULL)
+			level->edf_last = msg_hanger;
+		else
+			msg_hanger->next->prev = msg_hanger;
+	} else {
+		if (level->last_hanger == NULL)
+			level->first_hanger = msg_hanger;
+		else
+			level->last_hanger->next = msg_hanger;
+
+		level->last_hanger = msg_hanger;
+		msg_hanger->next = NULL;
+	}
+	msgs_queue->levels_mask |= (1U << msg->prio);
+}
+
+/*
+ * Remove queued message hanger from its priority level (queue locked).
+ */
+static void msg_level_remove(msgs_queue_struct *msgs_queue, msg_hanger_struct *msg_hanger)
+{
+	evm_message_struct *msg = msg_hanger->msg;
+	struct msgs_level *level = &msgs_queue->levels[msg->prio];
+	msg_hanger_struct **link, *prev = NULL;
+
+	if (msg->deadline_set) {
+		if (msg_hanger->prev == NULL)
+			level->edf_first = msg_hanger->next;
+		else
+			msg_hanger->prev->next = msg_hanger->next;
+		if (msg_hanger->next == NULL)
+			level->edf_last = msg_hanger->prev;
+		else
+			msg_hanger->next->prev = msg_hanger->prev;
+	} else {
+		/* FIFO chain singly linked. */
+		for (link = &level->first_hanger; *link != msg_hanger; link = &(*link)->next)
+			prev = *link;
+		*link = msg_hanger->next;
+		if (level->last_hanger == msg_hanger)
+			level->last_hanger = prev;
+	}
+	msg_hanger->next = NULL;
+	msg_hanger->prev = NULL;
+	if ((level->edf_first == NULL) && (level->first_hanger == NULL))
+		msgs_queue->levels_mask &= ~(1U << msg->prio);
+}
+
+/*
+ * Replace the queued message of the hanger with msg in place (queue
+ * locked): Re-linked, if msg belongs to another priority level (or
+ * deadline position), and accounted to msg's subscription "sub".
+ */
+static void msg_replace(msgs_queue_struct *msgs_queue, msg_hanger_struct *msg_hanger, evm_message_struct *msg, evm_subscription_struct *sub, int conflate)
+{
+	evm_message_struct *old = msg_hanger->msg;
+	int relink;
+
+	relink = (old->prio != msg->prio) || (old->deadline_set != msg->deadline_set) ||
+		(msg->deadline_set && ((old->deadline.tv_sec != msg->deadline.tv_sec) || (old->deadline.tv_nsec != msg->deadline.tv_nsec)));
+	if (relink)
+		msg_level_remove(msgs_queue, msg_hanger);
+	if (msg_hanger->keyed)
+		msg_key_remove(msgs_queue, msg_hanger);
+
+	msg_hanger->msg = msg;
+	if (relink)
+		msg_link(msgs_queue, msg_hanger);
+	if (conflate)
+		msg_key_insert(msgs_queue, msg_hanger);
+
+	if (msg_hanger->sub != sub) {
+		msg_sub_leave(msg_hanger);
+		if (sub != NULL)
+			msg_sub_enter(msg_hanger, sub);
+	} else if (sub != NULL)
+		sub->last_hanger = msg_hanger;
+}
+
+/*
+ * Account queued message hanger to the topic subscription (queue locked).
+ */
+static void msg_sub_enter(msg_hanger_struct *msg_hanger, evm_subscription_struct *sub)
+{
+	msg_hanger->sub = sub;
+	sub->last_hanger = msg_hanger;
+	sub->stats.posted++;
+	if (++sub->stats.lag > sub->stats.max_lag)
+		sub->stats.max_lag = sub->stats.lag;
+}
+
+/*
+ * Release subscription of the message hanger no longer queued for it
+ * (queue locked) - freed, if unsubscribed and none of its messages queued.
+ */
+static void msg_sub_leave(msg_hanger_struct *msg_hanger)
+{
+	evm_subscription_struct *sub;
+
+	if ((sub = msg_hanger->sub) == NULL)
+		return;
+
+	sub->stats.lag--;
+	if (sub->last_hanger == msg_hanger)
+		sub->last_hanger = NULL;
+	if (!sub->linked && (sub->stats.lag == 0))
+		free(sub);
+	msg_hanger->sub = NULL;
+}
+
+/*
+ * Take the next message from the consumer's queue (semaphore already taken).
+ */
+static evm_message_struct * msg_take(evm_consumer_struct *consumer)
+{
+	int below = EVM_FALSE;
+	evm_message_struct *msg;
+	msgs_queue_struct *msgs_queue = consumer->msgs_queue;
+	msg_hanger_struct *msg_hanger;
+	int (*watermark)(evm_consumer_struct *consumer, int above);
+	pthread_mutex_t *amtx = &msgs_queue->access_mutex;
+
 	pthread_mutex_lock(amtx);
-	msg_hanger = msgs_queue->first_hanger;
-	if (msg_hanger == NULL) {
+	if (msgs_queue->levels_mask == 0) {
 		pthread_mutex_unlock(amtx);
 		return NULL;
 	}
 
-	if (msg_hanger->next == NULL) {
-		msgs_queue->first_hanger = NULL;
-		msgs_queue->last_hanger = NULL;
-	} else
-		msgs_queue->first_hanger = msg_hanger->next;
+	msg_hanger = msg_unlink(msgs_queue, msg_level_select(msgs_queue));
+	msgs_queue->depth--;
+	msgs_queue->stats.dequeued++;
+	if (msgs_queue->capacity != 0)
+		pthread_cond_signal(&msgs_queue->space_cond);
+	if (msgs_queue->above_wm && (msgs_queue->depth <= msgs_queue->low_wm)) {
+		msgs_queue->above_wm = EVM_FALSE;
+		below = EVM_TRUE;
+	}
+	watermark = msgs_queue->watermark;
 
 	msg = msg_hanger->msg;
 	free(msg_hanger);
 	msg_hanger = NULL;
 	pthread_mutex_unlock(amtx);
+
+	if (below && (watermark != NULL))
+		watermark(consumer, EVM_FALSE);
+
 	return msg;
 }
 
@@ -185,6 +631,205 @@ evm_message_struct * messages_check(evm_consumer_struct *consumer, const struct
 	return msg_dequeue(consumer, ts);
 }
 
+/*
+ * Non-blocking message check:
+ * Returns the first queued message or NULL, if none pending.
+ */
+evm_message_struct * messages_try(evm_consumer_struct *consumer)
+{
+	u2up_log_info("(entry)\n");
+
+	if ((consumer == NULL) || (consumer->msgs_queue == NULL))
+		return NULL;
+
+	if (sem_trywait(&consumer->blocking_sem) != 0)
+		return NULL;
+
+	return msg_take(consumer);
+}
+
+/*
+ * Returns true, if any message is waiting in the consumer's queue.
+ */
+int messages_pending(evm_consumer_struct *consumer)
+{
+	int pending;
+
+	if ((consumer == NULL) || (consumer->msgs_queue == NULL))
+		return EVM_FALSE;
+
+	pthread_mutex_lock(&consumer->msgs_queue->access_mutex);
+	pending = (consumer->msgs_queue->levels_mask != 0);
+	pthread_mutex_unlock(&consumer->msgs_queue->access_mutex);
+
+	return pending;
+}
+
+/*
+ * Returns current depth of the consumer's queue (sampled without locking).
+ */
+int messages_depth(evm_consumer_struct *consumer)
+{
+	if ((consumer == NULL) || (consumer->msgs_queue == NULL))
+		return 0;
+
+	return consumer->msgs_queue->depth;
+}
+
+/*
+ * Release topic's link to the subscription (already removed from the
+ * topic's consumers_list) - freed, when none of its messages queued.
+ */
+void messages_subscription_unlink(evm_subscription_struct *sub)
+{
+	pthread_mutex_t *amtx;
+
+	if (sub->consumer == NULL) {
+		/* Group subscription - messages not tracked. */
+		free(sub);
+		return;
+	}
+
+	amtx = &sub->consumer->msgs_queue->access_mutex;
+	pthread_mutex_lock(amtx);
+	sub->linked = EVM_FALSE;
+	if (sub->stats.lag == 0)
+		free(sub);
+	pthread_mutex_unlock(amtx);
+}
+
+/*
+ * Public API function:
+ * - evm_consumer_msgs_aging_set()
+ */
+int evm_consumer_msgs_aging_set(evmConsumerStruct *consumer, int aging_limit)
+{
+	u2up_log_info("(entry)\n");
+
+	if ((consumer == NULL) || (consumer->msgs_queue == NULL))
+		return -1;
+
+	if (aging_limit < 0)
+		return -1;
+
+	pthread_mutex_lock(&consumer->msgs_queue->access_mutex);
+	consumer->msgs_queue->aging_limit = aging_limit;
+	consumer->msgs_queue->aging_count = 0;
+	pthread_mutex_unlock(&consumer->msgs_queue->access_mutex);
+	return 0;
+}
+
+/*
+ * Public API functions:
+ * - evm_consumer_conflate_set()
+ * - evm_topic_conflate_set()
+ */
+int evm_consumer_conflate_set(evmConsumerStruct *consumer, int conflate)
+{
+	u2up_log_info("(entry)\n");
+
+	if ((consumer == NULL) || (consumer->msgs_queue == NULL))
+		return -1;
+
+	pthread_mutex_lock(&consumer->msgs_queue->access_mutex);
+	consumer->msgs_queue->conflate = (conflate != 0);
+	pthread_mutex_unlock(&consumer->msgs_queue->access_mutex);
+	return 0;
+}
+
+int evm_topic_conflate_set(evmTopicStruct *topic, int conflate)
+{
+	u2up_log_info("(entry)\n");
+
+	if (topic == NULL)
+		return -1;
+
+	pthread_mutex_lock(&topic->consumers_list->access_mutex);
+	topic->conflate = (conflate != 0);
+	pthread_mutex_unlock(&topic->consumers_list->access_mutex);
+	return 0;
+}
+
+/*
+ * Public API functions:
+ * - evm_consumer_queue_limit_set()
+ * - evm_consumer_queue_watermarks_set()
+ * - evm_consumer_queue_stats_get()
+ */
+int evm_consumer_queue_limit_set(evmConsumerStruct *consumer, int capacity, int overflow, const struct timespec *timeout)
+{
+	msgs_queue_struct *msgs_queue;
+	u2up_log_info("(entry)\n");
+
+	if ((consumer == NULL) || (consumer->msgs_queue == NULL))
+		return -1;
+
+	if (capacity < 0)
+		return -1;
+
+	switch (overflow) {
+	case EVM_QUEUE_OVERFLOW_FAIL:
+	case EVM_QUEUE_OVERFLOW_BLOCK:
+	case EVM_QUEUE_OVERFLOW_DROP_OLDEST:
+	case EVM_QUEUE_OVERFLOW_DROP_NEWEST:
+		break;
+	default:
+		return -1;
+	}
+
+	if ((timeout != NULL) && ((timeout->tv_sec < 0) || (timeout->tv_nsec < 0) || (timeout->tv_nsec >= 1000000000)))
+		return -1;
+
+	msgs_queue = consumer->msgs_queue;
+	pthread_mutex_lock(&msgs_queue->access_mutex);
+	msgs_queue->capacity = capacity;
+	msgs_queue->overflow = overflow;
+	if (timeout != NULL) {
+		msgs_queue->block_timeout = *timeout;
+		msgs_queue->block_timeout_set = EVM_TRUE;
+	} else
+		msgs_queue->block_timeout_set = EVM_FALSE;
+	/* Let blocked producers re-check the new limit. */
+	pthread_cond_broadcast(&msgs_queue->space_cond);
+	pthread_mutex_unlock(&msgs_queue->access_mutex);
+	return 0;
+}
+
+int evm_consumer_queue_watermarks_set(evmConsumerStruct *consumer, int high_wm, int low_wm, int (*watermark)(evmConsumerStruct *consumer, int above))
+{
+	msgs_queue_struct *msgs_queue;
+	u2up_log_info("(entry)\n");
+
+	if ((consumer == NULL) || (consumer->msgs_queue == NULL))
+		return -1;
+
+	if ((high_wm < 0) || (low_wm < 0) || ((high_wm != 0) && (low_wm >= high_wm)))
+		return -1;
+
+	msgs_queue = consumer->msgs_queue;
+	pthread_mutex_lock(&msgs_queue->access_mutex);
+	msgs_queue->high_wm = high_wm;
+	msgs_queue->low_wm = low_wm;
+	msgs_queue->watermark = watermark;
+	msgs_queue->above_wm = EVM_FALSE;
+	pthread_mutex_unlock(&msgs_queue->access_mutex);
+	return 0;
+}
+
+int evm_consumer_queue_stats_get(evmConsumerStruct *consumer, evmQueueStatsStruct *stats)
+{
+	u2up_log_info("(entry)\n");
+
+	if ((consumer == NULL) || (consumer->msgs_queue == NULL) || (stats == NULL))
+		return -1;
+
+	pthread_mutex_lock(&consumer->msgs_queue->access_mutex);
+	*stats = consumer->msgs_queue->stats;
+	stats->depth = consumer->msgs_queue->depth;
+	pthread_mutex_unlock(&consumer->msgs_queue->access_mutex);
+	return 0;
+}
+
 /*
  * Public API functions:
  * - evm_message_pass()
@@ -192,17 +837,43 @@ evm_message_struct * messages_check(evm_consumer_struct *consumer, const struct
  */
 int evm_message_pass(evmConsumerStruct *consumer, evmMessageStruct *msg)
 {
+	int rv;
 	u2up_log_info("(entry) consumer=%p, msg=%p\n", consumer, msg);
 
 	if ((consumer != NULL) && (msg != NULL)) {
+		if (consumer->shm != NULL)
+			return shm_pass(consumer, msg);
+		/* Never blocks on its own queue (would never get drained). */
+		if ((rv = messages_pass(consumer, msg, consumer != evm_consumer_running)) == -EAGAIN)
+			errno = EAGAIN;
+		return (rv == 0) ? 0 : -1;
+	}
+	return -1;
+}
+
+int messages_pass(evm_consumer_struct *consumer, evm_message_struct *msg, int wait)
+{
+	int erv;
+	msg_hanger_struct *dropped;
+	u2up_log_info("(entry) consumer=%p, msg=%p, wait=%d\n", consumer, msg, wait);
+
+	if ((consumer != NULL) && (msg != NULL)) {
+		/* Account the consumer in advance - enqueuing may block (full queue). */
 		pthread_mutex_lock(&msg->amtx);
-		if (msg_enqueue(consumer, msg) != 0) {
-			u2up_log_error("Message enqueuing failed!\n");
-			pthread_mutex_unlock(&msg->amtx);
-			return -1;
-		}
 		msg->consumers++;
 		pthread_mutex_unlock(&msg->amtx);
+		if ((erv = msg_enqueue(consumer, msg, NULL, &dropped, wait)) != 0) {
+			if (erv == -EAGAIN) {
+				u2up_log_debug("Consumer queue full - message rejected!\n");
+			} else {
+				u2up_log_error("Message enqueuing failed!\n");
+			}
+			pthread_mutex_lock(&msg->amtx);
+			msg->consumers--;
+			pthread_mutex_unlock(&msg->amtx);
+			return erv;
+		}
+		msg_dropped(dropped);
 		return 0;
 	}
 	return -1;
@@ -210,30 +881,107 @@ int evm_message_pass(evmConsumerStruct *consumer, evmMessageStruct *msg)
 
 int evm_message_post(evmTopicStruct *topic, evmMessageStruct *msg)
 {
-	int rv = 0;
+	int rv = 0, erv;
+	int enqueued = 0, forwarded = 0;
+	int w, row;
+	unsigned long long *bits, word;
 	evmlist_el_struct *tmp;
 	evmConsumerStruct *consumer;
+	evm_subscription_struct *sub, *gone = NULL;
+	msg_hanger_struct *dropped;
 	u2up_log_info("(entry) topic=%p, msg=%p\n", topic, msg);
 
 	if ((topic != NULL) && (msg != NULL)) {
 		pthread_mutex_lock(&topic->consumers_list->access_mutex);
-		pthread_mutex_lock(&msg->amtx);
-		for (
-			tmp = topic->consumers_list->first;
-			tmp != NULL;
-			tmp = tmp->next
-		) {
-			consumer = (evm_consumer_struct *)tmp->el;
-			if (msg_enqueue(consumer, msg) != 0) {
-				u2up_log_error("Message enqueuing failed!\n");
-				rv++;
+		if ((topic->filters == NULL) || topic->filters_dirty) {
+			if (filters_index_build(topic) != 0) {
+				pthread_mutex_unlock(&topic->consumers_list->access_mutex);
+				u2up_log_error("Filters index build failed!\n");
+				return -1;
 			}
-			msg->consumers++;
 		}
+		/* Hold an extra reference, while the message is being enqueued. */
+		pthread_mutex_lock(&msg->amtx);
+		msg->consumers++;
 		pthread_mutex_unlock(&msg->amtx);
+		topic->posts++;
+		/* Filtered out subscriptions never touched (see evm_topic_lag_stats_get()). */
+		bits = filters_index_match(topic->filters, msg);
+		for (w = 0; w < topic->filters->words; w++) {
+			word = bits[w];
+			while (word != 0) {
+				row = (w << 6) + __builtin_ctzll(word);
+				word &= word - 1;
+				tmp = topic->filters->rows[row];
+				sub = (evm_subscription_struct *)tmp->el;
+				sub->matched++;
+				consumer = sub->consumer;
+				if (sub->group != NULL) {
+					/* Group subscription - delivered to one of its members. */
+					if ((consumer = groups_member_select(sub->group)) == NULL) {
+						u2up_log_debug("Group without members!\n");
+						continue;
+					}
+					sub = NULL;
+				}
+				pthread_mutex_lock(&msg->amtx);
+				msg->consumers++;
+				pthread_mutex_unlock(&msg->amtx);
+				/* Never waits for space with the topic locked. */
+				if ((erv = msg_enqueue(consumer, msg, sub, &dropped, EVM_FALSE)) != 0) {
+					pthread_mutex_lock(&msg->amtx);
+					msg->consumers--;
+					pthread_mutex_unlock(&msg->amtx);
+					if (erv > 0) {
+						/* Lagging subscriber - unsubscribe (notify after unlocking). */
+						u2up_log_debug("Subscriber lag limit exceeded - unsubscribed!\n");
+						if (tmp->prev != NULL)
+							tmp->prev->next = tmp->next;
+						else
+							topic->consumers_list->first = tmp->next;
+						if (tmp->next != NULL)
+							tmp->next->prev = tmp->prev;
+						free(tmp);
+						topic->filters_dirty = EVM_TRUE;
+						sub->gone_next = gone;
+						gone = sub;
+						continue;
+					}
+					if (erv == -EAGAIN) {
+						u2up_log_debug("Consumer queue full - message rejected!\n");
+						errno = EAGAIN;
+					} else {
+						u2up_log_error("Message enqueuing failed!\n");
+					}
+					rv++;
+					continue;
+				}
+				msg_dropped(dropped);
+				enqueued++;
+			}
+		}
+		/* Peers subscribed over bridges. */
+		if (topic->bridges_num > 0)
+			rv += bridges_forward(topic, msg, &forwarded);
 		pthread_mutex_unlock(&topic->consumers_list->access_mutex);
+		if ((enqueued > 0) || (forwarded > 0))
+			evm_message_delete(msg);
+		else {
+			/* Not taken over - still owned by the caller. */
+			pthread_mutex_lock(&msg->amtx);
+			msg->consumers--;
+			pthread_mutex_unlock(&msg->amtx);
+			rv = -1;
+		}
+		while ((sub = gone) != NULL) {
+			gone = sub->gone_next;
+			if (sub->lagged != NULL)
+				sub->lagged(sub->consumer, topic);
+			messages_subscription_unlink(sub);
+		}
+		return rv;
 	}
-	return rv;
+	return -1;
 }
 
 /*
@@ -366,6 +1114,24 @@ int evm_msgtype_cb_parse_set(evmMsgtypeStruct *msgtype, int (*msgtype_parse)(voi
 	return rv;
 }
 
+/*
+ * Public API function:
+ * - evm_msgtype_prio_set()
+ */
+int evm_msgtype_prio_set(evmMsgtypeStruct *msgtype, int prio)
+{
+	u2up_log_info("(entry)\n");
+
+	if (msgtype == NULL)
+		return -1;
+
+	if ((prio < 0) || (prio >= EVM_MSG_PRIO_LEVELS))
+		return -1;
+
+	msgtype->prio = prio;
+	return 0;
+}
+
 /*
  * Public API functions:
  * - evm_msgid_add()
@@ -468,6 +1234,7 @@ evmMsgidStruct * evm_msgid_del(evmMsgtypeStruct *msgtype, int id)
 /*
  * Public API functions:
  * - evm_msgid_cb_handle_set()
+ * - evm_msgid_cb_expire_set()
  */
 int evm_msgid_cb_handle_set(evmMsgidStruct *msgid, int (*msg_handle)(evmConsumerStruct *consumer, evmMessageStruct *msg))
 {
@@ -486,12 +1253,112 @@ int evm_msgid_cb_handle_set(evmMsgidStruct *msgid, int (*msg_handle)(evmConsumer
 	return rv;
 }
 
+int evm_msgid_cb_expire_set(evmMsgidStruct *msgid, int (*msg_expire)(evmConsumerStruct *consumer, evmMessageStruct *msg))
+{
+	u2up_log_info("(entry)\n");
+
+	if (msgid == NULL)
+		return -1;
+
+	msgid->msg_expire = msg_expire;
+	return 0;
+}
+
+/*
+ * Public API functions:
+ * - evm_msgtype_route_set()
+ * - evm_msgid_route_set()
+ * - evm_message_send()
+ */
+static int msg_route_check(int route, void *dest)
+{
+	switch (route) {
+	case EVM_ROUTE_NONE:
+		return (dest == NULL) ? 0 : -1;
+	case EVM_ROUTE_CONSUMER:
+	case EVM_ROUTE_TOPIC:
+	case EVM_ROUTE_GROUP:
+	case EVM_ROUTE_SHARD:
+		return (dest != NULL) ? 0 : -1;
+	default:
+		return -1;
+	}
+}
+
+int evm_msgtype_route_set(evmMsgtypeStruct *msgtype, int route, void *dest)
+{
+	u2up_log_info("(entry)\n");
+
+	if (msgtype == NULL)
+		return -1;
+
+	if (msg_route_check(route, dest) != 0)
+		return -1;
+
+	msgtype->route = route;
+	msgtype->route_dest = dest;
+	return 0;
+}
+
+int evm_msgid_route_set(evmMsgidStruct *msgid, int route, void *dest)
+{
+	u2up_log_info("(entry)\n");
+
+	if (msgid == NULL)
+		return -1;
+
+	if (msg_route_check(route, dest) != 0)
+		return -1;
+
+	msgid->route = route;
+	msgid->route_dest = dest;
+	return 0;
+}
+
+int evm_message_send(evmMessageStruct *msg)
+{
+	int route = EVM_ROUTE_NONE;
+	void *dest = NULL;
+	u2up_log_info("(entry) msg=%p\n", msg);
+
+	if (msg == NULL)
+		return -1;
+
+	if ((msg->msgid != NULL) && (msg->msgid->route != EVM_ROUTE_NONE)) {
+		route = msg->msgid->route;
+		dest = msg->msgid->route_dest;
+	} else if (msg->msgtype != NULL) {
+		route = msg->msgtype->route;
+		dest = msg->msgtype->route_dest;
+	}
+
+	switch (route) {
+	case EVM_ROUTE_CONSUMER:
+		return evm_message_pass((evm_consumer_struct *)dest, msg);
+	case EVM_ROUTE_TOPIC:
+		return evm_message_post((evm_topic_struct *)dest, msg);
+	case EVM_ROUTE_GROUP:
+		return evm_message_group_pass((evm_group_struct *)dest, msg);
+	case EVM_ROUTE_SHARD:
+		return evm_message_shard_pass((evm_router_struct *)dest, msg);
+	default:
+		u2up_log_debug("Message without route!\n");
+		return -1;
+	}
+}
+
 /*
  * Public API functions:
  * - evm_message_new()
  * - evm_message_delete()
  * - evm_message_alloc_add()
  * - evm_message_persistent_set()
+ * - evm_message_prio_set()
+ * - evm_message_deadline_set()
+ * - evm_message_key_set()
+ * - evm_message_msgid_set()
+ * - evm_message_field_set()
+ * - evm_message_field_get()
  * - evm_message_ctx_set()
  * - evm_message_ctx_get()
  * - evm_message_data_get()
@@ -518,15 +1385,19 @@ evmMessageStruct * evm_message_new(evmMsgtypeStruct *msgtype, evmMsgidStruct *ms
 	pthread_mutex_unlock(&msg->allocs_list->access_mutex);
 	msg->msgtype = msgtype;
 	msg->msgid = msgid;
+	if (msgtype != NULL)
+		msg->prio = msgtype->prio;
 	pthread_mutex_init(&msg->amtx, NULL);
 	pthread_mutex_unlock(&msg->amtx);
-	if (size > 0)
+	if (size > 0) {
 		if ((msg->data = malloc(size)) == NULL) {
 			errno = ENOMEM;
 			u2up_log_system_error("malloc(): data\n");
 			free(msg);
 			msg = NULL;
-		}
+		} else
+			msg->size = size;
+	}
 
 	return msg;
 }
@@ -543,6 +1414,8 @@ void evm_message_delete(evmMessageStruct *msg)
 		if (msg->consumers != 0) {
 			pthread_mutex_unlock(&msg->amtx);
 		} else {
+			if (msg->release != NULL)
+				msg->release(msg->release_ctx);
 			if (msg->data != NULL) {
 				free(msg->data);
 				msg->data = NULL;
@@ -611,6 +1484,107 @@ int evm_message_persistent_set(evmMessageStruct *msg)
 	return 0;
 }
 
+int evm_message_prio_set(evmMessageStruct *msg, int prio)
+{
+	u2up_log_info("(entry)\n");
+
+	if (msg == NULL)
+		return -1;
+
+	if ((prio < 0) || (prio >= EVM_MSG_PRIO_LEVELS))
+		return -1;
+
+	pthread_mutex_lock(&msg->amtx);
+	msg->prio = prio;
+	pthread_mutex_unlock(&msg->amtx);
+	return 0;
+}
+
+int evm_message_deadline_set(evmMessageStruct *msg, const struct timespec *ts)
+{
+	u2up_log_info("(entry)\n");
+
+	if (msg == NULL)
+		return -1;
+
+	if ((ts != NULL) && ((ts->tv_nsec < 0) || (ts->tv_nsec >= 1000000000)))
+		return -1;
+
+	pthread_mutex_lock(&msg->amtx);
+	if (ts != NULL) {
+		msg->deadline = *ts;
+		msg->deadline_set = EVM_TRUE;
+	} else
+		msg->deadline_set = EVM_FALSE;
+	pthread_mutex_unlock(&msg->amtx);
+	return 0;
+}
+
+int evm_message_key_set(evmMessageStruct *msg, unsigned long key)
+{
+	u2up_log_info("(entry)\n");
+
+	if (msg == NULL)
+		return -1;
+
+	pthread_mutex_lock(&msg->amtx);
+	msg->key = key;
+	msg->key_set = EVM_TRUE;
+	pthread_mutex_unlock(&msg->amtx);
+	return 0;
+}
+
+int evm_message_msgid_set(evmMessageStruct *msg, evmMsgidStruct *msgid)
+{
+	u2up_log_info("(entry)\n");
+
+	if ((msg == NULL) || (msgid == NULL))
+		return -1;
+
+	if (msgid->msgtype != msg->msgtype)
+		return -1;
+
+	msg->msgid = msgid;
+	return 0;
+}
+
+int evm_message_field_set(evmMessageStruct *msg, int field, long long value)
+{
+	u2up_log_info("(entry)\n");
+
+	if (msg == NULL)
+		return -1;
+
+	if ((field < 0) || (field >= EVM_MSG_FIELDS))
+		return -1;
+
+	pthread_mutex_lock(&msg->amtx);
+	msg->fields[field] = value;
+	msg->fields_set |= (1 << field);
+	pthread_mutex_unlock(&msg->amtx);
+	return 0;
+}
+
+int evm_message_field_get(evmMessageStruct *msg, int field, long long *value)
+{
+	int rv = -1;
+	u2up_log_info("(entry)\n");
+
+	if ((msg == NULL) || (value == NULL))
+		return -1;
+
+	if ((field < 0) || (field >= EVM_MSG_FIELDS))
+		return -1;
+
+	pthread_mutex_lock(&msg->amtx);
+	if (msg->fields_set & (1 << field)) {
+		*value = msg->fields[field];
+		rv = 0;
+	}
+	pthread_mutex_unlock(&msg->amtx);
+	return rv;
+}
+
 int evm_message_ctx_set(evmMessageStruct *msg, void *ctx)
 {
 	u2up_log_info("(entry)\n");
@@ -655,6 +1629,7 @@ void * evm_message_data_takeover(evmMessageStruct *msg)
 
 	ptr = msg->data;
 	msg->data = NULL;
+	msg->size = 0;
 
 	return ptr;
 }
@@ -34,9 +34,33 @@
 
 typedef struct msg_hanger msg_hanger_struct;
 
-struct msgs_queue {
-	msg_hanger_struct *first_hanger;
+struct msgs_level {
+	msg_hanger_struct *edf_first; /*messages with deadline - earliest first*/
+	msg_hanger_struct *edf_last;
+	msg_hanger_struct *first_hanger; /*messages without deadline - FIFO*/
 	msg_hanger_struct *last_hanger;
+}; /*msgs_level_struct*/
+
+struct msgs_queue {
+	struct msgs_level levels[EVM_MSG_PRIO_LEVELS]; /*FIFO per priority level*/
+	unsigned int levels_mask; /*bitmap of non-empty priority levels*/
+	int aging_limit; /*lower levels bypassed in a row before served (0 - no aging)*/
+	int aging_count;
+	int depth; /*messages currently queued*/
+	int capacity; /*max queued messages (0 - unlimited)*/
+	int overflow; /*overflow policy (EVM_QUEUE_OVERFLOW_...)*/
+	int block_timeout_set;
+	struct timespec block_timeout; /*max producer blocking time (relative)*/
+	pthread_cond_t space_cond; /*signalled on dequeue (blocked producers)*/
+	int high_wm; /*high watermark (0 - no watermarks)*/
+	int low_wm; /*low watermark*/
+	int above_wm; /*high watermark reached and low one not yet*/
+	int (*watermark)(evm_consumer_struct *consumer, int above);
+	int conflate; /*keyed messages enqueued in last-value conflation mode*/
+	msg_hanger_struct **keys; /*hash index of queued keyed messages (msgid, key)*/
+	unsigned int keys_size; /*power of 2*/
+	unsigned int keys_count;
+	evmQueueStatsStruct stats;
 	pthread_mutex_t access_mutex;
 }; /*msgs_queue_struct*/
 
@@ -44,10 +68,27 @@ struct msg_hanger {
 	msg_hanger_struct *next;
 	msg_hanger_struct *prev;
 	evm_message_struct *msg; /*hangs of a hanger when linked in a chain - i.e.: in a message queue*/
+	evm_subscription_struct *sub; /*topic subscription, if posted*/
+	int keyed; /*in queue's keys index*/
+	msg_hanger_struct *key_next; /*keys index bucket chain*/
 }; /*msg_hanger_struct*/
 
 EXTERN msgs_queue_struct * messages_consumer_queue_init(evm_consumer_struct *consumer_ptr);
 EXTERN msgs_queue_struct * messages_topic_queue_init(evm_topic_struct *topic_ptr);
 EXTERN evm_message_struct * messages_check(evm_consumer_struct *consumer_ptr, const struct timespec *ts);
+EXTERN evm_message_struct * messages_try(evm_consumer_struct *consumer_ptr);
+EXTERN int messages_pending(evm_consumer_struct *consumer_ptr);
+EXTERN int messages_depth(evm_consumer_struct *consumer_ptr);
+EXTERN void messages_subscription_unlink(evm_subscription_struct *sub_ptr);
+
+/*
+ * Pass message to the local consumer's queue (see evm_message_pass()),
+ * waiting for space with the BLOCK overflow policy only if "wait" set.
+ * Returns:
+ * - -EAGAIN, if rejected due to full queue
+ * - -1 on other failure
+ * - 0 on success
+ */
+EXTERN int messages_pass(evm_consumer_struct *consumer_ptr, evm_message_struct *msg_ptr, int wait);
 
 #endif /*EVM_FILE_messages_h*/
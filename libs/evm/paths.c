@@ -0,0 +1,521 @@
+/*
+ * The EVM paths module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_paths_c
+#define EVM_FILE_paths_c
+#else
+#error Preprocesor macro EVM_FILE_paths_c conflict!
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <semaphore.h>
+#include <pthread.h>
+
+#include "evm/libevm.h"
+
+#include "evm.h"
+#include "messages.h"
+#include "paths.h"
+
+#define U2UP_LOG_NAME EVM_PATH
+#include <u2up-log/u2up-log.h>
+
+/* Initial (power of 2) size of node's children hash */
+#define EVM_PATHS_CHILDREN 4
+
+/* Path level (not zero terminated within the path string) */
+struct path_level {
+	const char *name;
+	size_t len;
+};
+
+static int path_split(const char *path, struct path_level *levels, int wildcards);
+static int path_is(const struct path_level *level, const char *name);
+static unsigned int path_hash(const char *name, size_t len);
+static paths_node_struct * path_node_new(paths_node_struct *parent, const char *name, size_t len);
+static paths_node_struct * path_child_find(paths_node_struct *node, const struct path_level *level);
+static paths_node_struct * path_child_add(paths_node_struct *node, const struct path_level *level);
+static paths_node_struct * path_node_lookup(paths_node_struct *root, const struct path_level *levels, int depth);
+static paths_node_struct * path_node_create(paths_node_struct **root, const struct path_level *levels, int depth);
+static void path_node_prune(paths_node_struct *node);
+static void path_topics_subscribe(paths_node_struct *node, const struct path_level *levels, int depth, int level, evm_consumer_struct *consumer, int subscribe);
+static void path_subtree_subscribe(paths_node_struct *node, evm_consumer_struct *consumer, int subscribe);
+static void path_topic_subscribe(evm_topic_struct *topic, evm_consumer_struct *consumer, int subscribe);
+static void path_patterns_resolve(paths_node_struct *node, const struct path_level *levels, int depth, int level, evm_topic_struct *topic);
+static void path_consumers_subscribe(paths_node_struct *node, evm_topic_struct *topic);
+
+/*
+ * Split "/" separated path into levels (without empty levels). Wildcard
+ * levels ("*" - any single level, "**" - any number of levels) allowed
+ * in subscription patterns only ("**" as the last level).
+ * Returns:
+ * - number of levels
+ * - -1, if invalid path
+ */
+static int path_split(const char *path, struct path_level *levels, int wildcards)
+{
+	int depth = 0;
+	const char *end;
+
+	if ((path == NULL) || (*path == '\0'))
+		return -1;
+
+	while (EVM_TRUE) {
+		if (depth == EVM_TOPIC_PATH_DEPTH)
+			return -1;
+		if ((end = strchr(path, '/')) == NULL)
+			end = path + strlen(path);
+		if (end == path)
+			return -1;
+		levels[depth].name = path;
+		levels[depth].len = end - path;
+		if (path_is(&levels[depth], "*") || path_is(&levels[depth], "**")) {
+			if (!wildcards)
+				return -1;
+			if (path_is(&levels[depth], "**") && (*end != '\0'))
+				return -1;
+		}
+		depth++;
+		if (*end == '\0')
+			break;
+		path = end + 1;
+	}
+
+	return depth;
+}
+
+static int path_is(const struct path_level *level, const char *name)
+{
+	return ((strncmp(level->name, name, level->len) == 0) && (name[level->len] == '\0'));
+}
+
+/*
+ * FNV-1a hash of the path level name.
+ */
+static unsigned int path_hash(const char *name, size_t len)
+{
+	unsigned int hash = 2166136261U;
+
+	while (len-- > 0) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static paths_node_struct * path_node_new(paths_node_struct *parent, const char *name, size_t len)
+{
+	paths_node_struct *node;
+
+	if ((node = (paths_node_struct *)calloc(1, sizeof(paths_node_struct))) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("calloc(): paths node\n");
+		return NULL;
+	}
+	if ((node->name = (char *)calloc(len + 1, sizeof(char))) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("calloc(): paths node name\n");
+		free(node);
+		return NULL;
+	}
+	memcpy(node->name, name, len);
+	node->parent = parent;
+	return node;
+}
+
+static paths_node_struct * path_child_find(paths_node_struct *node, const struct path_level *level)
+{
+	paths_node_struct *child;
+
+	if (node->children_num == 0)
+		return NULL;
+
+	child = node->children[path_hash(level->name, level->len) & (node->children_size - 1)];
+	while (child != NULL) {
+		if (path_is(level, child->name))
+			break;
+		child = child->next;
+	}
+	return child;
+}
+
+static paths_node_struct * path_child_add(paths_node_struct *node, const struct path_level *level)
+{
+	unsigned int i, size, bucket;
+	paths_node_struct *child, *next, **children;
+
+	if ((child = path_child_find(node, level)) != NULL)
+		return child;
+
+	if (node->children_num >= node->children_size) {
+		/* Grow children hash (rehash). */
+		size = (node->children_size == 0) ? EVM_PATHS_CHILDREN : (node->children_size << 1);
+		if ((children = (paths_node_struct **)calloc(size, sizeof(paths_node_struct *))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): paths node children\n");
+			return NULL;
+		}
+		for (i = 0; i < node->children_size; i++) {
+			for (child = node->children[i]; child != NULL; child = next) {
+				next = child->next;
+				bucket = path_hash(child->name, strlen(child->name)) & (size - 1);
+				child->next = children[bucket];
+				children[bucket] = child;
+			}
+		}
+		free(node->children);
+		node->children = children;
+		node->children_size = size;
+	}
+
+	if ((child = path_node_new(node, level->name, level->len)) == NULL)
+		return NULL;
+
+	bucket = path_hash(level->name, level->len) & (node->children_size - 1);
+	child->next = node->children[bucket];
+	node->children[bucket] = child;
+	node->children_num++;
+	return child;
+}
+
+static paths_node_struct * path_node_lookup(paths_node_struct *root, const struct path_level *levels, int depth)
+{
+	int i;
+	paths_node_struct *node = root;
+
+	for (i = 0; (node != NULL) && (i < depth); i++)
+		node = path_child_find(node, &levels[i]);
+
+	return node;
+}
+
+static paths_node_struct * path_node_create(paths_node_struct **root, const struct path_level *levels, int depth)
+{
+	int i;
+	paths_node_struct *node, *child;
+
+	if (*root == NULL) {
+		if ((*root = path_node_new(NULL, "", 0)) == NULL)
+			return NULL;
+	}
+
+	for (i = 0, node = *root; i < depth; i++, node = child) {
+		if ((child = path_child_add(node, &levels[i])) == NULL) {
+			path_node_prune(node);
+			return NULL;
+		}
+	}
+	return node;
+}
+
+/*
+ * Free unused nodes (without topic, consumers and children) up the trie.
+ */
+static void path_node_prune(paths_node_struct *node)
+{
+	paths_node_struct *parent, **prev;
+
+	while ((parent = node->parent) != NULL) {
+		if ((node->topic != NULL) || (node->consumers_num > 0) || (node->children_num > 0))
+			break;
+		prev = &parent->children[path_hash(node->name, strlen(node->name)) & (parent->children_size - 1)];
+		while (*prev != node)
+			prev = &(*prev)->next;
+		*prev = node->next;
+		parent->children_num--;
+		free(node->children);
+		free(node->consumers);
+		free(node->name);
+		free(node);
+		node = parent;
+	}
+}
+
+/*
+ * Subscribe (unsubscribe) consumer to all topics matching the pattern.
+ */
+static void path_topics_subscribe(paths_node_struct *node, const struct path_level *levels, int depth, int level, evm_consumer_struct *consumer, int subscribe)
+{
+	unsigned int i;
+	paths_node_struct *child;
+
+	if (level == depth) {
+		if (node->topic != NULL)
+			path_topic_subscribe(node->topic, consumer, subscribe);
+		return;
+	}
+
+	if (path_is(&levels[level], "**")) {
+		path_subtree_subscribe(node, consumer, subscribe);
+	} else if (path_is(&levels[level], "*")) {
+		for (i = 0; i < node->children_size; i++) {
+			for (child = node->children[i]; child != NULL; child = child->next)
+				path_topics_subscribe(child, levels, depth, level + 1, consumer, subscribe);
+		}
+	} else if ((child = path_child_find(node, &levels[level])) != NULL)
+		path_topics_subscribe(child, levels, depth, level + 1, consumer, subscribe);
+}
+
+/*
+ * Subscribe (unsubscribe) consumer to all topics of the subtree ("**").
+ */
+static void path_subtree_subscribe(paths_node_struct *node, evm_consumer_struct *consumer, int subscribe)
+{
+	unsigned int i;
+	paths_node_struct *child;
+
+	if (node->topic != NULL)
+		path_topic_subscribe(node->topic, consumer, subscribe);
+
+	for (i = 0; i < node->children_size; i++) {
+		for (child = node->children[i]; child != NULL; child = child->next)
+			path_subtree_subscribe(child, consumer, subscribe);
+	}
+}
+
+static void path_topic_subscribe(evm_topic_struct *topic, evm_consumer_struct *consumer, int subscribe)
+{
+	if (subscribe) {
+		if (evm_topic_path_subscriber_add(topic, consumer) != 0)
+			u2up_log_error("Path subscription failed (topic id=%d)!\n", topic->id);
+	} else
+		evm_topic_path_subscriber_del(topic, consumer);
+}
+
+/*
+ * Subscribe consumers of all patterns matching the new topic's path.
+ */
+static void path_patterns_resolve(paths_node_struct *node, const struct path_level *levels, int depth, int level, evm_topic_struct *topic)
+{
+	static const struct path_level any = {"*", 1}, rest = {"**", 2};
+	paths_node_struct *child;
+
+	if ((child = path_child_find(node, &rest)) != NULL)
+		path_consumers_subscribe(child, topic);
+
+	if (level == depth) {
+		path_consumers_subscribe(node, topic);
+		return;
+	}
+
+	if ((child = path_child_find(node, &levels[level])) != NULL)
+		path_patterns_resolve(child, levels, depth, level + 1, topic);
+
+	if ((child = path_child_find(node, &any)) != NULL)
+		path_patterns_resolve(child, levels, depth, level + 1, topic);
+}
+
+static void path_consumers_subscribe(paths_node_struct *node, evm_topic_struct *topic)
+{
+	int i;
+
+	for (i = 0; i < node->consumers_num; i++)
+		path_topic_subscribe(topic, node->consumers[i], EVM_TRUE);
+}
+
+void paths_topic_unbind(evm_topic_struct *topic)
+{
+	evm_struct *evm = topic->evm;
+	paths_node_struct *node;
+	u2up_log_info("(entry)\n");
+
+	pthread_rwlock_wrlock(&evm->paths_rwlock);
+	if ((node = topic->path_node) != NULL) {
+		node->topic = NULL;
+		topic->path_node = NULL;
+		path_node_prune(node);
+	}
+	pthread_rwlock_unlock(&evm->paths_rwlock);
+}
+
+/*
+ * Public API functions:
+ * - evm_topic_path_add()
+ * - evm_topic_path_get()
+ */
+evmTopicStruct * evm_topic_path_add(evmStruct *evm, int topic_id, const char *path)
+{
+	int depth;
+	struct path_level levels[EVM_TOPIC_PATH_DEPTH];
+	paths_node_struct *node;
+	evm_topic_struct *topic = NULL;
+	u2up_log_info("(entry) path=%s\n", path);
+
+	if (evm == NULL)
+		return NULL;
+
+	if ((depth = path_split(path, levels, EVM_FALSE)) < 0)
+		return NULL;
+
+	pthread_rwlock_wrlock(&evm->paths_rwlock);
+	if ((node = path_node_create(&evm->paths_topics, levels, depth)) != NULL) {
+		if (node->topic != NULL) {
+			/* Path already added - with required id? */
+			if (node->topic->id == topic_id)
+				topic = node->topic;
+		} else if ((topic = evm_topic_add(evm, topic_id)) != NULL) {
+			if (topic->path_node != NULL) {
+				/* Topic with required id has another path. */
+				topic = NULL;
+			} else {
+				node->topic = topic;
+				topic->path_node = node;
+				/* Resolve already subscribed patterns. */
+				if (evm->paths_patterns != NULL)
+					path_patterns_resolve(evm->paths_patterns, levels, depth, 0, topic);
+			}
+		}
+		if (topic == NULL)
+			path_node_prune(node);
+	}
+	pthread_rwlock_unlock(&evm->paths_rwlock);
+
+	return topic;
+}
+
+evmTopicStruct * evm_topic_path_get(evmStruct *evm, const char *path)
+{
+	int depth;
+	struct path_level levels[EVM_TOPIC_PATH_DEPTH];
+	paths_node_struct *node;
+	evm_topic_struct *topic = NULL;
+	u2up_log_info("(entry) path=%s\n", path);
+
+	if (evm == NULL)
+		return NULL;
+
+	if ((depth = path_split(path, levels, EVM_FALSE)) < 0)
+		return NULL;
+
+	pthread_rwlock_rdlock(&evm->paths_rwlock);
+	if ((node = path_node_lookup(evm->paths_topics, levels, depth)) != NULL)
+		topic = node->topic;
+	pthread_rwlock_unlock(&evm->paths_rwlock);
+
+	return topic;
+}
+
+/*
+ * Public API functions:
+ * - evm_topic_path_subscribe()
+ * - evm_topic_path_unsubscribe()
+ */
+int evm_topic_path_subscribe(evmConsumerStruct *consumer, const char *pattern)
+{
+	int i, depth, rv = 0;
+	struct path_level levels[EVM_TOPIC_PATH_DEPTH];
+	paths_node_struct *node;
+	evm_consumer_struct **consumers;
+	evm_struct *evm;
+	u2up_log_info("(entry) pattern=%s\n", pattern);
+
+	if ((consumer == NULL) || ((evm = consumer->evm) == NULL) || (consumer->shm != NULL))
+		return -1;
+
+	if ((depth = path_split(pattern, levels, EVM_TRUE)) < 0)
+		return -1;
+
+	pthread_rwlock_wrlock(&evm->paths_rwlock);
+	if ((node = path_node_create(&evm->paths_patterns, levels, depth)) == NULL) {
+		pthread_rwlock_unlock(&evm->paths_rwlock);
+		return -1;
+	}
+	for (i = 0; i < node->consumers_num; i++) {
+		if (node->consumers[i] == consumer)
+			break;
+	}
+	if (i < node->consumers_num) {
+		/* Already subscribed with this pattern. */
+		pthread_rwlock_unlock(&evm->paths_rwlock);
+		return 0;
+	}
+	if (node->consumers_num == node->consumers_size) {
+		if ((consumers = (evm_consumer_struct **)realloc(node->consumers, (node->consumers_size + EVM_PATHS_CHILDREN) * sizeof(evm_consumer_struct *))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("realloc(): paths node consumers\n");
+			path_node_prune(node);
+			rv = -1;
+		} else {
+			node->consumers = consumers;
+			node->consumers_size += EVM_PATHS_CHILDREN;
+		}
+	}
+	if (rv == 0) {
+		node->consumers[node->consumers_num++] = consumer;
+		/* Subscribe to already added matching topics. */
+		if (evm->paths_topics != NULL)
+			path_topics_subscribe(evm->paths_topics, levels, depth, 0, consumer, EVM_TRUE);
+	}
+	pthread_rwlock_unlock(&evm->paths_rwlock);
+
+	return rv;
+}
+
+int evm_topic_path_unsubscribe(evmConsumerStruct *consumer, const char *pattern)
+{
+	int i, depth;
+	struct path_level levels[EVM_TOPIC_PATH_DEPTH];
+	paths_node_struct *node;
+	evm_struct *evm;
+	u2up_log_info("(entry) pattern=%s\n", pattern);
+
+	if ((consumer == NULL) || ((evm = consumer->evm) == NULL))
+		return -1;
+
+	if ((depth = path_split(pattern, levels, EVM_TRUE)) < 0)
+		return -1;
+
+	pthread_rwlock_wrlock(&evm->paths_rwlock);
+	if ((node = path_node_lookup(evm->paths_patterns, levels, depth)) != NULL) {
+		for (i = 0; i < node->consumers_num; i++) {
+			if (node->consumers[i] == consumer)
+				break;
+		}
+		if (i < node->consumers_num) {
+			node->consumers[i] = node->consumers[--node->consumers_num];
+			/* Unsubscribe from matching topics (unless matching other patterns). */
+			if (evm->paths_topics != NULL)
+				path_topics_subscribe(evm->paths_topics, levels, depth, 0, consumer, EVM_FALSE);
+			path_node_prune(node);
+		}
+	}
+	pthread_rwlock_unlock(&evm->paths_rwlock);
+
+	return 0;
+}
+
+/*
+ * Public API function:
+ * - evm_message_path_post()
+ */
+int evm_message_path_post(evmStruct *evm, const char *path, evmMessageStruct *msg)
+{
+	evm_topic_struct *topic;
+	u2up_log_info("(entry) path=%s\n", path);
+
+	if ((topic = evm_topic_path_get(evm, path)) == NULL)
+		return -1;
+
+	return evm_message_post(topic, msg);
+}
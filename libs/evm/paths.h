@@ -0,0 +1,56 @@
+/*
+ * The EVM paths module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_paths_h
+#define EVM_FILE_paths_h
+
+#ifdef EVM_FILE_paths_c
+/* PRIVATE usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN
+#else
+/* PUBLIC usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN extern
+#endif
+
+typedef struct paths_node paths_node_struct;
+
+/*Trie node (path level) of topic paths or path subscription patterns*/
+struct paths_node {
+	char *name; /*path level name*/
+	paths_node_struct *parent;
+	paths_node_struct *next; /*parent's children hash bucket chain*/
+	paths_node_struct **children; /*hash of child nodes by name*/
+	unsigned int children_size; /*power of 2*/
+	unsigned int children_num;
+	evm_topic_struct *topic; /*topics trie: topic with this path*/
+	evm_consumer_struct **consumers; /*patterns trie: consumers subscribed with this pattern*/
+	int consumers_num;
+	int consumers_size;
+}; /*paths_node_struct*/
+
+/*
+ * Remove topic's path from the topics trie (before topic deleted).
+ */
+EXTERN void paths_topic_unbind(evm_topic_struct *topic_ptr);
+
+#endif /*EVM_FILE_paths_h*/
@@ -0,0 +1,605 @@
+/*
+ * The EVM worker pool module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_pools_c
+#define EVM_FILE_pools_c
+#else
+#error Preprocesor macro EVM_FILE_pools_c conflict!
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "evm/libevm.h"
+
+#include "evm.h"
+#include "messages.h"
+#include "timers.h"
+#include "pools.h"
+
+#define U2UP_LOG_NAME EVM_POOL
+#include <u2up-log/u2up-log.h>
+
+/* Worker running the current thread (consumers it schedules kept local). */
+static __thread pools_worker_struct *worker_current;
+
+static long long ts_ns(const struct timespec *ts);
+static int runq_push(pools_worker_struct *worker, evm_consumer_struct *consumer);
+static evm_consumer_struct * runq_pop(pools_worker_struct *worker, int steal);
+static void pool_idle(pools_struct *pools, evm_consumer_struct *consumer);
+static void pool_left(pools_struct *pools);
+static void pool_push(pools_struct *pools, pools_worker_struct *worker, evm_consumer_struct *consumer);
+static void pool_schedule(pools_struct *pools, evm_consumer_struct *consumer);
+static evm_consumer_struct * pool_take(pools_worker_struct *worker);
+static void timers_sift_up(pools_struct *pools, int i);
+static void timers_sift_down(pools_struct *pools, int i);
+static void timers_register(pools_struct *pools, evm_consumer_struct *consumer);
+static void timers_schedule(pools_struct *pools);
+static void timers_purge(pools_struct *pools, evm_consumer_struct *consumer);
+static void worker_run(pools_worker_struct *worker, evm_consumer_struct *consumer);
+static void * worker_thread_start(void *arg);
+static void pools_stop(pools_struct *pools);
+
+static long long ts_ns(const struct timespec *ts)
+{
+	return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/*
+ * Run queues (worker's mutex): pushed at the tail, taken by the owner at
+ * the head and stolen by others from the tail.
+ */
+static int runq_push(pools_worker_struct *worker, evm_consumer_struct *consumer)
+{
+	evm_consumer_struct **runq;
+	unsigned int i, len;
+
+	pthread_mutex_lock(&worker->mutex);
+	len = worker->runq_tail - worker->runq_head;
+	if (len == worker->runq_size) {
+		if ((runq = (evm_consumer_struct **)calloc(worker->runq_size * 2, sizeof(evm_consumer_struct *))) == NULL) {
+			pthread_mutex_unlock(&worker->mutex);
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): runq\n");
+			return -1;
+		}
+		for (i = 0; i < len; i++)
+			runq[i] = worker->runq[(worker->runq_head + i) & (worker->runq_size - 1)];
+		free(worker->runq);
+		worker->runq = runq;
+		worker->runq_size *= 2;
+		worker->runq_head = 0;
+		worker->runq_tail = len;
+	}
+	worker->runq[worker->runq_tail++ & (worker->runq_size - 1)] = consumer;
+	pthread_mutex_unlock(&worker->mutex);
+
+	return 0;
+}
+
+static evm_consumer_struct * runq_pop(pools_worker_struct *worker, int steal)
+{
+	evm_consumer_struct *consumer = NULL;
+
+	pthread_mutex_lock(&worker->mutex);
+	if (worker->runq_tail != worker->runq_head) {
+		if (steal)
+			consumer = worker->runq[--worker->runq_tail & (worker->runq_size - 1)];
+		else
+			consumer = worker->runq[worker->runq_head++ & (worker->runq_size - 1)];
+	}
+	pthread_mutex_unlock(&worker->mutex);
+
+	return consumer;
+}
+
+/*
+ * Leave consumer idle - not touched afterwards, as it may get freed once
+ * removed from the pool (see evm_consumer_pool_del()).
+ */
+static void pool_idle(pools_struct *pools, evm_consumer_struct *consumer)
+{
+	__atomic_store_n(&consumer->pool_state, POOLS_IDLE, __ATOMIC_SEQ_CST);
+	pool_left(pools);
+}
+
+/*
+ * Wake consumers' removals waiting for them to be left idle.
+ */
+static void pool_left(pools_struct *pools)
+{
+	/* Pairs with removals re-checking the state after "leaving" accounted. */
+	if (__atomic_load_n(&pools->leaving, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&pools->mutex);
+		pthread_cond_broadcast(&pools->left_cond);
+		pthread_mutex_unlock(&pools->mutex);
+	}
+}
+
+/*
+ * Queue runnable consumer and wake an idle worker.
+ */
+static void pool_push(pools_struct *pools, pools_worker_struct *worker, evm_consumer_struct *consumer)
+{
+	if (worker == NULL)
+		worker = &pools->workers[__atomic_fetch_add(&pools->next, 1, __ATOMIC_RELAXED) % pools->workers_num];
+
+	if (runq_push(worker, consumer) != 0) {
+		pool_idle(pools, consumer);
+		return;
+	}
+
+	/* Pairs with idle workers re-checking "queued" before waiting. */
+	__atomic_add_fetch(&pools->queued, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pools->idle, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&pools->mutex);
+		pthread_cond_signal(&pools->cond);
+		pthread_mutex_unlock(&pools->mutex);
+	}
+}
+
+/*
+ * Schedule consumer (read lock held), unless removed from the pool.
+ */
+static void pool_schedule(pools_struct *pools, evm_consumer_struct *consumer)
+{
+	pools_worker_struct *worker = NULL;
+	int state;
+
+	if ((pools->workers_num == 0) || !__atomic_load_n(&consumer->pooled, __ATOMIC_SEQ_CST))
+		return;
+
+	state = __atomic_load_n(&consumer->pool_state, __ATOMIC_SEQ_CST);
+	for (;;) {
+		if (state == POOLS_IDLE) {
+			if (__atomic_compare_exchange_n(&consumer->pool_state, &state, POOLS_QUEUED, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+				/* Scheduled by a worker of this pool - kept local (cache warm). */
+				if ((worker_current != NULL) && (worker_current->pool == pools))
+					worker = worker_current;
+				pool_push(pools, worker, consumer);
+				break;
+			}
+		} else if (state == POOLS_RUNNING) {
+			if (__atomic_compare_exchange_n(&consumer->pool_state, &state, POOLS_NOTIFIED, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+				break;
+		} else
+			break;
+	}
+}
+
+/*
+ * Own run queue first, then steal from others.
+ */
+static evm_consumer_struct * pool_take(pools_worker_struct *worker)
+{
+	pools_struct *pools = worker->pool;
+	evm_consumer_struct *consumer;
+	int i;
+
+	if (__atomic_load_n(&pools->queued, __ATOMIC_RELAXED) == 0)
+		return NULL;
+
+	if ((consumer = runq_pop(worker, EVM_FALSE)) == NULL) {
+		for (i = 1; i < pools->workers_num; i++) {
+			if ((consumer = runq_pop(&pools->workers[(worker->index + i) % pools->workers_num], EVM_TRUE)) != NULL)
+				break;
+		}
+	}
+	if (consumer != NULL)
+		__atomic_sub_fetch(&pools->queued, 1, __ATOMIC_RELAXED);
+
+	return consumer;
+}
+
+/*
+ * Timers min-heap (pools->mutex locked).
+ */
+static void timers_sift_up(pools_struct *pools, int i)
+{
+	pools_timer_struct tmp;
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (ts_ns(&pools->timers[parent].ts) <= ts_ns(&pools->timers[i].ts))
+			break;
+		tmp = pools->timers[parent];
+		pools->timers[parent] = pools->timers[i];
+		pools->timers[i] = tmp;
+		i = parent;
+	}
+}
+
+static void timers_sift_down(pools_struct *pools, int i)
+{
+	pools_timer_struct tmp;
+	int child;
+
+	while ((child = 2 * i + 1) < pools->timers_num) {
+		if ((child + 1 < pools->timers_num) && (ts_ns(&pools->timers[child + 1].ts) < ts_ns(&pools->timers[child].ts)))
+			child++;
+		if (ts_ns(&pools->timers[i].ts) <= ts_ns(&pools->timers[child].ts))
+			break;
+		tmp = pools->timers[child];
+		pools->timers[child] = pools->timers[i];
+		pools->timers[i] = tmp;
+		i = child;
+	}
+}
+
+/*
+ * Let the pool know of consumer's next timer expiration (after its run).
+ * Later expirations of already known ones are left stale in the heap.
+ */
+static void timers_register(pools_struct *pools, evm_consumer_struct *consumer)
+{
+	struct timespec *ts;
+	pools_timer_struct *timers;
+
+	if ((ts = timers_next_ts(consumer)) == NULL)
+		return;
+
+	pthread_mutex_lock(&pools->mutex);
+	if (consumer->pool_deadline_set && (ts_ns(&consumer->pool_deadline) <= ts_ns(ts))) {
+		pthread_mutex_unlock(&pools->mutex);
+		return;
+	}
+	if (pools->timers_num == pools->timers_size) {
+		if ((timers = (pools_timer_struct *)realloc(pools->timers, (pools->timers_size + 64) * sizeof(pools_timer_struct))) == NULL) {
+			pthread_mutex_unlock(&pools->mutex);
+			errno = ENOMEM;
+			u2up_log_system_error("realloc(): timers\n");
+			return;
+		}
+		pools->timers = timers;
+		pools->timers_size += 64;
+	}
+	consumer->pool_deadline_set = EVM_TRUE;
+	consumer->pool_deadline = *ts;
+	pools->timers[pools->timers_num].ts = *ts;
+	pools->timers[pools->timers_num].consumer = consumer;
+	timers_sift_up(pools, pools->timers_num++);
+	if (ts_ns(ts) < pools->timers_next) {
+		__atomic_store_n(&pools->timers_next, ts_ns(ts), __ATOMIC_RELAXED);
+		/* Idle workers may wait for a later one. */
+		if (pools->idle > 0)
+			pthread_cond_signal(&pools->cond);
+	}
+	pthread_mutex_unlock(&pools->mutex);
+}
+
+/*
+ * Schedule consumers with expired timers (read lock held while taken
+ * ones get scheduled - consumers removed meanwhile are not freed).
+ */
+static void timers_schedule(pools_struct *pools)
+{
+	struct timespec now;
+	evm_consumer_struct *expired[64];
+	evm_consumer_struct *consumer;
+	int i, num = 0;
+
+	if (evm_clock_gettime(pools->evm, &now) != 0)
+		return;
+	if (ts_ns(&now) < __atomic_load_n(&pools->timers_next, __ATOMIC_RELAXED))
+		return;
+
+	pthread_rwlock_rdlock(&pools->rwlock);
+	pthread_mutex_lock(&pools->mutex);
+	while ((num < 64) && (pools->timers_num > 0) && (ts_ns(&pools->timers[0].ts) <= ts_ns(&now))) {
+		consumer = pools->timers[0].consumer;
+		/* Stale ones (earlier expiration registered since) skipped. */
+		if (consumer->pool_deadline_set && (ts_ns(&consumer->pool_deadline) == ts_ns(&pools->timers[0].ts))) {
+			consumer->pool_deadline_set = EVM_FALSE;
+			expired[num++] = consumer;
+		}
+		pools->timers[0] = pools->timers[--pools->timers_num];
+		timers_sift_down(pools, 0);
+	}
+	__atomic_store_n(&pools->timers_next, (pools->timers_num > 0) ? ts_ns(&pools->timers[0].ts) : LLONG_MAX, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&pools->mutex);
+
+	for (i = 0; i < num; i++)
+		pool_schedule(pools, expired[i]);
+	pthread_rwlock_unlock(&pools->rwlock);
+}
+
+static void timers_purge(pools_struct *pools, evm_consumer_struct *consumer)
+{
+	int i;
+
+	pthread_mutex_lock(&pools->mutex);
+	for (i = 0; i < pools->timers_num;) {
+		if (pools->timers[i].consumer == consumer)
+			pools->timers[i] = pools->timers[--pools->timers_num];
+		else
+			i++;
+	}
+	for (i = pools->timers_num / 2 - 1; i >= 0; i--)
+		timers_sift_down(pools, i);
+	__atomic_store_n(&pools->timers_next, (pools->timers_num > 0) ? ts_ns(&pools->timers[0].ts) : LLONG_MAX, __ATOMIC_RELAXED);
+	consumer->pool_deadline_set = EVM_FALSE;
+	pthread_mutex_unlock(&pools->mutex);
+}
+
+/*
+ * Run consumer's pass (never by two workers at once) and requeue it, if
+ * work left behind or woken meanwhile.
+ */
+static void worker_run(pools_worker_struct *worker, evm_consumer_struct *consumer)
+{
+	pools_struct *pools = worker->pool;
+	struct timespec now, *ts;
+	int more = EVM_FALSE;
+
+	__atomic_store_n(&consumer->pool_state, POOLS_RUNNING, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&consumer->pooled, __ATOMIC_ACQUIRE)) {
+		evm_run_async(consumer);
+		timers_register(pools, consumer);
+		/* Budgets exhausted - requeued behind others (fairness). */
+		if (messages_pending(consumer)) {
+			more = EVM_TRUE;
+		} else if (((ts = timers_next_ts(consumer)) != NULL) && (evm_clock_gettime(pools->evm, &now) == 0)) {
+			more = (ts_ns(ts) <= ts_ns(&now));
+		}
+	}
+	if (!more) {
+		int running = POOLS_RUNNING;
+
+		if (__atomic_compare_exchange_n(&consumer->pool_state, &running, POOLS_IDLE, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			pool_left(pools);
+			return;
+		}
+		/* Woken while running. */
+		if (!__atomic_load_n(&consumer->pooled, __ATOMIC_ACQUIRE)) {
+			pool_idle(pools, consumer);
+			return;
+		}
+	}
+	__atomic_store_n(&consumer->pool_state, POOLS_QUEUED, __ATOMIC_SEQ_CST);
+	pool_push(pools, worker, consumer);
+}
+
+static void * worker_thread_start(void *arg)
+{
+	pools_worker_struct *worker = (pools_worker_struct *)arg;
+	pools_struct *pools = worker->pool;
+	evm_consumer_struct *consumer;
+	struct timespec ts;
+	long long next;
+	u2up_log_info("(entry) worker=%d\n", worker->index);
+
+	worker_current = worker;
+	/* Wait for all workers started (run queues kept until joined). */
+	pthread_rwlock_rdlock(&pools->rwlock);
+	pthread_rwlock_unlock(&pools->rwlock);
+	while (!__atomic_load_n(&pools->stop, __ATOMIC_ACQUIRE)) {
+		timers_schedule(pools);
+		if ((consumer = pool_take(worker)) != NULL) {
+			worker_run(worker, consumer);
+			continue;
+		}
+
+		/* Idle - until scheduled or the earliest timer expires. */
+		pthread_mutex_lock(&pools->mutex);
+		__atomic_add_fetch(&pools->idle, 1, __ATOMIC_SEQ_CST);
+		if ((__atomic_load_n(&pools->queued, __ATOMIC_SEQ_CST) == 0) && !__atomic_load_n(&pools->stop, __ATOMIC_ACQUIRE)) {
+			if ((next = pools->timers_next) == LLONG_MAX) {
+				pthread_cond_wait(&pools->cond, &pools->mutex);
+			} else {
+				ts.tv_sec = next / 1000000000LL;
+				ts.tv_nsec = next % 1000000000LL;
+				pthread_cond_timedwait(&pools->cond, &pools->mutex, &ts);
+			}
+			__atomic_sub_fetch(&pools->idle, 1, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&pools->mutex);
+			continue;
+		}
+		__atomic_sub_fetch(&pools->idle, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&pools->mutex);
+	}
+	worker_current = NULL;
+
+	return NULL;
+}
+
+/*
+ * Stop and join workers (evm->pools_mutex locked): Queued consumers are
+ * left idle, to be rescheduled when restarted.
+ */
+static void pools_stop(pools_struct *pools)
+{
+	evm_consumer_struct *consumer;
+	int i;
+
+	__atomic_store_n(&pools->stop, EVM_TRUE, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&pools->mutex);
+	pthread_cond_broadcast(&pools->cond);
+	pthread_mutex_unlock(&pools->mutex);
+	for (i = 0; i < pools->workers_num; i++)
+		pthread_join(pools->workers[i].thread, NULL);
+
+	pthread_rwlock_wrlock(&pools->rwlock);
+	for (i = 0; i < pools->workers_num; i++) {
+		while ((consumer = runq_pop(&pools->workers[i], EVM_FALSE)) != NULL)
+			pool_idle(pools, consumer);
+		pthread_mutex_destroy(&pools->workers[i].mutex);
+		free(pools->workers[i].runq);
+	}
+	free(pools->workers);
+	pools->workers = NULL;
+	pools->workers_num = 0;
+	pools->queued = 0;
+	pools->stop = EVM_FALSE;
+	pthread_rwlock_unlock(&pools->rwlock);
+}
+
+void pools_schedule(evm_consumer_struct *consumer)
+{
+	pools_struct *pools = __atomic_load_n(&consumer->evm->pools, __ATOMIC_ACQUIRE);
+
+	if ((pools == NULL) || !__atomic_load_n(&consumer->pooled, __ATOMIC_ACQUIRE))
+		return;
+
+	pthread_rwlock_rdlock(&pools->rwlock);
+	pool_schedule(pools, consumer);
+	pthread_rwlock_unlock(&pools->rwlock);
+}
+
+void pools_consumer_free(evm_consumer_struct *consumer)
+{
+	u2up_log_info("(entry)\n");
+
+	if (consumer->pooled)
+		evm_consumer_pool_del(consumer);
+}
+
+/*
+ * Public API functions:
+ * - evm_pool_threads_set()
+ * - evm_consumer_pool_add()
+ * - evm_consumer_pool_del()
+ */
+int evm_pool_threads_set(evmStruct *evm, int threads)
+{
+	int rv = 0;
+	pools_struct *pools;
+	evmlist_el_struct *tmp;
+	u2up_log_info("(entry) threads=%d\n", threads);
+
+	if ((evm == NULL) || (threads < 0))
+		return -1;
+
+	pthread_mutex_lock(&evm->pools_mutex);
+	if ((pools = evm->pools) == NULL) {
+		if ((pools = (pools_struct *)calloc(1, sizeof(pools_struct))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): pools\n");
+			pthread_mutex_unlock(&evm->pools_mutex);
+			return -1;
+		}
+		pools->evm = evm;
+		pools->timers_next = LLONG_MAX;
+		pthread_rwlock_init(&pools->rwlock, NULL);
+		pthread_mutex_init(&pools->mutex, NULL);
+		pthread_cond_init(&pools->cond, NULL);
+		pthread_cond_init(&pools->left_cond, NULL);
+		__atomic_store_n(&evm->pools, pools, __ATOMIC_RELEASE);
+	}
+
+	if (pools->workers_num > 0)
+		pools_stop(pools);
+
+	if (threads > 0) {
+		pthread_rwlock_wrlock(&pools->rwlock);
+		if ((pools->workers = (pools_worker_struct *)calloc(threads, sizeof(pools_worker_struct))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): workers\n");
+			rv = -1;
+		} else {
+			for (pools->workers_num = 0; pools->workers_num < threads; pools->workers_num++) {
+				pools_worker_struct *worker = &pools->workers[pools->workers_num];
+
+				worker->pool = pools;
+				worker->index = pools->workers_num;
+				worker->runq_size = 64;
+				pthread_mutex_init(&worker->mutex, NULL);
+				if ((worker->runq = (evm_consumer_struct **)calloc(worker->runq_size, sizeof(evm_consumer_struct *))) == NULL) {
+					errno = ENOMEM;
+					u2up_log_system_error("calloc(): runq\n");
+					pthread_mutex_destroy(&worker->mutex);
+					rv = -1;
+					break;
+				}
+				if (pthread_create(&worker->thread, NULL, worker_thread_start, worker) != 0) {
+					u2up_log_system_error("pthread_create()\n");
+					pthread_mutex_destroy(&worker->mutex);
+					free(worker->runq);
+					rv = -1;
+					break;
+				}
+			}
+		}
+		pthread_rwlock_unlock(&pools->rwlock);
+
+		/* Pooled consumers may have work left from before (re)start. */
+		pthread_mutex_lock(&evm->consumers_list->access_mutex);
+		for (tmp = evm->consumers_list->first; tmp != NULL; tmp = tmp->next) {
+			if ((tmp->el != NULL) && ((evm_consumer_struct *)tmp->el)->pooled)
+				pools_schedule((evm_consumer_struct *)tmp->el);
+		}
+		pthread_mutex_unlock(&evm->consumers_list->access_mutex);
+	}
+	pthread_mutex_unlock(&evm->pools_mutex);
+
+	return rv;
+}
+
+int evm_consumer_pool_add(evmConsumerStruct *consumer)
+{
+	u2up_log_info("(entry) consumer=%p\n", consumer);
+
+	if ((consumer == NULL) || consumer->pooled)
+		return -1;
+
+	consumer->pool_state = POOLS_IDLE;
+	__atomic_store_n(&consumer->pooled, EVM_TRUE, __ATOMIC_SEQ_CST);
+
+	/* Work queued before. */
+	pools_schedule(consumer);
+	return 0;
+}
+
+int evm_consumer_pool_del(evmConsumerStruct *consumer)
+{
+	pools_struct *pools;
+	u2up_log_info("(entry) consumer=%p\n", consumer);
+
+	if ((consumer == NULL) || !consumer->pooled)
+		return -1;
+
+	__atomic_store_n(&consumer->pooled, EVM_FALSE, __ATOMIC_SEQ_CST);
+	if ((pools = __atomic_load_n(&consumer->evm->pools, __ATOMIC_ACQUIRE)) == NULL)
+		return 0;
+
+	/* Schedulers in progress (may have seen it pooled) done - never queued again. */
+	pthread_rwlock_wrlock(&pools->rwlock);
+	pthread_rwlock_unlock(&pools->rwlock);
+
+	/* Wait for a worker to leave it (not called by the consumer's handlers). */
+	pthread_mutex_lock(&pools->mutex);
+	__atomic_add_fetch(&pools->leaving, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&consumer->pool_state, __ATOMIC_SEQ_CST) != POOLS_IDLE)
+		pthread_cond_wait(&pools->left_cond, &pools->mutex);
+	__atomic_sub_fetch(&pools->leaving, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&pools->mutex);
+
+	/* Expired timers being scheduled (taken before purged) done as well. */
+	timers_purge(pools, consumer);
+	pthread_rwlock_wrlock(&pools->rwlock);
+	pthread_rwlock_unlock(&pools->rwlock);
+	return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * The EVM worker pool module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+
+#ifndef EVM_FILE_pools_h
+#define EVM_FILE_pools_h
+
+#ifdef EVM_FILE_pools_c
+/* PRIVATE usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN
+#else
+/* PUBLIC usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN extern
+#endif
+
+/* Pooled consumer states */
+#define POOLS_IDLE 0 /*nothing to do (not queued)*/
+#define POOLS_QUEUED 1 /*in a worker's run queue*/
+#define POOLS_RUNNING 2 /*being run by a worker*/
+#define POOLS_NOTIFIED 3 /*being run, woken meanwhile (run again)*/
+
+typedef struct pools_worker pools_worker_struct;
+typedef struct pools_timer pools_timer_struct;
+
+/*Worker thread with its run queue (consumers ring, stolen from the tail)*/
+struct pools_worker {
+	pools_struct *pool;
+	int index;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	evm_consumer_struct **runq;
+	unsigned int runq_size; /*power of 2*/
+	unsigned int runq_head;
+	unsigned int runq_tail;
+}; /*pools_worker_struct*/
+
+/*Next timer expiration of a pooled consumer (min-heap entry)*/
+struct pools_timer {
+	struct timespec ts;
+	evm_consumer_struct *consumer;
+}; /*pools_timer_struct*/
+
+struct pools {
+	evm_struct *evm;
+	pthread_rwlock_t rwlock; /*workers (re)started or consumers removed (write), consumers scheduled (read)*/
+	pools_worker_struct *workers;
+	int workers_num;
+	int stop;
+	unsigned int next; /*round robin for non-worker schedulers*/
+	int queued; /*consumers in run queues*/
+	pthread_mutex_t mutex; /*idle workers, timers and consumers being removed*/
+	pthread_cond_t cond;
+	int idle; /*workers waiting*/
+	pthread_cond_t left_cond; /*consumer left idle by a worker*/
+	int leaving; /*consumers being removed (waiting to be left idle)*/
+	pools_timer_struct *timers;
+	int timers_num;
+	int timers_size;
+	long long timers_next; /*earliest expiration (ns, LLONG_MAX - none)*/
+}; /*pools_struct*/
+
+/*
+ * Schedule pooled consumer (runnable - messages queued or timer expired).
+ */
+EXTERN void pools_schedule(evm_consumer_struct *consumer_ptr);
+
+/*
+ * Remove consumer from the pool (see evm_consumer_pool_del()).
+ */
+EXTERN void pools_consumer_free(evm_consumer_struct *consumer_ptr);
+
+#endif /*EVM_FILE_pools_h*/
@@ -0,0 +1,405 @@
+/*
+ * The EVM shards (sharded routing) module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_shards_c
+#define EVM_FILE_shards_c
+#else
+#error Preprocesor macro EVM_FILE_shards_c conflict!
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <semaphore.h>
+#include <pthread.h>
+
+#include "evm/libevm.h"
+
+#include "evm.h"
+#include "messages.h"
+#include "shards.h"
+
+#define U2UP_LOG_NAME EVM_SHRD
+#include <u2up-log/u2up-log.h>
+
+/* Virtual nodes (hash ring points) per shard */
+#define EVM_SHARD_VNODES 64
+
+static unsigned long long shard_hash(unsigned long long x);
+static int shard_ring_build(evm_router_struct *router, int skip);
+static int shard_ring_cmp(const void *a, const void *b);
+static int shard_lookup(evm_router_struct *router, unsigned long key);
+
+/*
+ * 64-bit mix function (splitmix64 finalizer).
+ */
+static unsigned long long shard_hash(unsigned long long x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+static int shard_ring_cmp(const void *a, const void *b)
+{
+	const struct evm_ring_point *pa = (const struct evm_ring_point *)a;
+	const struct evm_ring_point *pb = (const struct evm_ring_point *)b;
+
+	if (pa->point != pb->point)
+		return (pa->point < pb->point) ? -1 : 1;
+
+	return pa->shard - pb->shard;
+}
+
+/*
+ * Rebuild the hash ring (router locked): Virtual node positions only
+ * depend on the shard consumer's id, so adding or removing a shard only
+ * moves the keys from or to that shard. The shard at index "skip" (if
+ * not -1) is left out, the ring indexing the shards as if already removed
+ * from the array. The ring is only replaced on success.
+ */
+static int shard_ring_build(evm_router_struct *router, int skip)
+{
+	int i, j, n = 0;
+	int shards_num = router->shards_num - ((skip >= 0) ? 1 : 0);
+	struct evm_ring_point *ring = NULL;
+
+	if (shards_num > 0) {
+		if ((ring = (struct evm_ring_point *)calloc(shards_num * EVM_SHARD_VNODES, sizeof(struct evm_ring_point))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): shards ring\n");
+			return -1;
+		}
+		for (i = 0; i < router->shards_num; i++) {
+			if (i == skip)
+				continue;
+			for (j = 0; j < EVM_SHARD_VNODES; j++) {
+				ring[n].point = shard_hash(((unsigned long long)(unsigned int)router->shards[i].consumer->id << 32) | (unsigned int)j);
+				ring[n].shard = ((skip >= 0) && (i > skip)) ? (i - 1) : i;
+				n++;
+			}
+		}
+		qsort(ring, n, sizeof(struct evm_ring_point), shard_ring_cmp);
+	}
+
+	free(router->ring);
+	router->ring = ring;
+	router->ring_num = n;
+	return 0;
+}
+
+/*
+ * Find the shard of the key (router locked, ring not empty): The first
+ * virtual node clockwise from the key's hash.
+ */
+static int shard_lookup(evm_router_struct *router, unsigned long key)
+{
+	unsigned long long h = shard_hash(key);
+	int lo = 0, hi = router->ring_num, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (router->ring[mid].point < h)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == router->ring_num)
+		lo = 0;
+
+	return router->ring[lo].shard;
+}
+
+/*
+ * Public API functions:
+ * - evm_router_add()
+ * - evm_router_get()
+ * - evm_router_del()
+ */
+evmRouterStruct * evm_router_add(evmStruct *evm, int id)
+{
+	evmRouterStruct *router = NULL;
+	evmlist_el_struct *tmp, *new;
+	u2up_log_info("(entry)\n");
+
+	if (evm != NULL) {
+		if (evm->routers_list != NULL) {
+			pthread_mutex_lock(&evm->routers_list->access_mutex);
+			tmp = evm_search_evmlist(evm->routers_list, id);
+			if ((tmp != NULL) && (tmp->id == id)) {
+				/* required id already exists - return existing element */
+				router = (evm_router_struct *)tmp->el;
+			} else {
+				/* create new evmlist element with id */
+				if ((new = evm_new_evmlist_el(id)) != NULL) {
+					/* create new router */
+					if ((router = (evm_router_struct *)calloc(1, sizeof(evm_router_struct))) == NULL) {
+						errno = ENOMEM;
+						u2up_log_system_error("calloc(): router\n");
+						free(new);
+						new = NULL;
+					}
+					if (router != NULL) {
+						router->evm = evm;
+						router->id = id;
+						pthread_mutex_init(&router->access_mutex, NULL);
+						pthread_mutex_unlock(&router->access_mutex);
+					}
+				}
+				if (new != NULL) {
+					new->id = id;
+					new->el = (void *)router;
+					new->prev = tmp;
+					new->next = NULL;
+					if (tmp != NULL)
+						tmp->next = new;
+					else
+						evm->routers_list->first = new;
+				}
+			}
+			pthread_mutex_unlock(&evm->routers_list->access_mutex);
+		}
+	}
+	return router;
+}
+
+evmRouterStruct * evm_router_get(evmStruct *evm, int id)
+{
+	evmRouterStruct *router = NULL;
+	evmlist_el_struct *tmp;
+	u2up_log_info("(entry)\n");
+
+	if (evm != NULL) {
+		if (evm->routers_list != NULL) {
+			pthread_mutex_lock(&evm->routers_list->access_mutex);
+			tmp = evm_search_evmlist(evm->routers_list, id);
+			if ((tmp != NULL) && (tmp->id == id)) {
+				/* required id already exists - return existing element */
+				router = (evm_router_struct *)tmp->el;
+			}
+			pthread_mutex_unlock(&evm->routers_list->access_mutex);
+		}
+	}
+	return router;
+}
+
+evmRouterStruct * evm_router_del(evmStruct *evm, int id)
+{
+	evmRouterStruct *router = NULL;
+	evmlist_el_struct *tmp;
+	u2up_log_info("(entry)\n");
+
+	if (evm != NULL) {
+		if (evm->routers_list != NULL) {
+			pthread_mutex_lock(&evm->routers_list->access_mutex);
+			tmp = evm_search_evmlist(evm->routers_list, id);
+			if ((tmp != NULL) && (tmp->id == id)) {
+				/* required id already exists - return existing element */
+				router = (evm_router_struct *)tmp->el;
+				if (router != NULL) {
+					free(router->ring);
+					free(router->shards);
+					free(router);
+				}
+				if (tmp->prev != NULL)
+					tmp->prev->next = tmp->next;
+				else
+					evm->routers_list->first = tmp->next;
+				if (tmp->next != NULL)
+					tmp->next->prev = tmp->prev;
+				free(tmp);
+				tmp = NULL;
+			}
+			pthread_mutex_unlock(&evm->routers_list->access_mutex);
+		}
+	}
+	return router;
+}
+
+/*
+ * Public API functions:
+ * - evm_router_shard_add()
+ * - evm_router_shard_del()
+ * - evm_router_shard_stats_get()
+ */
+int evm_router_shard_add(evmRouterStruct *router, evmConsumerStruct *consumer)
+{
+	int i;
+	struct evm_shard *shards;
+	u2up_log_info("(entry)\n");
+
+	if ((router == NULL) || (consumer == NULL))
+		return -1;
+
+	pthread_mutex_lock(&router->access_mutex);
+	for (i = 0; i < router->shards_num; i++) {
+		if (router->shards[i].consumer == consumer) {
+			/* already a shard */
+			pthread_mutex_unlock(&router->access_mutex);
+			return 0;
+		}
+	}
+	if (router->shards_num == router->shards_size) {
+		shards = (struct evm_shard *)realloc(router->shards, ((router->shards_size != 0) ? (router->shards_size * 2) : 4) * sizeof(struct evm_shard));
+		if (shards == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("realloc(): router shards\n");
+			pthread_mutex_unlock(&router->access_mutex);
+			return -1;
+		}
+		router->shards = shards;
+		router->shards_size = (router->shards_size != 0) ? (router->shards_size * 2) : 4;
+	}
+	router->shards[router->shards_num].consumer = consumer;
+	router->shards[router->shards_num].routed = 0;
+	router->shards_num++;
+	if (shard_ring_build(router, -1) != 0) {
+		router->shards_num--;
+		pthread_mutex_unlock(&router->access_mutex);
+		return -1;
+	}
+	pthread_mutex_unlock(&router->access_mutex);
+	return 0;
+}
+
+int evm_router_shard_del(evmRouterStruct *router, evmConsumerStruct *consumer)
+{
+	int i, rv = 0;
+	u2up_log_info("(entry)\n");
+
+	if ((router == NULL) || (consumer == NULL))
+		return -1;
+
+	pthread_mutex_lock(&router->access_mutex);
+	for (i = 0; i < router->shards_num; i++) {
+		if (router->shards[i].consumer == consumer) {
+			/* Removed only with the ring without it in place. */
+			if ((rv = shard_ring_build(router, i)) == 0) {
+				router->shards_num--;
+				memmove(&router->shards[i], &router->shards[i + 1], (router->shards_num - i) * sizeof(struct evm_shard));
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&router->access_mutex);
+	return rv;
+}
+
+int evm_router_shard_stats_get(evmRouterStruct *router, evmConsumerStruct *consumer, evmShardStatsStruct *stats)
+{
+	int i;
+	u2up_log_info("(entry)\n");
+
+	if ((router == NULL) || (consumer == NULL) || (stats == NULL))
+		return -1;
+
+	pthread_mutex_lock(&router->access_mutex);
+	for (i = 0; i < router->shards_num; i++) {
+		if (router->shards[i].consumer == consumer) {
+			stats->routed = router->shards[i].routed;
+			stats->depth = messages_depth(consumer);
+			pthread_mutex_unlock(&router->access_mutex);
+			return 0;
+		}
+	}
+	pthread_mutex_unlock(&router->access_mutex);
+	return -1;
+}
+
+void shards_consumer_free(evm_consumer_struct *consumer)
+{
+	evm_struct *evm = consumer->evm;
+	evm_router_struct *router;
+	evmlist_el_struct *tmp;
+	int i;
+	u2up_log_info("(entry)\n");
+
+	if (evm->routers_list == NULL)
+		return;
+
+	pthread_mutex_lock(&evm->routers_list->access_mutex);
+	for (tmp = evm->routers_list->first; tmp != NULL; tmp = tmp->next) {
+		if ((router = (evm_router_struct *)tmp->el) == NULL)
+			continue;
+		pthread_mutex_lock(&router->access_mutex);
+		for (i = 0; i < router->shards_num; i++) {
+			if (router->shards[i].consumer == consumer) {
+				/* Removed anyway - the router left without ring, if not rebuilt. */
+				if (shard_ring_build(router, i) != 0) {
+					u2up_log_error("Router (id=%d) without shards, until next shard added!\n", router->id);
+					free(router->ring);
+					router->ring = NULL;
+					router->ring_num = 0;
+				}
+				router->shards_num--;
+				memmove(&router->shards[i], &router->shards[i + 1], (router->shards_num - i) * sizeof(struct evm_shard));
+				break;
+			}
+		}
+		pthread_mutex_unlock(&router->access_mutex);
+	}
+	pthread_mutex_unlock(&evm->routers_list->access_mutex);
+}
+
+/*
+ * Public API function:
+ * - evm_message_shard_pass()
+ */
+int evm_message_shard_pass(evmRouterStruct *router, evmMessageStruct *msg)
+{
+	int i, shard;
+	evm_consumer_struct *consumer;
+	u2up_log_info("(entry) router=%p, msg=%p\n", router, msg);
+
+	if ((router == NULL) || (msg == NULL))
+		return -1;
+
+	if (!msg->key_set) {
+		u2up_log_debug("Message key not set!\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&router->access_mutex);
+	if (router->ring_num == 0) {
+		pthread_mutex_unlock(&router->access_mutex);
+		u2up_log_debug("Router without shards!\n");
+		return -1;
+	}
+	shard = shard_lookup(router, msg->key);
+	consumer = router->shards[shard].consumer;
+	pthread_mutex_unlock(&router->access_mutex);
+
+	if (evm_message_pass(consumer, msg) != 0)
+		return -1;
+
+	/* Counted when passed (shards may have moved meanwhile). */
+	pthread_mutex_lock(&router->access_mutex);
+	for (i = 0; i < router->shards_num; i++) {
+		if (router->shards[i].consumer == consumer) {
+			router->shards[i].routed++;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&router->access_mutex);
+	return 0;
+}
@@ -0,0 +1,555 @@
+/*
+ * The EVM shared memory transport module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_shm_c
+#define EVM_FILE_shm_c
+#else
+#error Preprocesor macro EVM_FILE_shm_c conflict!
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "evm/libevm.h"
+
+#include "evm.h"
+#include "messages.h"
+#include "shm.h"
+#include "memfds.h"
+
+#define U2UP_LOG_NAME EVM_SHM
+#include <u2up-log/u2up-log.h>
+
+static shm_block_struct * block_ptr(evm_shm_struct *shm, unsigned int index);
+static int block_get(evm_shm_struct *shm);
+static void block_put(evm_shm_struct *shm, unsigned int index);
+static void block_release(void *ctx);
+static int credit_take(evm_shm_struct *shm);
+static void credit_grant(evm_shm_struct *shm);
+static void credit_release(void *ctx);
+static void credit_block_release(void *ctx);
+static void shm_wake(evm_shm_struct *shm);
+static evm_message_struct * shm_message(evm_shm_struct *shm, shm_slot_struct *slot);
+static int shm_drain(evm_shm_struct *shm);
+static int shm_pending(evm_shm_struct *shm);
+static int shm_handle(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx);
+static int shm_memfd_handle(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx);
+
+static shm_block_struct * block_ptr(evm_shm_struct *shm, unsigned int index)
+{
+	return (shm_block_struct *)(shm->blocks + (size_t)index * shm->block_stride);
+}
+
+/*
+ * Shared pool blocks (lock-free stack, tagged against ABA).
+ */
+static int block_get(evm_shm_struct *shm)
+{
+	unsigned long long old, new;
+	unsigned int index;
+
+	old = __atomic_load_n(&shm->region->free_top, __ATOMIC_ACQUIRE);
+	do {
+		if ((index = (unsigned int)old) == 0)
+			return -1;
+		new = (((old >> 32) + 1) << 32) | __atomic_load_n(&shm->links[index - 1], __ATOMIC_RELAXED);
+	} while (!__atomic_compare_exchange_n(&shm->region->free_top, &old, new, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	return index - 1;
+}
+
+static void block_put(evm_shm_struct *shm, unsigned int index)
+{
+	unsigned long long old, new;
+
+	old = __atomic_load_n(&shm->region->free_top, __ATOMIC_RELAXED);
+	do {
+		__atomic_store_n(&shm->links[index], (unsigned int)old, __ATOMIC_RELAXED);
+		new = (((old >> 32) + 1) << 32) | (index + 1);
+	} while (!__atomic_compare_exchange_n(&shm->region->free_top, &old, new, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * Message release hook (data within a pool block - ctx is the message).
+ */
+static void block_release(void *ctx)
+{
+	evm_message_struct *msg = (evm_message_struct *)ctx;
+	shm_block_struct *blk;
+
+	if (msg->data == NULL)
+		return;
+
+	blk = (shm_block_struct *)msg->data - 1;
+	block_put(blk->owner, blk->index);
+	msg->data = NULL;
+}
+
+/*
+ * Credits - messages passed, but not yet deleted by the consumer.
+ */
+static int credit_take(evm_shm_struct *shm)
+{
+	int credits = __atomic_load_n(&shm->region->credits, __ATOMIC_RELAXED);
+
+	do {
+		if (credits <= 0)
+			return -1;
+	} while (!__atomic_compare_exchange_n(&shm->region->credits, &credits, credits - 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+	return 0;
+}
+
+static void credit_grant(evm_shm_struct *shm)
+{
+	__atomic_add_fetch(&shm->region->credits, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Received message release hooks (message deleted by any thread).
+ */
+static void credit_release(void *ctx)
+{
+	credit_grant((evm_shm_struct *)ctx);
+}
+
+static void credit_block_release(void *ctx)
+{
+	evm_message_struct *msg = (evm_message_struct *)ctx;
+	evm_shm_struct *shm;
+
+	if (msg->data == NULL)
+		return;
+
+	shm = ((shm_block_struct *)msg->data - 1)->owner;
+	block_release(ctx);
+	credit_grant(shm);
+}
+
+/*
+ * Wake the consumer, only if it armed the wakeup (no syscall otherwise).
+ */
+static void shm_wake(evm_shm_struct *shm)
+{
+	uint64_t val = 1;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&shm->region->armed, __ATOMIC_RELAXED) == 0)
+		return;
+	if (__atomic_exchange_n(&shm->region->armed, 0, __ATOMIC_SEQ_CST) == 0)
+		return;
+	if (write(shm->event_fd, &val, sizeof(val)) < 0) {
+		u2up_log_system_error("write(): eventfd\n");
+	}
+}
+
+int shm_pass(evm_consumer_struct *consumer, evm_message_struct *msg)
+{
+	evm_shm_struct *shm = consumer->shm;
+	shm_region_struct *region = shm->region;
+	shm_slot_struct *slot;
+	shm_block_struct *blk = NULL;
+	unsigned long pos, seq;
+	size_t size = (msg->data != NULL) ? msg->size : 0;
+	int index = -1, zero_copy = 0;
+	u2up_log_info("(entry) consumer=%p, msg=%p\n", consumer, msg);
+
+	if ((msg->msgtype == NULL) || (msg->msgid == NULL))
+		return -1;
+
+	/* Memfd data goes by its fd (mapped on arrival), not through the ring. */
+	if (memfds_is(msg)) {
+		if (memfds_send(shm->socks[0], msg) != 0)
+			return -1;
+		pthread_mutex_lock(&msg->amtx);
+		msg->consumers++;
+		pthread_mutex_unlock(&msg->amtx);
+		evm_message_delete(msg);
+		return 0;
+	}
+
+	/* Data already within our pool and referenced by nobody else goes as is. */
+	pthread_mutex_lock(&msg->amtx);
+	if ((msg->release == block_release) && (msg->data != NULL) && (msg->consumers == 0)) {
+		blk = (shm_block_struct *)msg->data - 1;
+		zero_copy = (blk->owner == shm);
+	}
+	pthread_mutex_unlock(&msg->amtx);
+
+	if (!zero_copy && (size > region->block_size) && (size > EVM_SHM_INLINE)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	/* Backpressure - the consumer falls behind. */
+	if (credit_take(shm) != 0) {
+		u2up_log_debug("No credits - message rejected!\n");
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if (!zero_copy && (size > EVM_SHM_INLINE)) {
+		if ((index = block_get(shm)) < 0) {
+			credit_grant(shm);
+			errno = EAGAIN;
+			return -1;
+		}
+		blk = block_ptr(shm, index);
+		memcpy(blk + 1, msg->data, size);
+	}
+
+	/* Reserve a slot. */
+	pos = __atomic_load_n(&region->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &shm->slots[pos & (region->slots_num - 1)];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&region->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((long)(seq - pos) < 0) {
+			/* Ring full. */
+			if (index >= 0)
+				block_put(shm, index);
+			credit_grant(shm);
+			errno = EAGAIN;
+			return -1;
+		} else {
+			pos = __atomic_load_n(&region->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->msgtype_id = msg->msgtype->id;
+	slot->msgid_id = msg->msgid->id;
+	slot->size = size;
+	if (zero_copy) {
+		slot->block = blk->index;
+		msg->release = NULL;
+		msg->data = NULL;
+	} else if (index >= 0) {
+		slot->block = index;
+	} else {
+		slot->block = -1;
+		if (size > 0)
+			memcpy(slot->data, msg->data, size);
+	}
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	shm_wake(shm);
+
+	/* Passed - drop the local message. */
+	pthread_mutex_lock(&msg->amtx);
+	msg->consumers++;
+	pthread_mutex_unlock(&msg->amtx);
+	evm_message_delete(msg);
+
+	return 0;
+}
+
+/*
+ * Local message out of a ring slot (pool block data not copied).
+ */
+static evm_message_struct * shm_message(evm_shm_struct *shm, shm_slot_struct *slot)
+{
+	evm_struct *evm = shm->consumer->evm;
+	evm_msgtype_struct *msgtype;
+	evm_msgid_struct *msgid = NULL;
+	evm_message_struct *msg = NULL;
+	shm_block_struct *blk;
+
+	if ((msgtype = evm_msgtype_get(evm, slot->msgtype_id)) != NULL)
+		msgid = evm_msgid_get(msgtype, slot->msgid_id);
+	if (msgid == NULL) {
+		u2up_log_error("Unknown message (type=%d, id=%d) dropped!\n", slot->msgtype_id, slot->msgid_id);
+	} else if (slot->block >= 0) {
+		if ((msg = evm_message_new(msgtype, msgid, 0)) != NULL) {
+			blk = block_ptr(shm, slot->block);
+			blk->owner = shm;
+			blk->size = slot->size;
+			msg->data = blk + 1;
+			msg->size = slot->size;
+			msg->release = credit_block_release;
+			msg->release_ctx = msg;
+			return msg;
+		}
+	} else {
+		if ((msg = evm_message_new(msgtype, msgid, slot->size)) != NULL) {
+			memcpy(msg->data, slot->data, slot->size);
+			msg->release = credit_release;
+			msg->release_ctx = shm;
+			return msg;
+		}
+	}
+
+	if (slot->block >= 0)
+		block_put(shm, slot->block);
+	credit_grant(shm);
+	return NULL;
+}
+
+static int shm_drain(evm_shm_struct *shm)
+{
+	shm_region_struct *region = shm->region;
+	shm_slot_struct *slot;
+	evm_message_struct *msg;
+	unsigned long pos = region->head;
+	int num;
+
+	for (num = 0; num < EVM_SHM_BATCH; num++) {
+		slot = &shm->slots[pos & (region->slots_num - 1)];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+			break;
+		msg = shm_message(shm, slot);
+		__atomic_store_n(&slot->seq, pos + region->slots_num, __ATOMIC_RELEASE);
+		pos++;
+		__atomic_store_n(&region->head, pos, __ATOMIC_RELAXED);
+		if ((msg != NULL) && (messages_pass(shm->consumer, msg, EVM_FALSE) != 0))
+			evm_message_delete(msg);
+	}
+
+	return num;
+}
+
+static int shm_pending(evm_shm_struct *shm)
+{
+	shm_region_struct *region = shm->region;
+	unsigned long pos = region->head;
+
+	return (__atomic_load_n(&shm->slots[pos & (region->slots_num - 1)].seq, __ATOMIC_ACQUIRE) == pos + 1);
+}
+
+/*
+ * Wakeup (eventfd watched within the consumer's epoll set).
+ */
+static int shm_handle(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx)
+{
+	evm_shm_struct *shm = (evm_shm_struct *)ctx;
+	uint64_t val = 1;
+	u2up_log_info("(cb entry) fd=%d\n", fd);
+
+	if (read(fd, &val, sizeof(val)) < 0) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+			u2up_log_system_error("read(): eventfd\n");
+		}
+	}
+
+	if (shm_drain(shm) < EVM_SHM_BATCH) {
+		/* Arm the wakeup and recheck - producers may have missed it. */
+		__atomic_store_n(&shm->region->armed, 1, __ATOMIC_SEQ_CST);
+		if (!shm_pending(shm) || (__atomic_exchange_n(&shm->region->armed, 0, __ATOMIC_SEQ_CST) == 0))
+			return 0;
+	}
+
+	/* Left behind (budget) - let other events in first. */
+	val = 1;
+	if (write(fd, &val, sizeof(val)) < 0) {
+		u2up_log_system_error("write(): eventfd\n");
+	}
+
+	return 0;
+}
+
+/*
+ * Memfd data messages (socket watched within the consumer's epoll set).
+ */
+static int shm_memfd_handle(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx)
+{
+	evm_shm_struct *shm = (evm_shm_struct *)ctx;
+	evm_message_struct *msg;
+	int num;
+	u2up_log_info("(cb entry) fd=%d\n", fd);
+
+	for (num = 0; num < EVM_SHM_BATCH; num++) {
+		if ((msg = memfds_recv(consumer->evm, fd)) == NULL)
+			break;
+		if (messages_pass(shm->consumer, msg, EVM_FALSE) != 0)
+			evm_message_delete(msg);
+	}
+
+	return 0;
+}
+
+/*
+ * Public API functions:
+ * - evm_shm_new()
+ * - evm_shm_delete()
+ * - evm_shm_attach()
+ * - evm_shm_consumer_add()
+ * - evm_shm_message_new()
+ */
+evmShmStruct * evm_shm_new(unsigned int slots, unsigned int blocks, size_t block_size)
+{
+	evm_shm_struct *shm;
+	shm_region_struct *region;
+	unsigned int i, slots_num = 2;
+	size_t offset;
+	u2up_log_info("(entry) slots=%u, blocks=%u, block_size=%zu\n", slots, blocks, block_size);
+
+	if (slots == 0)
+		return NULL;
+
+	while (slots_num < slots)
+		slots_num <<= 1;
+
+	if ((shm = (evm_shm_struct *)calloc(1, sizeof(evm_shm_struct))) == NULL) {
+		errno = ENOMEM;
+		u2up_log_system_error("calloc(): shm\n");
+		return NULL;
+	}
+	shm->block_stride = (sizeof(shm_block_struct) + block_size + EVM_SHM_CACHELINE - 1) & ~((size_t)EVM_SHM_CACHELINE - 1);
+	offset = sizeof(shm_region_struct);
+	offset += (size_t)slots_num * sizeof(shm_slot_struct);
+	offset += (size_t)blocks * sizeof(unsigned int);
+	offset = (offset + EVM_SHM_CACHELINE - 1) & ~((size_t)EVM_SHM_CACHELINE - 1);
+	shm->region_size = offset + (size_t)blocks * shm->block_stride;
+
+	region = mmap(NULL, shm->region_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED) {
+		u2up_log_system_error("mmap(): shm\n");
+		free(shm);
+		return NULL;
+	}
+	if ((shm->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		u2up_log_system_error("eventfd()\n");
+		munmap(region, shm->region_size);
+		free(shm);
+		return NULL;
+	}
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, shm->socks) < 0) {
+		u2up_log_system_error("socketpair()\n");
+		close(shm->event_fd);
+		munmap(region, shm->region_size);
+		free(shm);
+		return NULL;
+	}
+	shm->region = region;
+	shm->slots = (shm_slot_struct *)(region + 1);
+	shm->links = (unsigned int *)(shm->slots + slots_num);
+	shm->blocks = (char *)region + offset;
+
+	/* Shared mapping zeroed: empty ring (sequence numbers set), all blocks free. */
+	region->slots_num = slots_num;
+	region->blocks_num = blocks;
+	region->block_size = block_size;
+	region->armed = 1;
+	region->credits = slots_num;
+	for (i = 0; i < slots_num; i++)
+		shm->slots[i].seq = i;
+	for (i = 0; i < blocks; i++) {
+		block_ptr(shm, i)->index = i;
+		shm->links[i] = (i + 1 < blocks) ? i + 2 : 0;
+	}
+	region->free_top = (blocks > 0) ? 1 : 0;
+
+	return shm;
+}
+
+void evm_shm_delete(evmShmStruct *shm)
+{
+	u2up_log_info("(entry) shm=%p\n", shm);
+
+	if (shm == NULL)
+		return;
+
+	if (shm->consumer != NULL) {
+		evm_fd_del(shm->consumer, shm->event_fd);
+		evm_fd_del(shm->consumer, shm->socks[1]);
+	}
+	close(shm->event_fd);
+	close(shm->socks[0]);
+	close(shm->socks[1]);
+	munmap(shm->region, shm->region_size);
+	free(shm);
+}
+
+int evm_shm_attach(evmShmStruct *shm, evmConsumerStruct *consumer)
+{
+	u2up_log_info("(entry) shm=%p, consumer=%p\n", shm, consumer);
+
+	if ((shm == NULL) || (consumer == NULL) || (shm->consumer != NULL) || (consumer->shm != NULL))
+		return -1;
+
+	if (evm_fd_add(consumer, shm->event_fd, EPOLLIN, shm_handle, shm) < 0)
+		return -1;
+
+	if (evm_fd_add(consumer, shm->socks[1], EPOLLIN, shm_memfd_handle, shm) < 0) {
+		evm_fd_del(consumer, shm->event_fd);
+		return -1;
+	}
+
+	shm->consumer = consumer;
+	return 0;
+}
+
+evmConsumerStruct * evm_shm_consumer_add(evmStruct *evm, int id, evmShmStruct *shm)
+{
+	evmConsumerStruct *consumer;
+	u2up_log_info("(entry) evm=%p, id=%d, shm=%p\n", evm, id, shm);
+
+	if ((evm == NULL) || (shm == NULL) || (shm->consumer != NULL))
+		return NULL;
+
+	/* Never take over a (local) consumer with the same id. */
+	if (evm_consumer_get(evm, id) != NULL)
+		return NULL;
+
+	if ((consumer = evm_consumer_add(evm, id)) == NULL)
+		return NULL;
+
+	consumer->shm = shm;
+	return consumer;
+}
+
+evmMessageStruct * evm_shm_message_new(evmShmStruct *shm, evmMsgtypeStruct *msgtype, evmMsgidStruct *msgid, size_t size)
+{
+	evmMessageStruct *msg;
+	shm_block_struct *blk;
+	int index;
+	u2up_log_info("(entry) shm=%p, size=%zu\n", shm, size);
+
+	if ((shm == NULL) || (size > shm->region->block_size))
+		return NULL;
+
+	if ((index = block_get(shm)) < 0) {
+		errno = EAGAIN;
+		return NULL;
+	}
+	if ((msg = evm_message_new(msgtype, msgid, 0)) == NULL) {
+		block_put(shm, index);
+		return NULL;
+	}
+	blk = block_ptr(shm, index);
+	blk->owner = shm;
+	blk->size = size;
+	msg->data = blk + 1;
+	msg->size = size;
+	msg->release = block_release;
+	msg->release_ctx = msg;
+
+	return msg;
+}
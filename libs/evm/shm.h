@@ -0,0 +1,95 @@
+/*
+ * The EVM shared memory transport module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+
+#ifndef EVM_FILE_shm_h
+#define EVM_FILE_shm_h
+
+#ifdef EVM_FILE_shm_c
+/* PRIVATE usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN
+#else
+/* PUBLIC usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN extern
+#endif
+
+/* Ring slots drained per wakeup */
+#define EVM_SHM_BATCH 256
+/* Avoid false sharing between producers and the consumer */
+#define EVM_SHM_CACHELINE 64
+
+typedef struct shm_region shm_region_struct;
+typedef struct shm_slot shm_slot_struct;
+typedef struct shm_block shm_block_struct;
+
+/*Ring slot (sequence numbered - multiple producers, single consumer)*/
+struct shm_slot {
+	unsigned long seq;
+	int msgtype_id;
+	int msgid_id;
+	int block; /*pool block index (-1 - inline data)*/
+	unsigned int size;
+	char data[EVM_SHM_INLINE];
+}; /*shm_slot_struct*/
+
+/*Pool block header (followed by payload)*/
+struct shm_block {
+	evm_shm_struct *owner; /*process local transport of the current owner*/
+	unsigned int index;
+	unsigned int size;
+}; /*shm_block_struct*/
+
+/*Shared memory region header (followed by slots, free list links and blocks)*/
+struct shm_region {
+	unsigned long tail; /*producers*/
+	int credits; /*messages passable (granted back, when deleted by the consumer)*/
+	char pad0[EVM_SHM_CACHELINE - sizeof(unsigned long) - sizeof(int)];
+	unsigned long head; /*consumer*/
+	int armed; /*consumer waits for a wakeup*/
+	char pad1[EVM_SHM_CACHELINE - sizeof(unsigned long) - sizeof(int)];
+	unsigned long long free_top; /*free blocks stack (tag << 32 | index + 1)*/
+	char pad2[EVM_SHM_CACHELINE - sizeof(unsigned long long)];
+	unsigned int slots_num; /*power of 2*/
+	unsigned int blocks_num;
+	size_t block_size; /*payload bytes per block*/
+}; /*shm_region_struct*/
+
+/*Process local view of the transport (inherited across fork())*/
+struct evm_shm {
+	shm_region_struct *region;
+	size_t region_size;
+	shm_slot_struct *slots;
+	unsigned int *links; /*free blocks stack links (index + 1, 0 - end)*/
+	char *blocks;
+	size_t block_stride;
+	int event_fd; /*consumer wakeups (process-shared)*/
+	int socks[2]; /*memfd data passing (0 - producers, 1 - consumer)*/
+	evm_consumer_struct *consumer; /*attached receiving consumer*/
+}; /*evm_shm_struct*/
+
+/*
+ * Pass message to a remote consumer (through its shm transport).
+ */
+EXTERN int shm_pass(evm_consumer_struct *consumer_ptr, evm_message_struct *msg_ptr);
+
+#endif /*EVM_FILE_shm_h*/
@@ -0,0 +1,170 @@
+/*
+ * The EVM signals module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_signals_c
+#define EVM_FILE_signals_c
+#else
+#error Preprocesor macro EVM_FILE_signals_c conflict!
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include <sys/epoll.h>
+
+#include "evm/libevm.h"
+
+#include "evm.h"
+#include "signals.h"
+
+#define U2UP_LOG_NAME EVM_SIGS
+#include <u2up-log/u2up-log.h>
+
+static int sigs_handle(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx);
+
+/*
+ * Signals pending (signalfd watched within the consumer's epoll set).
+ */
+static int sigs_handle(evm_consumer_struct *consumer, int fd, unsigned int revents, void *ctx)
+{
+	signals_set_struct *signals = (signals_set_struct *)ctx;
+	struct signalfd_siginfo infos[EVM_SIGNALS_BATCH];
+	int (*sig_handle)(evm_consumer_struct *consumer, const struct signalfd_siginfo *info);
+	ssize_t n;
+	int i, num = EVM_SIGNALS_BATCH; /*EINTR retries the read*/
+	u2up_log_info("(cb entry) fd=%d\n", fd);
+
+	do {
+		if ((n = read(fd, infos, sizeof(infos))) < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+				u2up_log_system_error("read(): signalfd\n");
+			break;
+		}
+		num = n / sizeof(struct signalfd_siginfo);
+		for (i = 0; i < num; i++) {
+			if ((infos[i].ssi_signo >= NSIG) || ((sig_handle = signals->sig_handle[infos[i].ssi_signo]) == NULL))
+				continue;
+			if (sig_handle(consumer, &infos[i]) < 0)
+				u2up_log_debug("sig_handle() failed (signo=%u)\n", infos[i].ssi_signo);
+		}
+	} while (num == EVM_SIGNALS_BATCH);
+
+	return 0;
+}
+
+void signals_consumer_free(evm_consumer_struct *consumer)
+{
+	signals_set_struct *signals = consumer->signals;
+	u2up_log_info("(entry)\n");
+
+	if (signals == NULL)
+		return;
+
+	close(signals->fd);
+	free(signals);
+	consumer->signals = NULL;
+}
+
+/*
+ * Public API functions:
+ * - evm_signal_add()
+ * - evm_signal_del()
+ */
+int evm_signal_add(evmConsumerStruct *consumer, int signo, int (*sig_handle)(evmConsumerStruct *consumer, const struct signalfd_siginfo *info))
+{
+	signals_set_struct *signals;
+	sigset_t block;
+	u2up_log_info("(entry) signo=%d\n", signo);
+
+	if ((consumer == NULL) || (signo <= 0) || (signo >= NSIG) || (sig_handle == NULL))
+		return -1;
+
+	if ((signo == SIGKILL) || (signo == SIGSTOP))
+		return -1;
+
+	if ((signals = consumer->signals) == NULL) {
+		if ((signals = (signals_set_struct *)calloc(1, sizeof(signals_set_struct))) == NULL) {
+			errno = ENOMEM;
+			u2up_log_system_error("calloc(): signals\n");
+			return -1;
+		}
+		sigemptyset(&signals->mask);
+		if ((signals->fd = signalfd(-1, &signals->mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+			u2up_log_system_error("signalfd()\n");
+			free(signals);
+			return -1;
+		}
+		if (evm_fd_add(consumer, signals->fd, EPOLLIN, sigs_handle, signals) < 0) {
+			close(signals->fd);
+			free(signals);
+			return -1;
+		}
+		consumer->signals = signals;
+	}
+
+	/* Delivered via signalfd only, when blocked (inherited by new threads). */
+	sigemptyset(&block);
+	sigaddset(&block, signo);
+	if (pthread_sigmask(SIG_BLOCK, &block, NULL) != 0) {
+		u2up_log_system_error("pthread_sigmask()\n");
+		return -1;
+	}
+
+	signals->sig_handle[signo] = sig_handle;
+	sigaddset(&signals->mask, signo);
+	if (signalfd(signals->fd, &signals->mask, 0) < 0) {
+		u2up_log_system_error("signalfd(): signo=%d\n", signo);
+		signals->sig_handle[signo] = NULL;
+		sigdelset(&signals->mask, signo);
+		return -1;
+	}
+
+	return 0;
+}
+
+int evm_signal_del(evmConsumerStruct *consumer, int signo)
+{
+	signals_set_struct *signals;
+	u2up_log_info("(entry) signo=%d\n", signo);
+
+	if ((consumer == NULL) || ((signals = consumer->signals) == NULL))
+		return -1;
+
+	if ((signo <= 0) || (signo >= NSIG) || (signals->sig_handle[signo] == NULL))
+		return -1;
+
+	/* Signal remains blocked (pending ones not lost). */
+	signals->sig_handle[signo] = NULL;
+	sigdelset(&signals->mask, signo);
+	if (signalfd(signals->fd, &signals->mask, 0) < 0) {
+		u2up_log_system_error("signalfd(): signo=%d\n", signo);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * The EVM signals module
+ *
+ * This file is part of the "evm" software project which is
+ * provided under the Apache license, Version 2.0.
+ *
+ *  Copyright 2019 Samo Pogacnik <samo_pogacnik@t-2.net>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+*/
+
+#ifndef EVM_FILE_signals_h
+#define EVM_FILE_signals_h
+
+#ifdef EVM_FILE_signals_c
+/* PRIVATE usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN
+#else
+/* PUBLIC usage of the PUBLIC part. */
+#	undef EXTERN
+#	define EXTERN extern
+#endif
+
+#include <signal.h>
+
+/* Signal infos read per read() */
+#define EVM_SIGNALS_BATCH 16
+
+/*Per consumer signals (signalfd watched within its epoll set)*/
+struct signals_set {
+	int fd; /*signalfd*/
+	sigset_t mask; /*signals handled*/
+	int (*sig_handle[NSIG])(evm_consumer_struct *consumer, const struct signalfd_siginfo *info);
+}; /*signals_set_struct*/
+
+/*
+ * Free consumer's signals (its signalfd closed, signals remain blocked).
+ */
+EXTERN void signals_consumer_free(evm_consumer_struct *consumer_ptr);
+
+#endif /*EVM_FILE_signals_h*/
@@ -42,6 +42,9 @@
 #include <u2up-log/u2up-log.h>
 
 static evm_timer_struct * tmr_dequeue(evm_consumer_struct *consumer);
+static evm_timer_struct * tmr_new(evm_consumer_struct *consumer, evm_tmrid_struct *tmrid, const struct timespec *now, time_t tv_sec, long tv_nsec, void *ctx);
+static int tmr_stamp_before(const struct timespec *a, const struct timespec *b);
+static evm_timer_struct * tmr_list_sort(evm_timer_struct *list);
 
 /*
  * Per consumer timers initialization.
@@ -125,8 +128,8 @@ evm_timer_struct * timers_check(evm_consumer_struct *consumer)
 	u2up_log_debug("(entry) tmr=%p\n", tmr);
 	if (tmr != NULL) {
 		pthread_mutex_lock(&tmr->amtx);
-		if (clock_gettime(CLOCK_REALTIME, &time_stamp) == -1) {
-			u2up_log_system_error("clock_gettime()\n");
+		if (evm_clock_gettime(consumer->evm, &time_stamp) == -1) {
+			u2up_log_system_error("evm_clock_gettime()\n");
 			pthread_mutex_unlock(&tmr->amtx);
 			return NULL;
 		}
@@ -147,6 +150,29 @@ evm_timer_struct * timers_check(evm_consumer_struct *consumer)
 	return NULL;
 }
 
+/*
+ * Returns true, if the first timer in the consumer's queue expired.
+ */
+int timers_pending(evm_consumer_struct *consumer)
+{
+	int pending = EVM_FALSE;
+	struct timespec time_stamp;
+	tmrs_queue_struct *tmrs_queue;
+
+	if ((consumer == NULL) || ((tmrs_queue = consumer->tmrs_queue) == NULL))
+		return EVM_FALSE;
+
+	if (evm_clock_gettime(consumer->evm, &time_stamp) == -1)
+		return EVM_FALSE;
+
+	pthread_mutex_lock(&tmrs_queue->access_mutex);
+	if (tmrs_queue->first_tmr != NULL)
+		pending = !tmr_stamp_before(&time_stamp, &tmrs_queue->first_tmr->tm_stamp);
+	pthread_mutex_unlock(&tmrs_queue->access_mutex);
+
+	return pending;
+}
+
 struct timespec * timers_next_ts(evm_consumer_struct *consumer)
 {
 	struct timespec *ts;
@@ -179,6 +205,91 @@ struct timespec * timers_next_ts(evm_consumer_struct *consumer)
 	return ts;
 }
 
+/*
+ * Timer object allocation with its expiration time stamp set
+ * relative to the provided "now" (normalized nanoseconds).
+ */
+static evm_timer_struct * tmr_new(evm_consumer_struct *consumer, evm_tmrid_struct *tmrid, const struct timespec *now, time_t tv_sec, long tv_nsec, void *ctx)
+{
+	evm_timer_struct *new;
+
+	new = (evm_timer_struct *)calloc(1, sizeof(evm_timer_struct));
+	if (new == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	pthread_mutex_init(&new->amtx, NULL);
+	pthread_mutex_unlock(&new->amtx);
+	new->tmrid = tmrid;
+	new->consumer = consumer;
+	new->saved = 0;
+	new->stopped = 0;
+	new->ctx = ctx;
+
+	new->tm_stamp.tv_sec = now->tv_sec + tv_sec;
+	new->tm_stamp.tv_nsec = now->tv_nsec + tv_nsec;
+	while (new->tm_stamp.tv_nsec >= 1000000000L) {
+		new->tm_stamp.tv_sec++;
+		new->tm_stamp.tv_nsec -= 1000000000L;
+	}
+
+	return new;
+}
+
+/*
+ * Returns true, if time stamp "a" is strictly before time stamp "b".
+ */
+static int tmr_stamp_before(const struct timespec *a, const struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return (a->tv_sec < b->tv_sec);
+
+	return (a->tv_nsec < b->tv_nsec);
+}
+
+/*
+ * Stable merge sort of a "next" linked list of timers by expiration.
+ * Returns the new list head.
+ */
+static evm_timer_struct * tmr_list_sort(evm_timer_struct *list)
+{
+	evm_timer_struct *a, *b, *slow, *fast;
+	evm_timer_struct head, *tail;
+
+	if ((list == NULL) || (list->next == NULL))
+		return list;
+
+	/* Split the list in halves. */
+	slow = list;
+	fast = list->next;
+	while ((fast != NULL) && (fast->next != NULL)) {
+		slow = slow->next;
+		fast = fast->next->next;
+	}
+	b = slow->next;
+	slow->next = NULL;
+
+	a = tmr_list_sort(list);
+	b = tmr_list_sort(b);
+
+	/* Merge (equal stamps keep their original order). */
+	tail = &head;
+	while ((a != NULL) && (b != NULL)) {
+		if (tmr_stamp_before(&b->tm_stamp, &a->tm_stamp)) {
+			tail->next = b;
+			b = b->next;
+		} else {
+			tail->next = a;
+			a = a->next;
+		}
+		tail = tail->next;
+	}
+	tail->next = (a != NULL) ? a : b;
+
+	return head.next;
+}
+
 /*
  * Public API functions:
  * - evm_tmrid_add()
@@ -313,6 +424,7 @@ evmTimerStruct * evm_timer_start(evmConsumerStruct *consumer, evmTmridStruct *tm
 {
 	evmTimerStruct *new;
 	evm_timer_struct *prev, *tmr;
+	struct timespec now;
 	tmrs_queue_struct *tmrs_queue;
 	pthread_mutex_t *tmrs_queue_amtx;
 	u2up_log_info("(entry) consumer=%p\n", consumer);
@@ -333,29 +445,13 @@ evmTimerStruct * evm_timer_start(evmConsumerStruct *consumer, evmTmridStruct *tm
 	else
 		return NULL;
 
-	new = (evmTimerStruct *)calloc(1, sizeof(evmTimerStruct));
-	if (new == NULL) {
-		errno = ENOMEM;
+	if (evm_clock_gettime(consumer->evm, &now) == -1) {
+		u2up_log_system_error("evm_clock_gettime()\n");
 		return NULL;
 	}
 
-	pthread_mutex_init(&new->amtx, NULL);
-	pthread_mutex_unlock(&new->amtx);
-	new->tmrid = tmrid;
-	new->consumer = consumer;
-	new->saved = 0;
-	new->stopped = 0;
-	new->ctx = ctx;
-
-	if (clock_gettime(CLOCK_REALTIME, &new->tm_stamp) == -1) {
-		u2up_log_system_error("clock_gettime()\n");
-		free(new);
-		new = NULL;
+	if ((new = tmr_new(consumer, tmrid, &now, tv_sec, tv_nsec, ctx)) == NULL)
 		return NULL;
-	}
-
-	new->tm_stamp.tv_sec += tv_sec;
-	new->tm_stamp.tv_nsec += tv_nsec;
 
 	u2up_log_debug("New timer: ptr=%p, new(sec)=%ld, new(nsec)=%ld\n", (void *)new, new->tm_stamp.tv_sec, new->tm_stamp.tv_nsec);
 
@@ -399,6 +495,101 @@ evmTimerStruct * evm_timer_start(evmConsumerStruct *consumer, evmTmridStruct *tm
 	return new;
 }
 
+/*
+ * Public API function:
+ * - evm_timer_start_many()
+ */
+int evm_timer_start_many(evmConsumerStruct *consumer, evmTimerArmStruct *arms, int count)
+{
+	int i;
+	evm_timer_struct *new, *list, *tail, *tmr, *prev;
+	struct timespec now;
+	tmrs_queue_struct *tmrs_queue;
+	pthread_mutex_t *tmrs_queue_amtx;
+	u2up_log_info("(entry) consumer=%p, count=%d\n", consumer, count);
+
+	if (consumer == NULL) {
+		u2up_log_error("Event machine consumer object undefined!\n");
+		return -1;
+	}
+
+	if ((arms == NULL) || (count < 0))
+		return -1;
+
+	tmrs_queue = consumer->tmrs_queue;
+	if (tmrs_queue != NULL)
+		tmrs_queue_amtx = &tmrs_queue->access_mutex;
+	else
+		return -1;
+
+	/* Single clock read for all timers in the batch. */
+	if (evm_clock_gettime(consumer->evm, &now) == -1) {
+		u2up_log_system_error("evm_clock_gettime()\n");
+		return -1;
+	}
+
+	/* Prepare all new timers in a private list (no locking required). */
+	list = NULL;
+	tail = NULL;
+	for (i = 0; i < count; i++) {
+		arms[i].timer = NULL;
+		if (arms[i].tmrid == NULL) {
+			u2up_log_error("Event machine tmrid object undefined (arms[%d])!\n", i);
+			continue;
+		}
+		if ((new = tmr_new(consumer, arms[i].tmrid, &now, arms[i].tv_sec, arms[i].tv_nsec, arms[i].ctx)) == NULL) {
+			u2up_log_system_error("calloc(): timer (arms[%d])\n", i);
+			break;
+		}
+		arms[i].timer = new;
+		if (tail == NULL)
+			list = new;
+		else
+			tail->next = new;
+		tail = new;
+	}
+
+	if (i < count) {
+		/* Allocation failed - nothing has been started yet, roll back. */
+		while (list != NULL) {
+			new = list;
+			list = list->next;
+			free(new);
+		}
+		for (i = 0; i < count; i++)
+			arms[i].timer = NULL;
+		return -1;
+	}
+
+	list = tmr_list_sort(list);
+
+	/* Merge the sorted batch into the sorted timers queue in a single pass. */
+	pthread_mutex_lock(tmrs_queue_amtx);
+	tmr = tmrs_queue->first_tmr;
+	prev = NULL;
+	count = 0;
+	while (list != NULL) {
+		new = list;
+		/* Existing timers with equal stamps expire first (as in evm_timer_start()). */
+		while ((tmr != NULL) && !tmr_stamp_before(&new->tm_stamp, &tmr->tm_stamp)) {
+			prev = tmr;
+			tmr = tmr->next;
+		}
+		list = list->next;
+		new->next = tmr;
+		if (prev == NULL)
+			tmrs_queue->first_tmr = new;
+		else
+			prev->next = new;
+		prev = new;
+		count++;
+	}
+	pthread_mutex_unlock(tmrs_queue_amtx);
+
+	u2up_log_debug("Started %d timers in a batch\n", count);
+	return count;
+}
+
 int evm_timer_stop(evmTimerStruct *tmr)
 {
 	evmTimerStruct *curr = NULL;
@@ -482,6 +673,32 @@ void * evm_timer_ctx_get(evmTimerStruct *tmr)
 	return ctx;
 }
 
+/*
+ * Public API function:
+ * - evm_consumer_next_deadline()
+ */
+int evm_consumer_next_deadline(evmConsumerStruct *consumer, struct timespec *ts)
+{
+	int rv = 0;
+	tmrs_queue_struct *tmrs_queue;
+	u2up_log_info("(entry) consumer=%p\n", consumer);
+
+	if ((consumer == NULL) || (ts == NULL))
+		return -1;
+
+	if ((tmrs_queue = consumer->tmrs_queue) == NULL)
+		return 0;
+
+	pthread_mutex_lock(&tmrs_queue->access_mutex);
+	if (tmrs_queue->first_tmr != NULL) {
+		*ts = tmrs_queue->first_tmr->tm_stamp;
+		rv = 1;
+	}
+	pthread_mutex_unlock(&tmrs_queue->access_mutex);
+
+	return rv;
+}
+
 /*
  * Public API function:
  * - evm_timer_delete()
@@ -46,5 +46,6 @@ struct tmrs_queue {
 EXTERN tmrs_queue_struct * timers_queue_init(evm_consumer_struct *consumer_ptr);
 EXTERN evm_timer_struct * timers_check(evm_consumer_struct *consumer_ptr);
 EXTERN struct timespec * timers_next_ts(evm_consumer_struct *consumer_ptr);
+EXTERN int timers_pending(evm_consumer_struct *consumer_ptr);
 
 #endif /*EVM_FILE_timers_h*/